@@ -1,14 +1,20 @@
 #include "ai_backend.h"
+#include "ai_breaker.h"
+#include "ai_endpoints.h"
+#include "ai_local.h"
+#include "ai_ratelimit.h"
+#include "ai_router.h"
+#include "json_extract.h"
+#include "ollama_opts.h"
 #include "shell.h"
 #include <curl/curl.h>
 #include <jansson.h>
+#include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
-
-/* Forward declarations for functions used in init */
-static int ollama_check_available_internal(void);
-static OllamaModelList *ollama_list_models_internal(void);
-static void ollama_model_list_free_internal(OllamaModelList *list);
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 /* Backend configurations */
 static AIBackendConfig backends[AI_BACKEND_COUNT] = {
@@ -21,12 +27,169 @@ static AIBackendConfig backends[AI_BACKEND_COUNT] = {
     {AI_BACKEND_DEEPSEEK, "deepseek", "DEEPSEEK_API_KEY", "deepseek-chat",
      "https://api.deepseek.com/v1/chat/completions", 0},
     {AI_BACKEND_OLLAMA, "ollama", "OLLAMA_HOST", "llama3.2",
-     "http://localhost:11434/api/generate", 0}
+     "http://localhost:11434/api/chat", 0},
+    {AI_BACKEND_LOCAL, "local", "CORTEX_LOCAL_MODEL", "", "", 0}
 };
 
-static AIBackendType active_backend = AI_BACKEND_GEMINI;
-static char current_model[256] = {0};
+/*
+ * The shell's selection, which the client-less API acts on. Written
+ * under client_lock; other threads read it only through ai_client_init.
+ */
+static AIClient default_client = {AI_BACKEND_GEMINI, "", 1, 0, 0, 0, 0};
+static pthread_mutex_t client_lock = PTHREAD_MUTEX_INITIALIZER;
 static int curl_initialized = 0;
+static int cascade_enabled = 0;     /* 'ai cascade on': a fast model answers first */
+static long hedge_delay_ms = 0;    /* 0 = derive from observed p95 */
+static long context_budget = 0;    /* 0 = per-backend default */
+
+/* Context token budgets */
+#define CONTEXT_BUDGET_LOCAL 1536
+#define CONTEXT_BUDGET_CLOUD 6144
+#define CONTEXT_BUDGET_MIN 256
+#define CONTEXT_REPLY_RESERVE 512       /* Kept free in num_ctx when num_predict is unset */
+
+/* How long a query may wait out rate limits, over at most this many 429s */
+#define RATELIMIT_WAIT_MS 30000L
+#define RATELIMIT_RETRIES 4
+#define RATELIMIT_NOTICE_MS 1000        /* Longer waits are announced */
+
+static long ratelimit_wait_ms = RATELIMIT_WAIT_MS;
+
+/* Hedge delay bounds when derived from latency samples */
+#define HEDGE_DEFAULT_DELAY_MS 1500
+#define HEDGE_MIN_DELAY_MS 200
+
+/*
+ * Request timeouts. The connect timeout follows the backend's p95
+ * connection setup time. A request is dropped once the server sends
+ * nothing for longer than a few times the usual wait: the p99 time to
+ * the first byte when streaming, the model's p99 answer time otherwise
+ * (a whole answer arrives at once). Until there are samples the defaults
+ * apply. The total is only a fixed backstop, so a long answer that keeps
+ * arriving is never cut off.
+ */
+#define STALL_TIMEOUT_CLOUD_MS 30000L
+#define STALL_TIMEOUT_LOCAL_MS 120000L
+#define STALL_TIMEOUT_MIN_MS 10000L
+#define REQUEST_TIMEOUT_MAX_MS 600000L  /* Total, and the cap on the stall timeout */
+#define CONNECT_TIMEOUT_MS 10000L       /* Default, and the cap */
+#define CONNECT_TIMEOUT_MIN_MS 1000L
+#define TIMEOUT_HEADROOM 3              /* Multiple of the percentile allowed */
+
+/* Recent latency samples per backend */
+#define LATENCY_SAMPLES 32
+
+typedef struct {
+    long ms[LATENCY_SAMPLES];
+    int count;
+    int next;
+} LatencyRing;
+
+static LatencyRing backend_ttfb[AI_BACKEND_COUNT];
+static LatencyRing backend_connect[AI_BACKEND_COUNT];   /* New connections only */
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Idle easy handles kept per backend so keep-alive connections survive */
+#define CURL_POOL_SIZE 4
+
+typedef struct {
+    CURL *idle[CURL_POOL_SIZE];
+    int idle_count;
+    AIPoolStats stats;
+} CurlPool;
+
+static CurlPool curl_pools[AI_BACKEND_COUNT];
+static pthread_mutex_t curl_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static CURLSH *curl_share = NULL;
+static pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+
+/* In-process cache of Ollama /api/tags */
+#define OLLAMA_TAGS_TTL 60     /* Seconds a fetched model list stays fresh */
+#define OLLAMA_DOWN_TTL 5      /* Seconds before re-probing an unreachable server */
+#define OLLAMA_ETAG_SIZE 128
+#define OLLAMA_EMBED_CONNECT_MS 1000L
+#define OLLAMA_EMBED_TIMEOUT_MS 5000L   /* Includes loading the embedding model */
+#define TASK_TYPE_COUNT (TASK_EXPLANATION + 1)
+
+typedef struct {
+    OllamaModelList *list;             /* Models of every endpoint, NULL if none answered */
+    unsigned long long digest;         /* Hash of (name, modified_at) pairs */
+    OllamaModelList *node_list[AI_ENDPOINT_MAX];    /* Per endpoint, NULL if unreachable */
+    char etag[AI_ENDPOINT_MAX][OLLAMA_ETAG_SIZE];
+    char best[TASK_TYPE_COUNT][256];   /* Best model per task, rebuilt on change */
+    char fast[TASK_TYPE_COUNT][256];   /* Best MODEL_CAP_FAST model per task, "" if none */
+    int reachable;
+    time_t checked_at;                 /* Monotonic seconds, 0 = never */
+    AIModelCacheStats stats;
+} OllamaTagsCache;
+
+static OllamaTagsCache ollama_tags;
+static long ollama_tags_ttl = OLLAMA_TAGS_TTL;
+static pthread_mutex_t tags_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+ * Startup probe of a local Ollama server. It runs on its own thread so the
+ * first prompt is not held up by connect timeouts; every entry point that
+ * reads backend state joins it first, so the thread never races the shell.
+ */
+typedef enum {
+    PROBE_NONE = 0,     /* Nothing to probe */
+    PROBE_RUNNING,      /* Thread started, not yet joined */
+    PROBE_DEFERRED,     /* No thread; probe on first use */
+    PROBE_DONE
+} ProbeState;
+
+static ProbeState probe_state = PROBE_NONE;
+static pthread_t probe_thread;
+static int probe_result = 0;
+static atomic_int probe_cancel = 0;
+static pthread_mutex_t probe_lock = PTHREAD_MUTEX_INITIALIZER;   /* Threads that wait on it */
+
+/*
+ * Model warm-up: an empty generate makes Ollama load the model it will be
+ * asked first while the user is still typing. Own thread and own handle,
+ * since queries may run meanwhile; only one warm-up at a time.
+ */
+#define OLLAMA_WARM_TIMEOUT 300L
+
+static pthread_t warm_thread;
+static int warm_started = 0;        /* warm_thread still needs a join */
+static int warm_enabled = 1;
+static atomic_int warm_done = 0;
+static atomic_int warm_cancel = 0;
+static char warm_url[256];
+static char *warm_payload = NULL;
+
+/*
+ * Single-flight: a query identical to one in progress waits for it, and
+ * one repeated within the reuse window gets a copy of its result, so each
+ * distinct (backend, model, prompt, conversation) costs one provider request.
+ */
+#define FLIGHT_SLOTS 16
+#define FLIGHT_WINDOW_MS 10000
+
+typedef enum {
+    FLIGHT_EMPTY = 0,
+    FLIGHT_RUNNING,
+    FLIGHT_DONE
+} FlightState;
+
+typedef struct {
+    unsigned long long key;
+    FlightState state;
+    int waiters;
+    int success;
+    char *content;
+    char *error_message;
+    long done_ms;
+} FlightSlot;
+
+static FlightSlot flights[FLIGHT_SLOTS];
+static pthread_mutex_t flight_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flight_cond = PTHREAD_COND_INITIALIZER;
+static long flight_window_ms = FLIGHT_WINDOW_MS;
+static AIFlightStats flight_stats;
 
 /* CURL memory struct for response */
 struct MemoryChunk {
@@ -34,61 +197,142 @@ struct MemoryChunk {
     size_t size;
 };
 
+/* Append bytes to a chunk, keeping it NUL-terminated */
+static int chunk_append(struct MemoryChunk *mem, const char *data, size_t len) {
+    char *ptr = realloc(mem->memory, mem->size + len + 1);
+    if (!ptr) return -1;
+
+    mem->memory = ptr;
+    memcpy(&(mem->memory[mem->size]), data, len);
+    mem->size += len;
+    mem->memory[mem->size] = 0;
+    return 0;
+}
+
 /* CURL write callback */
 static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
     size_t realsize = size * nmemb;
     struct MemoryChunk *mem = (struct MemoryChunk *)userp;
 
-    char *ptr = realloc(mem->memory, mem->size + realsize + 1);
-    if (!ptr) return 0;
-
-    mem->memory = ptr;
-    memcpy(&(mem->memory[mem->size]), contents, realsize);
-    mem->size += realsize;
-    mem->memory[mem->size] = 0;
+    if (chunk_append(mem, contents, realsize) != 0) return 0;
     return realsize;
 }
 
-/* Helper function to set common CURL performance options */
-static void set_curl_performance_options(CURL *curl, long timeout) {
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
-    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);  /* Enable TCP keep-alive */
-    curl_easy_setopt(curl, CURLOPT_FORBID_REUSE, 0L);   /* Allow connection reuse */
-}
+/* Get a handle for a backend, reusing an idle one when possible */
+static CURL *curl_pool_acquire(AIBackendType type) {
+    CurlPool *pool = &curl_pools[type];
+    CURL *curl = NULL;
+
+    pthread_mutex_lock(&curl_pool_lock);
+    if (pool->idle_count > 0) {
+        curl = pool->idle[--pool->idle_count];
+        pool->stats.handle_hits++;
+    } else {
+        pool->stats.handle_misses++;
+    }
+    pthread_mutex_unlock(&curl_pool_lock);
 
-/* Internal helper: Check if Ollama is available */
-static int ollama_check_available_internal(void) {
-    CURL *curl;
-    CURLcode res;
-    struct MemoryChunk chunk = {0};
-    int available = 0;
-    
-    char *host = getenv("OLLAMA_HOST");
-    if (!host) host = "http://localhost:11434";
-    
-    curl = curl_easy_init();
-    
     if (curl) {
-        char url[256];
-        snprintf(url, sizeof(url), "%s/api/tags", host);
-        
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &chunk);
-        curl_easy_setopt(curl, CURLOPT_TIMEOUT, 5L);
-        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 3L);
-        
-        res = curl_easy_perform(curl);
-        
-        if (res == CURLE_OK && chunk.memory) {
-            available = 1;
+        /* Reset options only - live connections and caches are kept */
+        curl_easy_reset(curl);
+    } else if (!(curl = curl_easy_init())) {
+        return NULL;
+    }
+
+    if (curl_share) {
+        curl_easy_setopt(curl, CURLOPT_SHARE, curl_share);
+    }
+    return curl;
+}
+
+/* Return a handle to its backend pool after a transfer */
+static void curl_pool_release(AIBackendType type, CURL *curl) {
+    CurlPool *pool = &curl_pools[type];
+    long new_connects = 0;
+
+    if (!curl) return;
+
+    /* A transfer that opened no new connection rode on a warm one */
+    int counted = curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &new_connects) == CURLE_OK;
+
+    pthread_mutex_lock(&curl_pool_lock);
+    if (counted) {
+        if (new_connects > 0) pool->stats.conn_new += new_connects;
+        else pool->stats.conn_reused++;
+    }
+    if (pool->idle_count < CURL_POOL_SIZE) {
+        pool->idle[pool->idle_count++] = curl;
+        curl = NULL;
+    }
+    pthread_mutex_unlock(&curl_pool_lock);
+
+    if (curl) curl_easy_cleanup(curl);
+}
+
+/* Handles on different threads reach the share through these */
+static void share_lock(CURL *curl, curl_lock_data data, curl_lock_access access, void *userptr) {
+    (void)curl;
+    (void)access;
+    (void)userptr;
+    pthread_mutex_lock(&share_locks[data]);
+}
+
+static void share_unlock(CURL *curl, curl_lock_data data, void *userptr) {
+    (void)curl;
+    (void)userptr;
+    pthread_mutex_unlock(&share_locks[data]);
+}
+
+/* Drop every pooled handle and the shared cache */
+static void curl_pool_cleanup(void) {
+    for (int i = 0; i < AI_BACKEND_COUNT; i++) {
+        while (curl_pools[i].idle_count > 0) {
+            curl_easy_cleanup(curl_pools[i].idle[--curl_pools[i].idle_count]);
         }
-        
-        curl_easy_cleanup(curl);
-        free(chunk.memory);
     }
-    
-    return available;
+    if (curl_share) {
+        curl_share_cleanup(curl_share);
+        curl_share = NULL;
+    }
+}
+
+/* Seconds on the monotonic clock, never 0 */
+static time_t monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1;
+}
+
+static long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* FNV-1a over a field, with a separator so fields cannot run together */
+static unsigned long long fnv_field(unsigned long long hash, const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    hash ^= 0xff;
+    hash *= 1099511628211ULL;
+    return hash;
+}
+
+static unsigned long long fnv_string(unsigned long long hash, const char *text) {
+    return fnv_field(hash, text ? text : "", text ? strlen(text) : 0);
+}
+
+/* Helper function to set common CURL performance options */
+static void set_curl_performance_options(CURL *curl, long connect_ms, long stall_ms, long timeout_ms) {
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, connect_ms);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout_ms);
+    /* Under 1 byte/s for the whole stall time: the server has gone quiet */
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (stall_ms + 999) / 1000);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);  /* Enable TCP keep-alive */
+    curl_easy_setopt(curl, CURLOPT_FORBID_REUSE, 0L);   /* Allow connection reuse */
 }
 
 /* Internal helper: Determine model capabilities from name */
@@ -113,192 +357,740 @@ static int get_model_capabilities_internal(const char *model_name) {
     /* Fast/small models */
     if (strstr(model_name, "tiny") || strstr(model_name, "small") ||
         strstr(model_name, "mini") || strstr(model_name, "1b") ||
-        strstr(model_name, "3b")) {
+        strstr(model_name, "3b") || strstr(model_name, "haiku") ||
+        strstr(model_name, "lite")) {
         caps |= MODEL_CAP_FAST;
     }
     
     return caps;
 }
 
-/* Internal helper: List Ollama models */
-static OllamaModelList *ollama_list_models_internal(void) {
-    OllamaModelList *list = calloc(1, sizeof(OllamaModelList));
-    if (!list) return NULL;
-    
-    CURL *curl;
-    CURLcode res;
-    struct MemoryChunk chunk = {0};
-    
-    char *host = getenv("OLLAMA_HOST");
-    if (!host) host = "http://localhost:11434";
+/* Internal helper: Free model list */
+static void ollama_model_list_free_internal(OllamaModelList *list) {
+    if (!list) return;
     
+    for (int i = 0; i < list->count; i++) {
+        free(list->models[i].name);
+        free(list->models[i].modified_at);
+    }
+    free(list->models);
+    free(list);
+}
+
+/* Internal helper: Parse an /api/tags body into a model list */
+static OllamaModelList *ollama_parse_tags(const char *body) {
+    json_error_t error;
+    json_t *root = json_loads(body, 0, &error);
+    if (!root) return NULL;
     
-    curl = curl_easy_init();
+    OllamaModelList *list = calloc(1, sizeof(OllamaModelList));
+    if (!list) {
+        json_decref(root);
+        return NULL;
+    }
     
-    if (curl) {
-        char url[256];
-        snprintf(url, sizeof(url), "%s/api/tags", host);
+    json_t *models = json_object_get(root, "models");
+    if (models && json_is_array(models) && json_array_size(models) > 0) {
+        size_t model_count = json_array_size(models);
+        list->models = calloc(model_count, sizeof(OllamaModel));
+        if (list->models) list->count = (int)model_count;
         
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &chunk);
-        curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
-        
-        res = curl_easy_perform(curl);
-        
-        if (res == CURLE_OK && chunk.memory) {
-            json_error_t error;
-            json_t *root = json_loads(chunk.memory, 0, &error);
+        for (int i = 0; i < list->count; i++) {
+            json_t *model = json_array_get(models, (size_t)i);
+            json_t *name = json_object_get(model, "name");
+            json_t *modified = json_object_get(model, "modified_at");
+            json_t *size = json_object_get(model, "size");
             
-            if (root) {
-                json_t *models = json_object_get(root, "models");
-                if (models && json_is_array(models)) {
-                    size_t model_count = json_array_size(models);
-                    list->models = calloc(model_count, sizeof(OllamaModel));
-                    list->count = (int)model_count;
-                    
-                    for (size_t i = 0; i < model_count; i++) {
-                        json_t *model = json_array_get(models, i);
-                        json_t *name = json_object_get(model, "name");
-                        json_t *modified = json_object_get(model, "modified_at");
-                        json_t *size = json_object_get(model, "size");
-                        
-                        if (name && json_is_string(name)) {
-                            list->models[i].name = strdup(json_string_value(name));
-                            list->models[i].capabilities = get_model_capabilities_internal(
-                                list->models[i].name);
-                        }
-                        if (modified && json_is_string(modified)) {
-                            list->models[i].modified_at = strdup(json_string_value(modified));
-                        }
-                        if (size && json_is_integer(size)) {
-                            list->models[i].size = (long)json_integer_value(size);
-                        }
-                    }
-                }
-                json_decref(root);
+            if (name && json_is_string(name)) {
+                list->models[i].name = strdup(json_string_value(name));
+                list->models[i].capabilities = get_model_capabilities_internal(
+                    list->models[i].name);
+            }
+            if (modified && json_is_string(modified)) {
+                list->models[i].modified_at = strdup(json_string_value(modified));
+            }
+            if (size && json_is_integer(size)) {
+                list->models[i].size = (long)json_integer_value(size);
             }
         }
-        
-        curl_easy_cleanup(curl);
-        free(chunk.memory);
     }
     
-    
+    json_decref(root);
     return list;
 }
 
-/* Internal helper: Free model list */
-static void ollama_model_list_free_internal(OllamaModelList *list) {
-    if (!list) return;
+/* Internal helper: Digest of the (name, modified_at) pairs in a list */
+static unsigned long long ollama_list_digest(const OllamaModelList *list) {
+    unsigned long long hash = 1469598103934665603ULL;
     
     for (int i = 0; i < list->count; i++) {
-        free(list->models[i].name);
-        free(list->models[i].modified_at);
+        const char *fields[2] = {list->models[i].name, list->models[i].modified_at};
+        for (int f = 0; f < 2; f++) {
+            for (const char *p = fields[f] ? fields[f] : ""; *p; p++) {
+                hash ^= (unsigned char)*p;
+                hash *= 1099511628211ULL;
+            }
+            hash ^= 0xff;
+            hash *= 1099511628211ULL;
+        }
     }
-    free(list->models);
-    free(list);
+    return hash;
 }
 
-/* Initialize backends */
-void ai_backend_init(void) {
-    /* Initialize CURL globally once */
-    if (!curl_initialized) {
-        curl_global_init(CURL_GLOBAL_DEFAULT);
-        curl_initialized = 1;
-    }
+/* Internal helper: Score every model having the required capabilities for a task */
+static const char *ollama_pick_model(const OllamaModelList *list, TaskType task, int require) {
+    const char *best = NULL;
+    int best_score = -1;
     
-    for (int i = 0; i < AI_BACKEND_COUNT; i++) {
-        char *key = getenv(backends[i].env_key);
-        backends[i].enabled = (key != NULL && strlen(key) > 0);
+    for (int i = 0; i < list->count; i++) {
+        int score = 0;
+        int caps = list->models[i].capabilities;
+        
+        if (!list->models[i].name || (caps & require) != require) continue;
+        
+        switch (task) {
+            case TASK_CODE_GENERATION:
+            case TASK_SHELL_COMMAND:
+            case TASK_AUTOMATION:
+                /* Prefer code-specialized models */
+                if (caps & MODEL_CAP_CODE) score += 10;
+                if (caps & MODEL_CAP_SHELL) score += 5;
+                break;
+            case TASK_EXPLANATION:
+            case TASK_GENERAL:
+            default:
+                /* Prefer reasoning models */
+                if (caps & MODEL_CAP_REASONING) score += 10;
+                if (caps & MODEL_CAP_GENERAL) score += 5;
+                break;
+        }
+        
+        if (score > best_score) {
+            best_score = score;
+            best = list->models[i].name;
+        }
     }
     
-    /* Special check for Ollama - it's enabled if the server is running */
-    if (!backends[AI_BACKEND_OLLAMA].enabled) {
-        /* Check if Ollama is available even without OLLAMA_HOST set */
-        if (ollama_check_available_internal()) {
-            backends[AI_BACKEND_OLLAMA].enabled = 1;
+    return best;
+}
+
+/* Internal helper: Replace the cached list and rebuild the per-task table */
+static void ollama_cache_install(OllamaModelList *list) {
+    ollama_model_list_free_internal(ollama_tags.list);
+    ollama_tags.list = list;
+    ollama_tags.digest = ollama_list_digest(list);
+    
+    for (int t = 0; t < TASK_TYPE_COUNT; t++) {
+        const char *best = ollama_pick_model(list, (TaskType)t, 0);
+        strncpy(ollama_tags.best[t], best ? best : "llama3.2",
+                sizeof(ollama_tags.best[t]) - 1);
+        ollama_tags.best[t][sizeof(ollama_tags.best[t]) - 1] = '\0';
+        
+        const char *fast = ollama_pick_model(list, (TaskType)t, MODEL_CAP_FAST);
+        snprintf(ollama_tags.fast[t], sizeof(ollama_tags.fast[t]), "%s", fast ? fast : "");
+    }
+}
+
+/* CURL header callback: remember the ETag of /api/tags */
+static size_t etag_header_callback(char *buffer, size_t size, size_t nitems, void *userdata) {
+    size_t len = size * nitems;
+    char *etag = (char *)userdata;
+    
+    if (len > 5 && strncasecmp(buffer, "ETag:", 5) == 0) {
+        size_t start = 5, end = len;
+        while (start < end && (buffer[start] == ' ' || buffer[start] == '\t')) start++;
+        while (end > start && (buffer[end - 1] == '\r' || buffer[end - 1] == '\n' ||
+                               buffer[end - 1] == ' ')) end--;
+        if (end - start < OLLAMA_ETAG_SIZE) {
+            memcpy(etag, buffer + start, end - start);
+            etag[end - start] = '\0';
         }
     }
+    return len;
+}
+
+/* CURL progress callback: lets cleanup abort a background transfer (clientp is its flag) */
+static int cancel_progress_callback(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
+                                    curl_off_t ultotal, curl_off_t ulnow) {
+    (void)dltotal; (void)dlnow; (void)ultotal; (void)ulnow;
+    return atomic_load((atomic_int *)clientp) ? 1 : 0;
+}
+
+/* Internal helper: Every model of every endpoint, each name once */
+static OllamaModelList *ollama_merge_lists(OllamaModelList *const *lists, int count) {
+    OllamaModelList *merged = calloc(1, sizeof(OllamaModelList));
+    int total = 0;
+    
+    for (int i = 0; i < count; i++) total += lists[i] ? lists[i]->count : 0;
+    if (!merged || (total > 0 && !(merged->models = calloc(total, sizeof(OllamaModel))))) {
+        free(merged);
+        return NULL;
+    }
     
-    /* Set active backend to first available */
-    for (int i = 0; i < AI_BACKEND_COUNT; i++) {
-        if (backends[i].enabled) {
-            active_backend = (AIBackendType)i;
-            break;
+    for (int i = 0; i < count; i++) {
+        for (int m = 0; lists[i] && m < lists[i]->count; m++) {
+            const OllamaModel *model = &lists[i]->models[m];
+            int seen = !model->name;
+            for (int k = 0; k < merged->count && !seen; k++) {
+                seen = strcmp(merged->models[k].name, model->name) == 0;
+            }
+            if (seen) continue;
+            
+            OllamaModel *copy = &merged->models[merged->count++];
+            *copy = *model;
+            copy->name = strdup(model->name);
+            copy->modified_at = model->modified_at ? strdup(model->modified_at) : NULL;
         }
     }
-    
-    /* Set default model */
-    strncpy(current_model, backends[active_backend].default_model, 
-            sizeof(current_model) - 1);
-    current_model[sizeof(current_model) - 1] = '\0';
+    return merged;
 }
 
-void ai_backend_cleanup(void) {
-    /* Cleanup CURL globally once */
-    if (curl_initialized) {
-        curl_global_cleanup();
-        curl_initialized = 0;
+/* One endpoint's /api/tags request */
+typedef struct {
+    CURL *curl;
+    struct MemoryChunk chunk;
+    struct curl_slist *headers;
+    char etag[OLLAMA_ETAG_SIZE];
+    CURLcode res;
+} TagsFetch;
+
+/*
+ * Internal helper: Make sure the /api/tags cache is fresh.
+ * Within the TTL this is a table lookup; after it every endpoint's list
+ * is revalidated with If-None-Match, all at once, and an unchanged
+ * (name, modified_at) set keeps the existing table. Availability probes,
+ * endpoint health checks and model listings share these requests.
+ * Returns 1 if any Ollama endpoint answered. Caller holds tags_lock, so
+ * threads that find the list stale together send one set of requests.
+ */
+static int ollama_refresh_models_locked(int force) {
+    time_t now = monotonic_seconds();
+    long ttl = ollama_tags.reachable ? ollama_tags_ttl : OLLAMA_DOWN_TTL;
+    
+    if (!force && ollama_tags.checked_at > 0 && now - ollama_tags.checked_at < ttl) {
+        ollama_tags.stats.hits++;
+        return ollama_tags.reachable;
+    }
+    
+    int count = ai_endpoint_count(AI_BACKEND_OLLAMA);
+    TagsFetch fetch[AI_ENDPOINT_MAX];
+    CURLM *multi = curl_multi_init();
+    if (!multi) return ollama_tags.reachable;
+    memset(fetch, 0, sizeof(fetch));
+    
+    for (int i = 0; i < count; i++) {
+        TagsFetch *f = &fetch[i];
+        char url[320];
+        f->res = CURLE_FAILED_INIT;
+        if (!(f->curl = curl_pool_acquire(AI_BACKEND_OLLAMA))) continue;
+        
+        snprintf(url, sizeof(url), "%s/api/tags", ai_endpoint_url(AI_BACKEND_OLLAMA, i));
+        curl_easy_setopt(f->curl, CURLOPT_URL, url);
+        curl_easy_setopt(f->curl, CURLOPT_WRITEFUNCTION, write_callback);
+        curl_easy_setopt(f->curl, CURLOPT_WRITEDATA, &f->chunk);
+        curl_easy_setopt(f->curl, CURLOPT_HEADERFUNCTION, etag_header_callback);
+        curl_easy_setopt(f->curl, CURLOPT_HEADERDATA, f->etag);
+        curl_easy_setopt(f->curl, CURLOPT_TIMEOUT, 10L);
+        curl_easy_setopt(f->curl, CURLOPT_CONNECTTIMEOUT, 3L);
+        curl_easy_setopt(f->curl, CURLOPT_NOPROGRESS, 0L);
+        curl_easy_setopt(f->curl, CURLOPT_XFERINFOFUNCTION, cancel_progress_callback);
+        curl_easy_setopt(f->curl, CURLOPT_XFERINFODATA, &probe_cancel);
+        
+        if (ollama_tags.node_list[i] && ollama_tags.etag[i][0]) {
+            char header[OLLAMA_ETAG_SIZE + 32];
+            snprintf(header, sizeof(header), "If-None-Match: %s", ollama_tags.etag[i]);
+            f->headers = curl_slist_append(f->headers, header);
+            curl_easy_setopt(f->curl, CURLOPT_HTTPHEADER, f->headers);
+        }
+        if (curl_multi_add_handle(multi, f->curl) != CURLM_OK) {
+            curl_pool_release(AI_BACKEND_OLLAMA, f->curl);
+            f->curl = NULL;
+        }
+    }
+    
+    /* A down endpoint costs its connect timeout, not one per endpoint */
+    int running = 1;
+    while (running) {
+        curl_multi_perform(multi, &running);
+        CURLMsg *msg;
+        int queued;
+        while ((msg = curl_multi_info_read(multi, &queued))) {
+            for (int i = 0; msg->msg == CURLMSG_DONE && i < count; i++) {
+                if (fetch[i].curl == msg->easy_handle) fetch[i].res = msg->data.result;
+            }
+        }
+        if (running) curl_multi_poll(multi, NULL, 0, 1000, NULL);
+    }
+    
+    int reachable = 0;
+    for (int i = 0; i < count; i++) {
+        TagsFetch *f = &fetch[i];
+        long status = 0;
+        if (f->curl) {
+            curl_easy_getinfo(f->curl, CURLINFO_RESPONSE_CODE, &status);
+            curl_multi_remove_handle(multi, f->curl);
+            curl_pool_release(AI_BACKEND_OLLAMA, f->curl);
+        }
+        curl_slist_free_all(f->headers);
+        
+        if (f->res != CURLE_OK) {
+            /* Unreachable: forget its models until it answers again */
+            ollama_model_list_free_internal(ollama_tags.node_list[i]);
+            ollama_tags.node_list[i] = NULL;
+            ollama_tags.etag[i][0] = '\0';
+        } else if (status != 304 || !ollama_tags.node_list[i]) {
+            OllamaModelList *list = f->chunk.memory ? ollama_parse_tags(f->chunk.memory) : NULL;
+            if (list) {
+                ollama_model_list_free_internal(ollama_tags.node_list[i]);
+                ollama_tags.node_list[i] = list;
+                snprintf(ollama_tags.etag[i], sizeof(ollama_tags.etag[i]), "%s", f->etag);
+            }
+        }
+        if (f->res == CURLE_OK) reachable = 1;
+        ai_endpoint_report(AI_BACKEND_OLLAMA, i, f->res == CURLE_OK);
+        ai_endpoint_set_models(AI_BACKEND_OLLAMA, i, ollama_tags.node_list[i]);
+        free(f->chunk.memory);
+    }
+    curl_multi_cleanup(multi);
+    
+    ollama_tags.checked_at = now;
+    ollama_tags.stats.fetches++;
+    ollama_tags.reachable = reachable;
+    
+    if (!reachable) {
+        /* Retry after the short down TTL */
+        ollama_model_list_free_internal(ollama_tags.list);
+        ollama_tags.list = NULL;
+        return 0;
     }
+    
+    OllamaModelList *merged = ollama_merge_lists(ollama_tags.node_list, count);
+    if (merged && ollama_tags.list && ollama_list_digest(merged) == ollama_tags.digest) {
+        /* Same models, same timestamps - keep the current table */
+        ollama_model_list_free_internal(merged);
+        ollama_tags.stats.not_modified++;
+    } else if (merged) {
+        ollama_cache_install(merged);
+    }
+    return 1;
 }
 
-AIBackendType ai_get_active_backend(void) {
-    return active_backend;
+static int ollama_refresh_models(int force) {
+    pthread_mutex_lock(&tags_lock);
+    int reachable = ollama_refresh_models_locked(force);
+    pthread_mutex_unlock(&tags_lock);
+    return reachable;
 }
 
-int ai_set_backend(AIBackendType type) {
-    if (type < 0 || type >= AI_BACKEND_COUNT) return -1;
-    if (!backends[type].enabled) return -1;
+/*
+ * keep_alive and "options" for a model. Queries and the warm-up send the
+ * same values: a different num_ctx or num_thread would make Ollama reload.
+ */
+static void ollama_add_runtime_opts(json_t *root, const char *model) {
+    OllamaOpts opts;
+    ollama_opts_get(model, &opts);
+    
+    /* Plain seconds go as a number, anything else ("30m") as a duration */
+    char *end;
+    long seconds = strtol(opts.keep_alive, &end, 10);
+    if (*end == '\0' && end != opts.keep_alive) {
+        json_object_set_new(root, "keep_alive", json_integer(seconds));
+    } else {
+        json_object_set_new(root, "keep_alive", json_string(opts.keep_alive));
+    }
     
-    active_backend = type;
-    strncpy(current_model, backends[type].default_model, sizeof(current_model) - 1);
-    return 0;
+    json_t *options = json_object();
+    if (opts.num_ctx) json_object_set_new(options, "num_ctx", json_integer(opts.num_ctx));
+    if (opts.num_thread) json_object_set_new(options, "num_thread", json_integer(opts.num_thread));
+    if (opts.num_predict) json_object_set_new(options, "num_predict", json_integer(opts.num_predict));
+    if (json_object_size(options) > 0) {
+        json_object_set_new(root, "options", options);
+    } else {
+        json_decref(options);
+    }
 }
 
-int ai_set_backend_by_name(const char *name) {
-    for (int i = 0; i < AI_BACKEND_COUNT; i++) {
-        if (strcasecmp(backends[i].name, name) == 0) {
-            return ai_set_backend((AIBackendType)i);
-        }
-    }
-    return -1;
+static size_t discard_callback(void *contents, size_t size, size_t nmemb, void *userp) {
+    (void)contents; (void)userp;
+    return size * nmemb;
 }
 
-const char *ai_get_backend_name(AIBackendType type) {
-    if (type < 0 || type >= AI_BACKEND_COUNT) return "unknown";
-    return backends[type].name;
+static void *ollama_warm_main(void *arg) {
+    (void)arg;
+    CURL *curl = curl_easy_init();
+    if (curl) {
+        struct curl_slist *headers = curl_slist_append(NULL, "Content-Type: application/json");
+        curl_easy_setopt(curl, CURLOPT_URL, warm_url);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, warm_payload);
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard_callback);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, OLLAMA_WARM_TIMEOUT);
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 3L);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, cancel_progress_callback);
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &warm_cancel);
+        curl_easy_perform(curl);
+        curl_slist_free_all(headers);
+        curl_easy_cleanup(curl);
+    }
+    atomic_store(&warm_done, 1);
+    return NULL;
 }
 
-int ai_backend_available(AIBackendType type) {
-    if (type < 0 || type >= AI_BACKEND_COUNT) return 0;
-    return backends[type].enabled;
+/* Have Ollama load a model in the background; skipped while one is loading */
+static void ollama_warm_start(const char *model) {
+    if (!warm_enabled || !model || !*model) return;
+    if (warm_started) {
+        if (!atomic_load(&warm_done)) return;
+        pthread_join(warm_thread, NULL);
+        warm_started = 0;
+    }
+    
+    /* The endpoint the next query for this model would most likely use */
+    snprintf(warm_url, sizeof(warm_url), "%s/api/generate",
+             ai_endpoint_url(AI_BACKEND_OLLAMA, ai_endpoint_pick(AI_BACKEND_OLLAMA, model)));
+    
+    /* No prompt: Ollama only loads the model and answers at once */
+    json_t *root = json_object();
+    json_object_set_new(root, "model", json_string(model));
+    ollama_add_runtime_opts(root, model);
+    free(warm_payload);
+    warm_payload = json_dumps(root, JSON_COMPACT);
+    json_decref(root);
+    if (!warm_payload) return;
+    
+    atomic_store(&warm_done, 0);
+    atomic_store(&warm_cancel, 0);
+    if (pthread_create(&warm_thread, NULL, ollama_warm_main, NULL) == 0) {
+        warm_started = 1;
+    }
 }
 
-AIBackendType ai_get_fallback_backend(void) {
-    for (int i = 0; i < AI_BACKEND_COUNT; i++) {
-        if (backends[i].enabled && i != (int)active_backend) {
-            return (AIBackendType)i;
-        }
+/* Ollama is last in priority; it is only used when no keyed backend is */
+static int ollama_preferred(void) {
+    for (int i = 0; i < AI_BACKEND_OLLAMA; i++) {
+        if (backends[i].enabled) return 0;
     }
-    return active_backend;
+    return 1;
 }
 
-const char *ai_get_model(void) {
-    return current_model;
+/* Background thread body: the only work it does is one /api/tags fetch */
+static void *backend_probe_main(void *arg) {
+    (void)arg;
+    char model[256] = "";
+    
+    pthread_mutex_lock(&tags_lock);
+    probe_result = ollama_refresh_models_locked(1);
+    if (probe_result && ollama_tags.list && ollama_tags.list->count > 0) {
+        memcpy(model, ollama_tags.best[TASK_GENERAL], sizeof(model));
+    }
+    pthread_mutex_unlock(&tags_lock);
+    
+    /* Load the general-purpose model now rather than on the first question */
+    if (model[0] && ollama_preferred()) ollama_warm_start(model);
+    return NULL;
 }
 
-void ai_set_model(const char *model) {
-    if (model) {
-        strncpy(current_model, model, sizeof(current_model) - 1);
+/*
+ * Wait for (or run) the startup probe and apply its result. The first
+ * caller does the work; others block on probe_lock until it is applied.
+ */
+static void backend_probe_wait(void) {
+    pthread_mutex_lock(&probe_lock);
+    if (probe_state == PROBE_NONE || probe_state == PROBE_DONE) {
+        pthread_mutex_unlock(&probe_lock);
+        return;
+    }
+    
+    if (probe_state == PROBE_RUNNING) {
+        pthread_join(probe_thread, NULL);
+    } else {
+        probe_result = ollama_refresh_models(1);
+    }
+    probe_state = PROBE_DONE;
+    
+    if (probe_result) {
+        backends[AI_BACKEND_OLLAMA].enabled = 1;
+        if (ollama_preferred()) {
+            pthread_mutex_lock(&client_lock);
+            default_client.backend = AI_BACKEND_OLLAMA;
+            snprintf(default_client.model, sizeof(default_client.model), "%s",
+                     backends[AI_BACKEND_OLLAMA].default_model);
+            pthread_mutex_unlock(&client_lock);
+        }
+    }
+    pthread_mutex_unlock(&probe_lock);
+}
+
+/* Initialize backends */
+void ai_backend_init(void) {
+    /* Initialize CURL globally once */
+    if (!curl_initialized) {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        curl_initialized = 1;
+    }
+    
+    /* Share DNS, TLS sessions and connections across all pooled handles */
+    if (!curl_share) {
+        curl_share = curl_share_init();
+        if (curl_share) {
+            for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) pthread_mutex_init(&share_locks[i], NULL);
+            curl_share_setopt(curl_share, CURLSHOPT_LOCKFUNC, share_lock);
+            curl_share_setopt(curl_share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+            curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+            curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+            curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+        }
+    }
+    
+    for (int i = 0; i < AI_BACKEND_COUNT; i++) {
+        char *key = getenv(backends[i].env_key);
+        backends[i].enabled = (key != NULL && strlen(key) > 0);
+    }
+    
+    /*
+     * Endpoint pools: CORTEX_<BACKEND>_ENDPOINTS lists servers to spread
+     * requests over (OLLAMA_HOST may also be a list); otherwise the one
+     * built-in URL. The in-process backend has no endpoints.
+     */
+    ai_endpoints_init();
+    for (int i = 0; i < AI_BACKEND_LOCAL; i++) {
+        char var[64];
+        size_t len = (size_t)snprintf(var, sizeof(var), "CORTEX_");
+        for (const char *c = backends[i].name; *c && len < 40; c++) {
+            var[len++] = (char)toupper((unsigned char)*c);
+        }
+        snprintf(var + len, sizeof(var) - len, "_ENDPOINTS");
+        
+        char *list = getenv(var);
+        if (i == AI_BACKEND_OLLAMA) {
+            if (!list) list = getenv("OLLAMA_HOST");
+            ai_endpoint_configure(i, list, "http://localhost:11434");
+        } else {
+            ai_endpoint_configure(i, list, backends[i].api_url);
+        }
+    }
+    
+    /* How long an Ollama model listing is trusted before revalidation */
+    char *tags_ttl = getenv("CORTEX_OLLAMA_TAGS_TTL");
+    if (tags_ttl && atol(tags_ttl) >= 0) {
+        ollama_tags_ttl = atol(tags_ttl);
+    }
+    
+    /* Per-model runtime options (keep_alive, num_ctx, ...) */
+    ollama_opts_init();
+    
+    /* The in-process backend's model is the GGUF file named by its key */
+    ai_local_init();
+    if (!ai_local_supported()) {
+        backends[AI_BACKEND_LOCAL].enabled = 0;
+    } else if (backends[AI_BACKEND_LOCAL].enabled) {
+        backends[AI_BACKEND_LOCAL].default_model = getenv(backends[AI_BACKEND_LOCAL].env_key);
+    }
+    
+    /* Latency statistics from earlier sessions; CORTEX_ROUTE=auto routes by them */
+    ai_router_init();
+    ai_breaker_init();
+    
+    /* Rate limits are shared with every dynamo on the host using the same key */
+    ai_ratelimit_init();
+    char *ratelimit_wait = getenv("CORTEX_RATELIMIT_WAIT");
+    if (ratelimit_wait && atol(ratelimit_wait) >= 0) {
+        ratelimit_wait_ms = atol(ratelimit_wait) * 1000L;
+    }
+    char *route = getenv("CORTEX_ROUTE");
+    if (route && strcmp(route, "auto") == 0) {
+        default_client.auto_route = 1;
+    }
+    char *warm = getenv("CORTEX_OLLAMA_WARMUP");
+    if (warm && strcmp(warm, "0") == 0) {
+        warm_enabled = 0;
+    }
+    
+    /*
+     * Special check for Ollama - it's enabled if the server is running.
+     * Probe in the background; if no thread can be started, on first use.
+     * A configured OLLAMA_HOST is probed too when Ollama will be active,
+     * so the model list is ready and the model gets warmed up.
+     */
+    if (!backends[AI_BACKEND_OLLAMA].enabled || ollama_preferred()) {
+        atomic_store(&probe_cancel, 0);
+        if (pthread_create(&probe_thread, NULL, backend_probe_main, NULL) == 0) {
+            probe_state = PROBE_RUNNING;
+        } else {
+            probe_state = PROBE_DEFERRED;
+        }
+    }
+    
+    /* Streaming is on by default; CORTEX_STREAM=0 turns it off */
+    char *stream = getenv("CORTEX_STREAM");
+    if (stream && strcmp(stream, "0") == 0) {
+        default_client.stream = 0;
+    }
+    
+    /* Identical queries repeated within this many ms share one result */
+    char *coalesce = getenv("CORTEX_COALESCE_MS");
+    if (coalesce && atol(coalesce) >= 0) {
+        flight_window_ms = atol(coalesce);
+    }
+    
+    /* Token budget for prompt context, overriding the per-backend default */
+    char *budget = getenv("CORTEX_CONTEXT_TOKENS");
+    if (budget && atol(budget) > 0) {
+        context_budget = atol(budget);
+    }
+    
+    /* Cascade routing is opt-in */
+    char *cascade = getenv("CORTEX_CASCADE");
+    if (cascade && strcmp(cascade, "1") == 0) {
+        cascade_enabled = 1;
+    }
+    
+    /* Hedged requests are opt-in; the delay defaults to the primary's p95 */
+    char *hedge = getenv("CORTEX_HEDGE");
+    if (hedge && strcmp(hedge, "1") == 0) {
+        default_client.hedge = 1;
+    }
+    char *hedge_delay = getenv("CORTEX_HEDGE_DELAY_MS");
+    if (hedge_delay && atol(hedge_delay) > 0) {
+        hedge_delay_ms = atol(hedge_delay);
+    }
+    
+    /* Set active backend to first available */
+    for (int i = 0; i < AI_BACKEND_COUNT; i++) {
+        if (backends[i].enabled) {
+            default_client.backend = (AIBackendType)i;
+            break;
+        }
+    }
+    
+    /* Set default model */
+    strncpy(default_client.model, backends[default_client.backend].default_model, 
+            sizeof(default_client.model) - 1);
+    default_client.model[sizeof(default_client.model) - 1] = '\0';
+}
+
+void ai_backend_cleanup(void) {
+    /* Abort a probe still in flight rather than wait out its timeout */
+    atomic_store(&probe_cancel, 1);
+    pthread_mutex_lock(&probe_lock);
+    if (probe_state == PROBE_RUNNING) pthread_join(probe_thread, NULL);
+    probe_state = PROBE_NONE;
+    pthread_mutex_unlock(&probe_lock);
+    
+    if (warm_started) {
+        atomic_store(&warm_cancel, 1);
+        pthread_join(warm_thread, NULL);
+        warm_started = 0;
+    }
+    free(warm_payload);
+    warm_payload = NULL;
+    ollama_opts_cleanup();
+    ai_local_cleanup();
+    ai_router_cleanup();
+    ai_ratelimit_cleanup();
+    
+    curl_pool_cleanup();
+    ai_flight_reset();
+    
+    ollama_model_list_free_internal(ollama_tags.list);
+    for (int i = 0; i < AI_ENDPOINT_MAX; i++) {
+        ollama_model_list_free_internal(ollama_tags.node_list[i]);
+    }
+    memset(&ollama_tags, 0, sizeof(ollama_tags));
+    ai_endpoints_cleanup();
+    
+    /* Cleanup CURL globally once */
+    if (curl_initialized) {
+        curl_global_cleanup();
+        curl_initialized = 0;
+    }
+}
+
+AIBackendType ai_get_active_backend(void) {
+    backend_probe_wait();
+    pthread_mutex_lock(&client_lock);
+    AIBackendType type = default_client.backend;
+    pthread_mutex_unlock(&client_lock);
+    return type;
+}
+
+int ai_set_backend(AIBackendType type) {
+    backend_probe_wait();
+    if (type < 0 || type >= AI_BACKEND_COUNT) return -1;
+    if (!backends[type].enabled) return -1;
+    
+    pthread_mutex_lock(&client_lock);
+    default_client.backend = type;
+    default_client.auto_route = 0;
+    snprintf(default_client.model, sizeof(default_client.model), "%s", backends[type].default_model);
+    pthread_mutex_unlock(&client_lock);
+    if (type == AI_BACKEND_OLLAMA) {
+        ollama_warm_start(ai_ollama_select_best_model(TASK_GENERAL));
+    }
+    return 0;
+}
+
+int ai_set_backend_by_name(const char *name) {
+    if (strcasecmp(name, "auto") == 0) {
+        ai_set_auto_routing(1);
+        return 0;
+    }
+    for (int i = 0; i < AI_BACKEND_COUNT; i++) {
+        if (strcasecmp(backends[i].name, name) == 0) {
+            return ai_set_backend((AIBackendType)i);
+        }
+    }
+    return -1;
+}
+
+const char *ai_get_backend_name(AIBackendType type) {
+    if (type < 0 || type >= AI_BACKEND_COUNT) return "unknown";
+    return backends[type].name;
+}
+
+int ai_backend_available(AIBackendType type) {
+    backend_probe_wait();
+    if (type < 0 || type >= AI_BACKEND_COUNT) return 0;
+    return backends[type].enabled;
+}
+
+AIBackendType ai_get_fallback_backend(void) {
+    AIBackendType active = ai_get_active_backend();
+    for (int i = 0; i < AI_BACKEND_COUNT; i++) {
+        if (backends[i].enabled && i != (int)active) {
+            return (AIBackendType)i;
+        }
+    }
+    return active;
+}
+
+/* A copy for this thread: the shared client is rewritten under client_lock */
+const char *ai_get_model(void) {
+    static _Thread_local char model[sizeof(default_client.model)];
+    backend_probe_wait();
+    pthread_mutex_lock(&client_lock);
+    memcpy(model, default_client.model, sizeof(model));
+    pthread_mutex_unlock(&client_lock);
+    return model;
+}
+
+void ai_set_model(const char *model) {
+    backend_probe_wait();
+    if (model) {
+        pthread_mutex_lock(&client_lock);
+        snprintf(default_client.model, sizeof(default_client.model), "%s", model);
+        pthread_mutex_unlock(&client_lock);
     }
 }
 
 void ai_list_backends(void) {
+    backend_probe_wait();
     _puts("\nAvailable AI Backends:\n");
     for (int i = 0; i < AI_BACKEND_COUNT; i++) {
         _puts("  ");
-        if (i == (int)active_backend) {
+        if (i == (int)default_client.backend) {
             _puts(COLOR_GREEN);
             _puts("* ");
         } else {
@@ -309,6 +1101,9 @@ void ai_list_backends(void) {
         if (backends[i].enabled) {
             _puts(COLOR_GREEN);
             _puts("available");
+        } else if (i == AI_BACKEND_LOCAL && !ai_local_supported()) {
+            _puts(COLOR_RED);
+            _puts("not built in (make LLAMA=1)");
         } else {
             _puts(COLOR_RED);
             _puts("not configured (set ");
@@ -318,6 +1113,24 @@ void ai_list_backends(void) {
         _puts(COLOR_RESET);
         _puts("\n");
     }
+    if (default_client.auto_route) {
+        _puts("  Routing: ");
+        _puts(COLOR_GREEN);
+        _puts("auto");
+        _puts(COLOR_RESET);
+        _puts(" (fastest capable backend per query)\n");
+    }
+}
+
+/* Connection pool counters for a backend */
+void ai_get_pool_stats(AIBackendType type, AIPoolStats *stats) {
+    backend_probe_wait();
+    if (!stats) return;
+    memset(stats, 0, sizeof(*stats));
+    if (type < 0 || type >= AI_BACKEND_COUNT) return;
+    pthread_mutex_lock(&curl_pool_lock);
+    *stats = curl_pools[type].stats;
+    pthread_mutex_unlock(&curl_pool_lock);
 }
 
 /* Task type detection based on input */
@@ -375,70 +1188,139 @@ const char *ai_get_task_type_name(TaskType type) {
 
 /* Check if Ollama is available - public API */
 int ai_ollama_check_available(void) {
-    return ollama_check_available_internal();
+    backend_probe_wait();
+    return ollama_refresh_models(0);
+}
+
+/* Internal helper: POST one embedding request; returns the vector or NULL */
+static float *ollama_embed_request(const char *base, const char *path, const char *field,
+                                   const char *model, const char *text, int *dim, long *status) {
+    CURL *curl = curl_pool_acquire(AI_BACKEND_OLLAMA);
+    if (!curl) return NULL;
+    
+    /* /api/embed takes "input" and answers "embeddings"; the older /api/embeddings "prompt" */
+    json_t *root = json_object();
+    json_object_set_new(root, "model", json_string(model));
+    json_object_set_new(root, strcmp(field, "embedding") == 0 ? "prompt" : "input", json_string(text));
+    char *payload = json_dumps(root, JSON_COMPACT);
+    json_decref(root);
+    
+    char url[320];
+    snprintf(url, sizeof(url), "%s%s", base, path);
+    struct MemoryChunk chunk = {0};
+    struct curl_slist *headers = curl_slist_append(NULL, "Content-Type: application/json");
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &chunk);
+    set_curl_performance_options(curl, OLLAMA_EMBED_CONNECT_MS, OLLAMA_EMBED_TIMEOUT_MS,
+                                 OLLAMA_EMBED_TIMEOUT_MS);
+    
+    CURLcode res = curl_easy_perform(curl);
+    *status = 0;
+    if (res == CURLE_OK) curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, status);
+    curl_pool_release(AI_BACKEND_OLLAMA, curl);
+    curl_slist_free_all(headers);
+    free(payload);
+    
+    float *vec = NULL;
+    json_t *resp = *status == 200 && chunk.memory ? json_loads(chunk.memory, 0, NULL) : NULL;
+    json_t *values = json_object_get(resp, field);
+    if (json_is_array(values) && json_is_array(json_array_get(values, 0))) {
+        values = json_array_get(values, 0);
+    }
+    size_t count = json_array_size(values);
+    if (count > 0 && (vec = malloc(count * sizeof(float)))) {
+        for (size_t i = 0; i < count; i++) {
+            vec[i] = (float)json_number_value(json_array_get(values, i));
+        }
+        *dim = (int)count;
+    }
+    json_decref(resp);
+    free(chunk.memory);
+    return vec;
+}
+
+/* Embedding of text from an Ollama embedding model - public API */
+float *ai_ollama_embed(const char *model, const char *text, int *dim) {
+    if (!model || !text || !ai_ollama_check_available()) return NULL;
+    
+    int endpoint = ai_endpoint_acquire(AI_BACKEND_OLLAMA, model);
+    const char *base = ai_endpoint_url(AI_BACKEND_OLLAMA, endpoint);
+    long start = monotonic_ms(), status;
+    
+    float *vec = ollama_embed_request(base, "/api/embed", "embeddings", model, text, dim, &status);
+    if (!vec && status == 404) {
+        /* Servers before /api/embed only have the single-prompt endpoint */
+        vec = ollama_embed_request(base, "/api/embeddings", "embedding", model, text, dim, &status);
+    }
+    /* Only an unreachable server counts against the endpoint; a missing model does not */
+    ai_endpoint_release(AI_BACKEND_OLLAMA, endpoint,
+                        vec ? monotonic_ms() - start : status == 0 ? 0 : -1, status == 0);
+    return vec;
 }
 
-/* List Ollama models - public API */
+/* List Ollama models - public API; returns a copy of the cached list */
 OllamaModelList *ai_ollama_list_models(void) {
-    return ollama_list_models_internal();
+    backend_probe_wait();
+    OllamaModelList *list = calloc(1, sizeof(OllamaModelList));
+    if (!list) return NULL;
+    
+    pthread_mutex_lock(&tags_lock);
+    ollama_refresh_models_locked(0);
+    if (ollama_tags.list && ollama_tags.list->count > 0 &&
+        (list->models = calloc((size_t)ollama_tags.list->count, sizeof(OllamaModel)))) {
+        list->count = ollama_tags.list->count;
+        for (int i = 0; i < list->count; i++) {
+            const OllamaModel *src = &ollama_tags.list->models[i];
+            list->models[i].name = src->name ? strdup(src->name) : NULL;
+            list->models[i].modified_at = src->modified_at ? strdup(src->modified_at) : NULL;
+            list->models[i].size = src->size;
+            list->models[i].capabilities = src->capabilities;
+        }
+    }
+    pthread_mutex_unlock(&tags_lock);
+    return list;
 }
 
 void ai_ollama_model_list_free(OllamaModelList *list) {
     ollama_model_list_free_internal(list);
 }
 
-/* Select best Ollama model for task */
+/* Force the next lookup to go back to the server */
+void ai_ollama_invalidate_models(void) {
+    backend_probe_wait();
+    pthread_mutex_lock(&tags_lock);
+    ollama_tags.checked_at = 0;
+    pthread_mutex_unlock(&tags_lock);
+}
+
+void ai_ollama_get_cache_stats(AIModelCacheStats *stats) {
+    backend_probe_wait();
+    pthread_mutex_lock(&tags_lock);
+    *stats = ollama_tags.stats;
+    pthread_mutex_unlock(&tags_lock);
+}
+
+/*
+ * Select best Ollama model for task - a lookup in the per-task table.
+ * The name is copied out per thread: a refresh may rebuild the table.
+ */
 const char *ai_ollama_select_best_model(TaskType task) {
-    OllamaModelList *list = ai_ollama_list_models();
-    if (!list || list->count == 0) {
-        ai_ollama_model_list_free(list);
-        return "llama3.2";  /* Default fallback */
-    }
-    
-    const char *best = NULL;
-    int best_score = -1;
-    
-    for (int i = 0; i < list->count; i++) {
-        int score = 0;
-        int caps = list->models[i].capabilities;
-        
-        switch (task) {
-            case TASK_CODE_GENERATION:
-            case TASK_SHELL_COMMAND:
-            case TASK_AUTOMATION:
-                /* Prefer code-specialized models */
-                if (caps & MODEL_CAP_CODE) score += 10;
-                if (caps & MODEL_CAP_SHELL) score += 5;
-                break;
-            case TASK_EXPLANATION:
-            case TASK_GENERAL:
-            default:
-                /* Prefer reasoning models */
-                if (caps & MODEL_CAP_REASONING) score += 10;
-                if (caps & MODEL_CAP_GENERAL) score += 5;
-                break;
-        }
-        
-        if (score > best_score) {
-            best_score = score;
-            best = list->models[i].name;
-        }
-    }
-    
-    /* Copy best model name before freeing list */
-    static char selected_model[256];
-    if (best) {
-        strncpy(selected_model, best, sizeof(selected_model) - 1);
-        selected_model[sizeof(selected_model) - 1] = '\0';
-    } else if (list->count > 0) {
-        strncpy(selected_model, list->models[0].name, sizeof(selected_model) - 1);
-        selected_model[sizeof(selected_model) - 1] = '\0';
+    static _Thread_local char best[256];
+    
+    backend_probe_wait();
+    pthread_mutex_lock(&tags_lock);
+    ollama_refresh_models_locked(0);
+    if (!ollama_tags.list || ollama_tags.list->count == 0 ||
+        task < 0 || task >= TASK_TYPE_COUNT) {
+        snprintf(best, sizeof(best), "llama3.2");  /* Default fallback */
     } else {
-        strncpy(selected_model, "llama3.2", sizeof(selected_model) - 1);
+        memcpy(best, ollama_tags.best[task], sizeof(best));
     }
-    
-    ai_ollama_model_list_free(list);
-    return selected_model;
+    pthread_mutex_unlock(&tags_lock);
+    return best;
 }
 
 /* List Ollama models to user */
@@ -469,8 +1351,8 @@ void ai_list_ollama_models(void) {
         _puts("  ");
         
         /* Check if this is the current model */
-        if (active_backend == AI_BACKEND_OLLAMA && 
-            strcmp(current_model, list->models[i].name) == 0) {
+        if (default_client.backend == AI_BACKEND_OLLAMA && 
+            strcmp(default_client.model, list->models[i].name) == 0) {
             _puts(COLOR_GREEN);
             _puts("* ");
         } else {
@@ -552,20 +1434,146 @@ const char *ai_get_recommended_model(AIBackendType backend, TaskType task) {
             }
         case AI_BACKEND_OLLAMA:
             return ai_ollama_select_best_model(task);
+        case AI_BACKEND_LOCAL:
+            return backends[AI_BACKEND_LOCAL].default_model;
         default:
             return "default";
     }
 }
 
-/* Auto-select the best model for the task */
-void ai_auto_select_model(TaskType task) {
-    const char *recommended = ai_get_recommended_model(active_backend, task);
+/*
+ * Fast model for a cascade: a small model of the same backend that is
+ * tried before the recommended one. NULL if the backend has none.
+ */
+const char *ai_get_fast_model(AIBackendType backend, TaskType task) {
+    switch (backend) {
+        case AI_BACKEND_GEMINI:
+            return "gemini-2.0-flash-lite";
+        case AI_BACKEND_OPENAI:
+            return "gpt-4o-mini";
+        case AI_BACKEND_CLAUDE:
+            return "claude-3-haiku-20240307";
+        case AI_BACKEND_OLLAMA: {
+            static _Thread_local char fast[256];
+            
+            backend_probe_wait();
+            pthread_mutex_lock(&tags_lock);
+            ollama_refresh_models_locked(0);
+            int found = ollama_tags.list && task >= 0 && task < TASK_TYPE_COUNT &&
+                        ollama_tags.fast[task][0];
+            if (found) memcpy(fast, ollama_tags.fast[task], sizeof(fast));
+            pthread_mutex_unlock(&tags_lock);
+            return found ? fast : NULL;
+        }
+        default:
+            return NULL;
+    }
+}
+
+void ai_set_cascade(int enabled) {
+    cascade_enabled = enabled ? 1 : 0;
+}
+
+int ai_get_cascade(void) {
+    return cascade_enabled;
+}
+
+/* Capability a task needs from the model */
+static int task_capability(TaskType task) {
+    switch (task) {
+        case TASK_CODE_GENERATION:
+        case TASK_AUTOMATION:
+            return MODEL_CAP_CODE;
+        case TASK_SHELL_COMMAND:
+            return MODEL_CAP_SHELL;
+        default:
+            return MODEL_CAP_GENERAL;
+    }
+}
+
+/* Cloud models cover every task; local ones only what their name says */
+static int model_has_capability(AIBackendType type, const char *model, int cap) {
+    if (type != AI_BACKEND_OLLAMA) return 1;
+    return (get_model_capabilities_internal(model) & cap) != 0;
+}
+
+/*
+ * Auto routing: among the enabled backends whose recommended model has the
+ * capability the task needs, take the lowest expected latency. A pair never
+ * tried scores 0 and is explored first. If no model has the capability,
+ * every enabled backend competes. Backends with an open circuit breaker
+ * sit out until their trial request is due.
+ */
+static void route_select(AIClient *client, TaskType task) {
+    int cap = task_capability(task);
+    
+    for (int pass = 0; pass < 2; pass++) {
+        int best = -1;
+        const char *best_model = NULL;
+        double best_ms = 0.0;
+        
+        for (int i = 0; i < AI_BACKEND_COUNT; i++) {
+            if (!backends[i].enabled || !ai_breaker_available((AIBackendType)i)) continue;
+            const char *model = ai_get_recommended_model((AIBackendType)i, task);
+            if (!model) continue;
+            if (pass == 0 && !model_has_capability((AIBackendType)i, model, cap)) continue;
+            
+            double ms = ai_router_expected_ms((AIBackendType)i, model);
+            if (best < 0 || ms < best_ms) {
+                best = i;
+                best_model = model;
+                best_ms = ms;
+            }
+        }
+        
+        if (best >= 0) {
+            client->backend = (AIBackendType)best;
+            snprintf(client->model, sizeof(client->model), "%s", best_model);
+            return;
+        }
+    }
+}
+
+void ai_set_auto_routing(int enabled) {
+    backend_probe_wait();
+    pthread_mutex_lock(&client_lock);
+    default_client.auto_route = enabled;
+    pthread_mutex_unlock(&client_lock);
+}
+
+int ai_get_auto_routing(void) {
+    pthread_mutex_lock(&client_lock);
+    int enabled = default_client.auto_route;
+    pthread_mutex_unlock(&client_lock);
+    return enabled;
+}
+
+void ai_client_select_model(AIClient *client, TaskType task) {
+    if (client->auto_route) {
+        route_select(client, task);
+        return;
+    }
+    const char *recommended = ai_get_recommended_model(client->backend, task);
     if (recommended) {
-        strncpy(current_model, recommended, sizeof(current_model) - 1);
-        current_model[sizeof(current_model) - 1] = '\0';
+        snprintf(client->model, sizeof(client->model), "%s", recommended);
     }
 }
 
+/*
+ * Auto-select the best model for the task. Selection runs on a copy:
+ * it consults the router and may probe Ollama.
+ */
+void ai_auto_select_model(TaskType task) {
+    AIClient client;
+    ai_client_init(&client);
+    ai_client_select_model(&client, task);
+    
+    pthread_mutex_lock(&client_lock);
+    default_client.backend = client.backend;
+    memcpy(default_client.model, client.model, sizeof(default_client.model));
+    pthread_mutex_unlock(&client_lock);
+}
+
 /* Get optimized system prompt for task type */
 const char *ai_get_optimized_prompt(TaskType task) {
     switch (task) {
@@ -597,594 +1605,1527 @@ const char *ai_get_optimized_prompt(TaskType task) {
     }
 }
 
-/* Query Gemini */
-static AIResponse *query_gemini(const char *prompt, const char *context) {
-    AIResponse *response = calloc(1, sizeof(AIResponse));
-    CURL *curl;
-    CURLcode res;
-    struct MemoryChunk chunk = {0};
-    char *api_key = getenv("GEMINI_API_KEY");
-    
-    if (!api_key) {
-        response->success = 0;
-        response->error_message = strdup("GEMINI_API_KEY not set");
-        return response;
+/*
+ * Rough token estimate: ASCII text runs at a few characters per token
+ * (tokenizers differ a little by provider); each non-ASCII character
+ * (Urdu, Arabic, CJK...) is counted as a token of its own.
+ */
+int ai_estimate_tokens(AIBackendType type, const char *text, size_t len) {
+    size_t ascii = 0, other = 0;
+    
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c < 0x80) ascii++;
+        else if ((c & 0xC0) != 0x80) other++;   /* Lead byte of a multi-byte character */
     }
     
-    /* Build full prompt with context */
-    size_t full_len = strlen(prompt) + (context ? strlen(context) : 0) + 100;
-    char *full_prompt = malloc(full_len);
-    if (context && strlen(context) > 0) {
-        snprintf(full_prompt, full_len, "%s\n\nUser Query: %s", context, prompt);
-    } else {
-        strncpy(full_prompt, prompt, full_len - 1);
+    /* Characters per token, times 10 */
+    size_t chars_x10;
+    switch (type) {
+        case AI_BACKEND_CLAUDE: chars_x10 = 35; break;
+        case AI_BACKEND_OLLAMA:
+        case AI_BACKEND_LOCAL: chars_x10 = 37; break;
+        default: chars_x10 = 40; break;
     }
-    
-    curl = curl_easy_init();
-    
-    if (curl) {
-        char url[512];
-        snprintf(url, sizeof(url), "%s%s:generateContent?key=%s",
-                 backends[AI_BACKEND_GEMINI].api_url, current_model, api_key);
-        
-        json_t *root = json_object();
-        json_t *contents = json_array();
-        json_t *content = json_object();
-        json_t *parts = json_array();
-        
-        json_array_append_new(parts, json_pack("{s:s}", "text", full_prompt));
-        json_object_set_new(content, "parts", parts);
-        json_array_append_new(contents, content);
-        json_object_set_new(root, "contents", contents);
-        
-        char *payload = json_dumps(root, JSON_COMPACT);
-        
-        struct curl_slist *headers = NULL;
-        headers = curl_slist_append(headers, "Content-Type: application/json");
-        headers = curl_slist_append(headers, "Connection: keep-alive");
-        
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &chunk);
-        set_curl_performance_options(curl, 30L);
-        
-        res = curl_easy_perform(curl);
-        
-        if (res == CURLE_OK && chunk.memory) {
-            json_error_t error;
-            json_t *resp_root = json_loads(chunk.memory, 0, &error);
-            if (resp_root) {
-                /* Check for API error response first */
-                json_t *api_error = json_object_get(resp_root, "error");
-                if (api_error) {
-                    json_t *err_msg = json_object_get(api_error, "message");
-                    if (err_msg && json_is_string(err_msg)) {
-                        response->success = 0;
-                        response->error_message = strdup(json_string_value(err_msg));
-                    } else {
-                        response->success = 0;
-                        response->error_message = strdup("Unknown API error");
-                    }
-                } else {
-                    json_t *candidates = json_object_get(resp_root, "candidates");
-                    if (candidates && json_array_size(candidates) > 0) {
-                        json_t *first = json_array_get(candidates, 0);
-                        json_t *content = first ? json_object_get(first, "content") : NULL;
-                        json_t *parts = content ? json_object_get(content, "parts") : NULL;
-                        if (parts && json_array_size(parts) > 0) {
-                            json_t *first_part = json_array_get(parts, 0);
-                            json_t *text = first_part ? json_object_get(first_part, "text") : NULL;
-                            if (text && json_is_string(text)) {
-                                response->content = strdup(json_string_value(text));
-                                response->success = 1;
-                            } else {
-                                response->success = 0;
-                                response->error_message = strdup("Invalid response format from Gemini");
-                            }
-                        } else {
-                            response->success = 0;
-                            response->error_message = strdup("Empty response from Gemini");
-                        }
-                    } else {
-                        response->success = 0;
-                        response->error_message = strdup("No candidates in Gemini response");
-                    }
-                }
-                json_decref(resp_root);
-            } else {
-                response->success = 0;
-                response->error_message = strdup("Failed to parse Gemini response");
-            }
-        } else {
-            response->success = 0;
-            response->error_message = strdup(curl_easy_strerror(res));
-        }
-        
-        curl_easy_cleanup(curl);
-        curl_slist_free_all(headers);
-        free(payload);
-        free(chunk.memory);
-        json_decref(root);
+    return (int)((ascii * 10 + chars_x10 - 1) / chars_x10 + other);
+}
+
+/* Token budget for the whole context (system prompt + session history) */
+int ai_get_context_budget(AIBackendType type, const char *model) {
+    if (context_budget > 0) return (int)context_budget;
+    if (type == AI_BACKEND_LOCAL) return ai_local_context_size() - CONTEXT_REPLY_RESERVE;
+    if (type != AI_BACKEND_OLLAMA) return CONTEXT_BUDGET_CLOUD;
+    
+    /* A configured num_ctx is the window, minus room for the answer */
+    OllamaOpts opts;
+    ollama_opts_get(model, &opts);
+    if (opts.num_ctx > 0) {
+        long reply = opts.num_predict > 0 ? opts.num_predict : CONTEXT_REPLY_RESERVE;
+        long budget = opts.num_ctx - reply;
+        return budget > CONTEXT_BUDGET_MIN ? (int)budget : CONTEXT_BUDGET_MIN;
     }
     
-    free(full_prompt);
-    return response;
+    /* Ollama's default num_ctx is 2048; leave room for the answer */
+    return CONTEXT_BUDGET_LOCAL;
 }
 
-/* Query OpenAI */
-static AIResponse *query_openai(const char *prompt, const char *context) {
-    AIResponse *response = calloc(1, sizeof(AIResponse));
-    CURL *curl;
-    CURLcode res;
-    struct MemoryChunk chunk = {0};
-    char *api_key = getenv("OPENAI_API_KEY");
+/* Display names used in error messages */
+static const char *backend_labels[AI_BACKEND_COUNT] = {
+    "Gemini", "OpenAI", "Claude", "DeepSeek", "Ollama", "Local model"
+};
+
+/* Request prepared for one backend, ready to hand to curl */
+typedef struct {
+    const char *base;            /* Endpoint chosen from the backend's pool */
+    char url[512];
+    struct curl_slist *headers;
+    char *payload;
+} BackendRequest;
+
+/* Incremental parser state for SSE / NDJSON response streams */
+typedef struct {
+    AIBackendType backend;
+    struct MemoryChunk line;     /* Current partial line */
+    struct MemoryChunk text;     /* Response text assembled so far */
+    struct MemoryChunk other;    /* Non-event lines (plain error bodies) */
+    char *error_message;
+    AIStreamCallback on_text;
+    void *userdata;
+} StreamState;
+
+static void stream_state_free(StreamState *st) {
+    free(st->line.memory);
+    free(st->text.memory);
+    free(st->other.memory);
+    free(st->error_message);
+    memset(st, 0, sizeof(*st));
+}
+
+static void backend_request_free(BackendRequest *req) {
+    curl_slist_free_all(req->headers);
+    free(req->payload);
+    req->headers = NULL;
+    req->payload = NULL;
+}
+
+static int conversation_has_system(const AIConversation *conv) {
+    return conv && conv->system && conv->system[0];
+}
+
+/* Stored answer of an earlier turn, possibly cut short */
+static json_t *turn_answer(const AITurn *turn) {
+    return json_stringn(turn->assistant, turn->assistant_len);
+}
+
+/* {"role": role, "content": text} */
+static json_t *chat_message(const char *role, json_t *content) {
+    json_t *message = json_object();
+    json_object_set_new(message, "role", json_string(role));
+    json_object_set_new(message, "content", content);
+    return message;
+}
+
+/*
+ * Messages in the OpenAI / Ollama chat shape: the system prompt first so it
+ * forms a stable prefix, then the earlier turns, then the new question.
+ */
+static json_t *build_chat_messages(const AIConversation *conv, const char *prompt) {
+    json_t *messages = json_array();
+    
+    if (conversation_has_system(conv)) {
+        json_array_append_new(messages, chat_message("system", json_string(conv->system)));
+    }
+    for (int i = 0; conv && i < conv->turn_count; i++) {
+        json_array_append_new(messages, chat_message("user", json_string(conv->turns[i].user)));
+        json_array_append_new(messages, chat_message("assistant", turn_answer(&conv->turns[i])));
+    }
+    json_array_append_new(messages, chat_message("user", json_string(prompt)));
+    return messages;
+}
+
+/* Gemini content entry: {"role": role, "parts": [{"text": text}]} */
+static json_t *gemini_content(const char *role, json_t *text) {
+    json_t *content = json_object();
+    json_t *parts = json_array();
+    json_t *part = json_object();
+    
+    json_object_set_new(part, "text", text);
+    json_array_append_new(parts, part);
+    if (role) json_object_set_new(content, "role", json_string(role));
+    json_object_set_new(content, "parts", parts);
+    return content;
+}
+
+/* Build Gemini request */
+static const char *build_gemini_request(BackendRequest *req, const char *model,
+                                        const char *prompt, const AIConversation *conv,
+                                        int stream) {
+    char *api_key = getenv("GEMINI_API_KEY");
+    if (!api_key) return "GEMINI_API_KEY not set";
+    
+    if (stream) {
+        snprintf(req->url, sizeof(req->url), "%s/%s:streamGenerateContent?alt=sse&key=%s",
+                 req->base, model, api_key);
+    } else {
+        snprintf(req->url, sizeof(req->url), "%s/%s:generateContent?key=%s",
+                 req->base, model, api_key);
+    }
+    
+    json_t *root = json_object();
+    json_t *contents = json_array();
+    
+    /* Kept apart from the turns; implicit caching matches on this prefix */
+    if (conversation_has_system(conv)) {
+        json_object_set_new(root, "systemInstruction",
+                            gemini_content(NULL, json_string(conv->system)));
+    }
+    for (int i = 0; conv && i < conv->turn_count; i++) {
+        json_array_append_new(contents, gemini_content("user", json_string(conv->turns[i].user)));
+        json_array_append_new(contents, gemini_content("model", turn_answer(&conv->turns[i])));
+    }
+    json_array_append_new(contents, gemini_content("user", json_string(prompt)));
+    json_object_set_new(root, "contents", contents);
     
+    req->payload = json_dumps(root, JSON_COMPACT);
+    json_decref(root);
+    
+    req->headers = curl_slist_append(req->headers, "Content-Type: application/json");
+    req->headers = curl_slist_append(req->headers, "Connection: keep-alive");
+    return NULL;
+}
+
+/* Build OpenAI-compatible request (OpenAI, DeepSeek) */
+static const char *build_openai_request(BackendRequest *req, AIBackendType type, const char *model,
+                                        const char *prompt, const AIConversation *conv,
+                                        int stream) {
+    char *api_key = getenv(backends[type].env_key);
     if (!api_key) {
-        response->success = 0;
-        response->error_message = strdup("OPENAI_API_KEY not set");
-        return response;
+        return type == AI_BACKEND_DEEPSEEK ? "DEEPSEEK_API_KEY not set" : "OPENAI_API_KEY not set";
     }
     
-    curl = curl_easy_init();
+    snprintf(req->url, sizeof(req->url), "%s", req->base);
     
-    if (curl) {
-        json_t *root = json_object();
-        json_t *messages = json_array();
-        
-        /* System message with context */
-        if (context && strlen(context) > 0) {
-            json_array_append_new(messages, 
-                json_pack("{s:s, s:s}", "role", "system", "content", context));
-        }
-        
-        /* User message */
-        json_array_append_new(messages,
-            json_pack("{s:s, s:s}", "role", "user", "content", prompt));
-        
-        json_object_set_new(root, "model", json_string(current_model));
-        json_object_set_new(root, "messages", messages);
-        json_object_set_new(root, "max_tokens", json_integer(2048));
-        
-        char *payload = json_dumps(root, JSON_COMPACT);
-        
-        struct curl_slist *headers = NULL;
-        headers = curl_slist_append(headers, "Content-Type: application/json");
-        headers = curl_slist_append(headers, "Connection: keep-alive");
-        char auth_header[256];
-        snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", api_key);
-        headers = curl_slist_append(headers, auth_header);
-        
-        curl_easy_setopt(curl, CURLOPT_URL, backends[AI_BACKEND_OPENAI].api_url);
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &chunk);
-        set_curl_performance_options(curl, 30L);
-        
-        res = curl_easy_perform(curl);
-        
-        if (res == CURLE_OK && chunk.memory) {
-            json_error_t error;
-            json_t *resp_root = json_loads(chunk.memory, 0, &error);
-            if (resp_root) {
-                /* Check for API error response first */
-                json_t *api_error = json_object_get(resp_root, "error");
-                if (api_error) {
-                    json_t *err_msg = json_object_get(api_error, "message");
-                    if (err_msg && json_is_string(err_msg)) {
-                        response->success = 0;
-                        response->error_message = strdup(json_string_value(err_msg));
-                    } else {
-                        response->success = 0;
-                        response->error_message = strdup("Unknown OpenAI API error");
-                    }
-                } else {
-                    json_t *choices = json_object_get(resp_root, "choices");
-                    if (choices && json_array_size(choices) > 0) {
-                        json_t *first = json_array_get(choices, 0);
-                        json_t *message = first ? json_object_get(first, "message") : NULL;
-                        json_t *content = message ? json_object_get(message, "content") : NULL;
-                        if (content && json_is_string(content)) {
-                            response->content = strdup(json_string_value(content));
-                            response->success = 1;
-                        } else {
-                            response->success = 0;
-                            response->error_message = strdup("Invalid response format from OpenAI");
-                        }
-                    } else {
-                        response->success = 0;
-                        response->error_message = strdup("No choices in OpenAI response");
-                    }
-                }
-                json_decref(resp_root);
-            } else {
-                response->success = 0;
-                response->error_message = strdup("Failed to parse OpenAI response");
-            }
-        } else {
-            response->success = 0;
-            response->error_message = strdup(curl_easy_strerror(res));
-        }
-        
-        curl_easy_cleanup(curl);
-        curl_slist_free_all(headers);
-        free(payload);
-        free(chunk.memory);
-        json_decref(root);
+    /* Both providers cache a repeated message prefix on their own */
+    json_t *root = json_object();
+    json_object_set_new(root, "model", json_string(model));
+    json_object_set_new(root, "messages", build_chat_messages(conv, prompt));
+    json_object_set_new(root, "max_tokens", json_integer(2048));
+    if (stream) {
+        json_object_set_new(root, "stream", json_true());
     }
     
+    req->payload = json_dumps(root, JSON_COMPACT);
+    json_decref(root);
     
-    return response;
+    req->headers = curl_slist_append(req->headers, "Content-Type: application/json");
+    req->headers = curl_slist_append(req->headers, "Connection: keep-alive");
+    char auth_header[256];
+    snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", api_key);
+    req->headers = curl_slist_append(req->headers, auth_header);
+    return NULL;
 }
 
-/* Query Anthropic Claude */
-static AIResponse *query_claude(const char *prompt, const char *context) {
-    AIResponse *response = calloc(1, sizeof(AIResponse));
-    CURL *curl;
-    CURLcode res;
-    struct MemoryChunk chunk = {0};
+/* Claude text block, optionally marked as the end of a cacheable prefix */
+static json_t *claude_text_block(json_t *text, int cache) {
+    json_t *block = json_object();
+    json_object_set_new(block, "type", json_string("text"));
+    json_object_set_new(block, "text", text);
+    if (cache) {
+        json_object_set_new(block, "cache_control", json_pack("{s:s}", "type", "ephemeral"));
+    }
+    return block;
+}
+
+/* Build Anthropic Claude request */
+static const char *build_claude_request(BackendRequest *req, const char *model,
+                                        const char *prompt, const AIConversation *conv,
+                                        int stream) {
     char *api_key = getenv("ANTHROPIC_API_KEY");
+    if (!api_key) return "ANTHROPIC_API_KEY not set";
+    
+    snprintf(req->url, sizeof(req->url), "%s", req->base);
+    
+    json_t *root = json_object();
+    json_t *messages = json_array();
+    
+    /*
+     * Two cache breakpoints: the system prompt, and the last earlier answer
+     * so the next question reuses the whole history written so far.
+     */
+    for (int i = 0; conv && i < conv->turn_count; i++) {
+        int last = i == conv->turn_count - 1;
+        json_t *answer = json_array();
+        json_array_append_new(answer, claude_text_block(turn_answer(&conv->turns[i]), last));
+        json_array_append_new(messages, chat_message("user", json_string(conv->turns[i].user)));
+        json_array_append_new(messages, chat_message("assistant", answer));
+    }
+    json_array_append_new(messages, chat_message("user", json_string(prompt)));
     
-    if (!api_key) {
+    json_object_set_new(root, "model", json_string(model));
+    json_object_set_new(root, "messages", messages);
+    json_object_set_new(root, "max_tokens", json_integer(2048));
+    if (stream) {
+        json_object_set_new(root, "stream", json_true());
+    }
+    
+    if (conversation_has_system(conv)) {
+        json_t *system = json_array();
+        json_array_append_new(system, claude_text_block(json_string(conv->system), 1));
+        json_object_set_new(root, "system", system);
+    }
+    
+    req->payload = json_dumps(root, JSON_COMPACT);
+    json_decref(root);
+    
+    req->headers = curl_slist_append(req->headers, "Content-Type: application/json");
+    req->headers = curl_slist_append(req->headers, "Connection: keep-alive");
+    char auth_header[256];
+    snprintf(auth_header, sizeof(auth_header), "x-api-key: %s", api_key);
+    req->headers = curl_slist_append(req->headers, auth_header);
+    req->headers = curl_slist_append(req->headers, "anthropic-version: 2023-06-01");
+    return NULL;
+}
+
+/* Build Ollama (local) request */
+static const char *build_ollama_request(BackendRequest *req, const char *model,
+                                        const char *prompt, const AIConversation *conv,
+                                        int stream) {
+    /* Chat keeps turns apart; the server reuses its KV cache for a matching prefix */
+    snprintf(req->url, sizeof(req->url), "%s/api/chat", req->base);
+    
+    json_t *root = json_object();
+    json_object_set_new(root, "model", json_string(model));
+    json_object_set_new(root, "messages", build_chat_messages(conv, prompt));
+    json_object_set_new(root, "stream", json_boolean(stream));
+    ollama_add_runtime_opts(root, model);
+    
+    req->payload = json_dumps(root, JSON_COMPACT);
+    json_decref(root);
+    
+    req->headers = curl_slist_append(req->headers, "Content-Type: application/json");
+    req->headers = curl_slist_append(req->headers, "Connection: keep-alive");
+    return NULL;
+}
+
+static const char *build_backend_request(AIBackendType type, BackendRequest *req, const char *model,
+                                         const char *prompt, const AIConversation *conv,
+                                         int stream) {
+    switch (type) {
+        case AI_BACKEND_GEMINI:
+            return build_gemini_request(req, model, prompt, conv, stream);
+        case AI_BACKEND_OPENAI:
+        case AI_BACKEND_DEEPSEEK:
+            return build_openai_request(req, type, model, prompt, conv, stream);
+        case AI_BACKEND_CLAUDE:
+            return build_claude_request(req, model, prompt, conv, stream);
+        case AI_BACKEND_OLLAMA:
+            return build_ollama_request(req, model, prompt, conv, stream);
+        default:
+            return "Unknown backend";
+    }
+}
+
+/* Fill error_message from an API error body; returns 1 if it was an error */
+static int parse_api_error(AIBackendType type, json_t *root, AIResponse *response) {
+    json_t *api_error = json_object_get(root, "error");
+    if (!api_error) return 0;
+    
+    /* Ollama reports a bare string, the cloud APIs an object with a message */
+    json_t *err_msg = json_is_string(api_error) ? api_error : json_object_get(api_error, "message");
+    response->success = 0;
+    if (err_msg && json_is_string(err_msg)) {
+        response->error_message = strdup(json_string_value(err_msg));
+    } else {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Unknown %s API error", backend_labels[type]);
+        response->error_message = strdup(msg);
+    }
+    return 1;
+}
+
+/* Extract the response text from a complete (non-streamed) body */
+static void parse_backend_body(AIBackendType type, json_t *root, AIResponse *response) {
+    const char *label = backend_labels[type];
+    json_t *text = NULL;
+    const char *missing = NULL;
+    char msg[128];
+    
+    if (parse_api_error(type, root, response)) return;
+    
+    switch (type) {
+        case AI_BACKEND_GEMINI: {
+            json_t *candidates = json_object_get(root, "candidates");
+            if (!candidates || json_array_size(candidates) == 0) {
+                missing = "No candidates in Gemini response";
+                break;
+            }
+            json_t *first = json_array_get(candidates, 0);
+            json_t *content = first ? json_object_get(first, "content") : NULL;
+            json_t *parts = content ? json_object_get(content, "parts") : NULL;
+            if (!parts || json_array_size(parts) == 0) {
+                missing = "Empty response from Gemini";
+                break;
+            }
+            json_t *first_part = json_array_get(parts, 0);
+            text = first_part ? json_object_get(first_part, "text") : NULL;
+            break;
+        }
+        case AI_BACKEND_OPENAI:
+        case AI_BACKEND_DEEPSEEK: {
+            json_t *choices = json_object_get(root, "choices");
+            if (!choices || json_array_size(choices) == 0) {
+                snprintf(msg, sizeof(msg), "No choices in %s response", label);
+                missing = msg;
+                break;
+            }
+            json_t *first = json_array_get(choices, 0);
+            json_t *message = first ? json_object_get(first, "message") : NULL;
+            text = message ? json_object_get(message, "content") : NULL;
+            break;
+        }
+        case AI_BACKEND_CLAUDE: {
+            json_t *content_arr = json_object_get(root, "content");
+            if (!content_arr || json_array_size(content_arr) == 0) {
+                missing = "No content in Claude response";
+                break;
+            }
+            json_t *first = json_array_get(content_arr, 0);
+            text = first ? json_object_get(first, "text") : NULL;
+            break;
+        }
+        case AI_BACKEND_OLLAMA: {
+            json_t *message = json_object_get(root, "message");
+            text = message ? json_object_get(message, "content") : NULL;
+            if (!text || !json_is_string(text)) missing = "No response from Ollama";
+            break;
+        }
+        default:
+            missing = "Unknown backend";
+    }
+    
+    if (missing) {
         response->success = 0;
-        response->error_message = strdup("ANTHROPIC_API_KEY not set");
-        return response;
+        response->error_message = strdup(missing);
+    } else if (text && json_is_string(text)) {
+        response->content = strdup(json_string_value(text));
+        response->success = 1;
+    } else {
+        snprintf(msg, sizeof(msg), "Invalid response format from %s", label);
+        response->success = 0;
+        response->error_message = strdup(msg);
     }
+}
+
+/* Append streamed text and hand it to the caller */
+static void stream_emit(StreamState *st, const char *text) {
+    size_t len;
     
+    if (!text || !(len = strlen(text))) return;
+    if (chunk_append(&st->text, text, len) != 0) return;
+    if (st->on_text) st->on_text(text, len, st->userdata);
+}
+
+/* Handle one decoded event (an SSE data payload or an NDJSON line) */
+static void stream_handle_event(StreamState *st, const char *data, size_t len) {
+    json_error_t error;
+    json_t *event = json_loadb(data, len, 0, &error);
+    
+    if (!event) {
+        /* Not JSON - likely part of a pretty-printed error body */
+        chunk_append(&st->other, data, len);
+        chunk_append(&st->other, "\n", 1);
+        return;
+    }
     
-    curl = curl_easy_init();
+    AIResponse err = {0};
+    if (parse_api_error(st->backend, event, &err)) {
+        if (!st->error_message) st->error_message = err.error_message;
+        else free(err.error_message);
+        json_decref(event);
+        return;
+    }
     
-    if (curl) {
-        json_t *root = json_object();
-        json_t *messages = json_array();
-        
-        /* User message */
-        json_array_append_new(messages,
-            json_pack("{s:s, s:s}", "role", "user", "content", prompt));
-        
-        json_object_set_new(root, "model", json_string(current_model));
-        json_object_set_new(root, "messages", messages);
-        json_object_set_new(root, "max_tokens", json_integer(2048));
-        
-        if (context && strlen(context) > 0) {
-            json_object_set_new(root, "system", json_string(context));
+    switch (st->backend) {
+        case AI_BACKEND_GEMINI: {
+            /* candidates[0].content.parts[*].text */
+            json_t *candidates = json_object_get(event, "candidates");
+            json_t *first = json_array_get(candidates, 0);
+            json_t *content = first ? json_object_get(first, "content") : NULL;
+            json_t *parts = content ? json_object_get(content, "parts") : NULL;
+            for (size_t i = 0; i < json_array_size(parts); i++) {
+                json_t *text = json_object_get(json_array_get(parts, i), "text");
+                if (json_is_string(text)) stream_emit(st, json_string_value(text));
+            }
+            break;
         }
-        
-        char *payload = json_dumps(root, JSON_COMPACT);
-        
-        struct curl_slist *headers = NULL;
-        headers = curl_slist_append(headers, "Content-Type: application/json");
-        headers = curl_slist_append(headers, "Connection: keep-alive");
-        char auth_header[256];
-        snprintf(auth_header, sizeof(auth_header), "x-api-key: %s", api_key);
-        headers = curl_slist_append(headers, auth_header);
-        headers = curl_slist_append(headers, "anthropic-version: 2023-06-01");
-        
-        curl_easy_setopt(curl, CURLOPT_URL, backends[AI_BACKEND_CLAUDE].api_url);
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &chunk);
-        set_curl_performance_options(curl, 30L);
-        
-        res = curl_easy_perform(curl);
-        
-        if (res == CURLE_OK && chunk.memory) {
-            json_error_t error;
-            json_t *resp_root = json_loads(chunk.memory, 0, &error);
-            if (resp_root) {
-                /* Check for API error response first */
-                json_t *api_error = json_object_get(resp_root, "error");
-                if (api_error) {
-                    json_t *err_msg = json_object_get(api_error, "message");
-                    if (err_msg && json_is_string(err_msg)) {
-                        response->success = 0;
-                        response->error_message = strdup(json_string_value(err_msg));
-                    } else {
-                        response->success = 0;
-                        response->error_message = strdup("Unknown Claude API error");
-                    }
-                } else {
-                    json_t *content_arr = json_object_get(resp_root, "content");
-                    if (content_arr && json_array_size(content_arr) > 0) {
-                        json_t *first = json_array_get(content_arr, 0);
-                        json_t *text = first ? json_object_get(first, "text") : NULL;
-                        if (text && json_is_string(text)) {
-                            response->content = strdup(json_string_value(text));
-                            response->success = 1;
-                        } else {
-                            response->success = 0;
-                            response->error_message = strdup("Invalid response format from Claude");
-                        }
-                    } else {
-                        response->success = 0;
-                        response->error_message = strdup("No content in Claude response");
-                    }
-                }
-                json_decref(resp_root);
-            } else {
-                response->success = 0;
-                response->error_message = strdup("Failed to parse Claude response");
+        case AI_BACKEND_OPENAI:
+        case AI_BACKEND_DEEPSEEK: {
+            /* choices[0].delta.content */
+            json_t *first = json_array_get(json_object_get(event, "choices"), 0);
+            json_t *delta = first ? json_object_get(first, "delta") : NULL;
+            json_t *text = delta ? json_object_get(delta, "content") : NULL;
+            if (json_is_string(text)) stream_emit(st, json_string_value(text));
+            break;
+        }
+        case AI_BACKEND_CLAUDE: {
+            /* content_block_delta events carry delta.text */
+            json_t *type = json_object_get(event, "type");
+            if (json_is_string(type) &&
+                strcmp(json_string_value(type), "content_block_delta") == 0) {
+                json_t *delta = json_object_get(event, "delta");
+                json_t *text = delta ? json_object_get(delta, "text") : NULL;
+                if (json_is_string(text)) stream_emit(st, json_string_value(text));
             }
+            break;
+        }
+        case AI_BACKEND_OLLAMA: {
+            json_t *message = json_object_get(event, "message");
+            json_t *text = message ? json_object_get(message, "content") : NULL;
+            if (json_is_string(text)) stream_emit(st, json_string_value(text));
+            break;
+        }
+        default:
+            break;
+    }
+    
+    json_decref(event);
+}
+
+/* Handle one complete line of a response stream */
+static void stream_handle_line(StreamState *st, char *line, size_t len) {
+    if (len > 0 && line[len - 1] == '\r') line[--len] = '\0';
+    if (len == 0) return;
+    
+    /* Ollama streams newline-delimited JSON */
+    if (st->backend == AI_BACKEND_OLLAMA) {
+        stream_handle_event(st, line, len);
+        return;
+    }
+    
+    /* Everything else is Server-Sent Events */
+    if (strncmp(line, "data:", 5) == 0) {
+        char *data = line + 5;
+        if (*data == ' ') data++;
+        if (strcmp(data, "[DONE]") == 0) return;
+        stream_handle_event(st, data, len - (size_t)(data - line));
+        return;
+    }
+    if (line[0] == ':' || strncmp(line, "event:", 6) == 0 ||
+        strncmp(line, "id:", 3) == 0 || strncmp(line, "retry:", 6) == 0) {
+        return;
+    }
+    
+    /* Plain body (e.g. a JSON error on a non-2xx reply) */
+    chunk_append(&st->other, line, len);
+    chunk_append(&st->other, "\n", 1);
+}
+
+/* CURL write callback for streamed responses */
+static size_t stream_write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
+    size_t realsize = size * nmemb;
+    StreamState *st = (StreamState *)userp;
+    const char *data = (const char *)contents;
+    size_t start = 0;
+    
+    for (size_t i = 0; i < realsize; i++) {
+        if (data[i] != '\n') continue;
+        
+        if (chunk_append(&st->line, data + start, i - start) != 0) return 0;
+        stream_handle_line(st, st->line.memory ? st->line.memory : "", st->line.size);
+        st->line.size = 0;
+        if (st->line.memory) st->line.memory[0] = '\0';
+        start = i + 1;
+    }
+    
+    if (start < realsize && chunk_append(&st->line, data + start, realsize - start) != 0) {
+        return 0;
+    }
+    return realsize;
+}
+
+/* Turn the finished stream into a response */
+static void stream_finish(StreamState *st, AIResponse *response) {
+    /* Flush a final line without a trailing newline */
+    if (st->line.size > 0) {
+        stream_handle_line(st, st->line.memory, st->line.size);
+    }
+    
+    if (st->error_message) {
+        response->success = 0;
+        response->error_message = st->error_message;
+        st->error_message = NULL;
+    } else if (st->text.size > 0) {
+        response->content = st->text.memory;
+        response->success = 1;
+        st->text.memory = NULL;
+    } else if (st->other.memory) {
+        /* The server answered with an ordinary body instead of a stream */
+        json_error_t error;
+        json_t *root = json_loads(st->other.memory, 0, &error);
+        if (root) {
+            parse_backend_body(st->backend, root, response);
+            json_decref(root);
         } else {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "Failed to parse %s response", backend_labels[st->backend]);
             response->success = 0;
-            response->error_message = strdup(curl_easy_strerror(res));
+            response->error_message = strdup(msg);
         }
-        
-        curl_easy_cleanup(curl);
-        curl_slist_free_all(headers);
-        free(payload);
-        free(chunk.memory);
-        json_decref(root);
+    } else {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Empty response from %s", backend_labels[st->backend]);
+        response->success = 0;
+        response->error_message = strdup(msg);
     }
     
+    stream_state_free(st);
+}
+
+/*
+ * One query as it moves through pacing, hedging and fallback: everything
+ * it needs travels here rather than in globals, so threads can run
+ * queries side by side.
+ */
+typedef struct {
+    AIClient client;                /* Snapshot; never changes during the query */
+    const char *prompt;
+    const AIConversation *conv;
+    AIStreamCallback on_text;
+    void *userdata;
+    unsigned int seed;              /* Rate-limit jitter */
+} AIRequest;
+
+/* One request to a backend, driven by curl_easy_perform or a multi handle */
+typedef struct {
+    AIBackendType type;
+    const char *model;
+    BackendRequest req;
+    CURL *curl;
+    int stream;
+    struct MemoryChunk chunk;
+    StreamState st;
+    JsonExtractor extract;
+    unsigned long long rate_key;    /* Rate-limit bucket, 0 = none */
+    AIRateHeaders rate;
+    int endpoint;                   /* Index in the backend's endpoint pool, -1 = none */
+    int trial;                      /* Holds the backend's breaker trial until an outcome */
+} BackendTransfer;
+
+/* Where each backend puts the answer text in a complete response body */
+static const char *const gemini_text_path[] = {"candidates", "0", "content", "parts", "0", "text"};
+static const char *const openai_text_path[] = {"choices", "0", "message", "content"};
+static const char *const claude_text_path[] = {"content", "0", "text"};
+static const char *const ollama_text_path[] = {"message", "content"};
+
+static void extract_init_for(JsonExtractor *x, AIBackendType type) {
+    switch (type) {
+        case AI_BACKEND_GEMINI:
+            json_extract_init(x, gemini_text_path, 6);
+            break;
+        case AI_BACKEND_OPENAI:
+        case AI_BACKEND_DEEPSEEK:
+            json_extract_init(x, openai_text_path, 4);
+            break;
+        case AI_BACKEND_CLAUDE:
+            json_extract_init(x, claude_text_path, 3);
+            break;
+        default:
+            json_extract_init(x, ollama_text_path, 2);
+            break;
+    }
+}
+
+/*
+ * CURL write callback for complete bodies: the extractor copies out the
+ * answer text as it arrives. Raw bytes are kept only until that text
+ * starts, which is all the jansson fallback for error bodies needs.
+ */
+static size_t extract_write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
+    size_t realsize = size * nmemb;
+    BackendTransfer *t = (BackendTransfer *)userp;
     
+    if (!t->extract.started && chunk_append(&t->chunk, contents, realsize) != 0) return 0;
+    json_extract_feed(&t->extract, contents, realsize);
+    return realsize;
+}
+
+/* Keep the most recent samples */
+static void ring_record(LatencyRing *ring, long ms) {
+    pthread_mutex_lock(&ring_lock);
+    ring->ms[ring->next] = ms;
+    ring->next = (ring->next + 1) % LATENCY_SAMPLES;
+    if (ring->count < LATENCY_SAMPLES) ring->count++;
+    pthread_mutex_unlock(&ring_lock);
+}
+
+static int compare_long(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/* Sample percentile in ms, or -1 without enough samples */
+static long ring_percentile(const LatencyRing *ring, int pct) {
+    long sorted[LATENCY_SAMPLES];
+
+    pthread_mutex_lock(&ring_lock);
+    int count = ring->count;
+    memcpy(sorted, ring->ms, sizeof(long) * count);
+    pthread_mutex_unlock(&ring_lock);
+
+    if (count < 5) return -1;
+    qsort(sorted, count, sizeof(long), compare_long);
+    int idx = (count * pct + 99) / 100 - 1;
+    if (idx < 0) idx = 0;
+    return sorted[idx];
+}
+
+static long clamp_ms(long ms, long min, long max) {
+    return ms < min ? min : ms > max ? max : ms;
+}
+
+/* Connection setup (TCP + TLS) allowance: a few times the usual p95 */
+static long connect_timeout_for(AIBackendType type) {
+    long p95 = ring_percentile(&backend_connect[type], 95);
+    if (p95 < 0) return CONNECT_TIMEOUT_MS;
+    return clamp_ms(p95 * TIMEOUT_HEADROOM, CONNECT_TIMEOUT_MIN_MS, CONNECT_TIMEOUT_MS);
+}
+
+/* Longest silence allowed: a few times the p99 wait for the first byte, or for the answer */
+static long stall_timeout_for(AIBackendType type, const char *model, int stream) {
+    long p99 = stream ? ring_percentile(&backend_ttfb[type], 99) : ai_router_percentile(type, model, 99);
+    if (p99 < 0) {
+        return type == AI_BACKEND_OLLAMA || type == AI_BACKEND_LOCAL ?
+               STALL_TIMEOUT_LOCAL_MS : STALL_TIMEOUT_CLOUD_MS;
+    }
+    return clamp_ms(p99 * TIMEOUT_HEADROOM, STALL_TIMEOUT_MIN_MS, REQUEST_TIMEOUT_MAX_MS);
+}
+
+void ai_get_timeouts(AIBackendType type, const char *model, long *connect_ms,
+                     long *stall_ms, long *stream_stall_ms) {
+    if (type < 0 || type >= AI_BACKEND_COUNT) type = AI_BACKEND_GEMINI;
+    *connect_ms = connect_timeout_for(type);
+    *stall_ms = stall_timeout_for(type, model, 0);
+    *stream_stall_ms = stall_timeout_for(type, model, 1);
+}
+
+/*
+ * Did the backend, rather than the request, fail? Transport errors,
+ * timeouts, server errors and rejected keys count. Rate limiting is left
+ * to the rate limiter; other 4xx answers mean the request itself was bad.
+ */
+static int backend_at_fault(CURL *curl, CURLcode res, const AIResponse *response) {
+    long code = 0;
+
+    if (response->success) return 0;
+    if (res != CURLE_OK) return 1;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    if (code >= 400 && code < 500) return code == 401 || code == 403 || code == 408;
+    return 1;
+}
+
+/* Collect rate-limit headers; a redirect or 100-continue simply overwrites them */
+static size_t rate_header_callback(char *buffer, size_t size, size_t nitems, void *userdata) {
+    BackendTransfer *t = (BackendTransfer *)userdata;
+    ai_rate_headers_parse(&t->rate, buffer, size * nitems);
+    return size * nitems;
+}
+
+/* Bucket shared by everyone using this API key; local servers are not limited */
+static unsigned long long rate_key_for(AIBackendType type) {
+    if (type == AI_BACKEND_OLLAMA || type == AI_BACKEND_LOCAL) return 0;
+    unsigned long long hash = fnv_string(1469598103934665603ULL, backends[type].name);
+    return fnv_string(hash, getenv(backends[type].env_key)) | 1;
+}
+
+static AIResponse *rate_limited_response(AIBackendType type, long wait_ms) {
+    AIResponse *response = calloc(1, sizeof(AIResponse));
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%s rate limit reached; next request allowed in %ld s",
+             backend_labels[type], (wait_ms + 999) / 1000);
+    response->error_message = strdup(msg);
+    response->rate_limited = 1;
     return response;
 }
 
-/* Query DeepSeek (same API format as OpenAI) */
-static AIResponse *query_deepseek(const char *prompt, const char *context) {
+/* Take a rate-limit slot only if one is free now */
+static AIResponse *rate_limit_now(AIBackendType type) {
+    long wait_ms;
+    if (ai_ratelimit_acquire(rate_key_for(type), 0, &wait_ms)) return NULL;
+    return rate_limited_response(type, wait_ms);
+}
+
+/* Error for a backend its circuit breaker keeps from a request */
+static AIResponse *breaker_refused_response(AIBackendType type) {
+    AIBreakerStats breaker;
+    char msg[160];
+    ai_breaker_get_stats(type, &breaker);
+    if (breaker.state == BREAKER_OPEN) {
+        snprintf(msg, sizeof(msg), "%s skipped after repeated failures; retrying in %ld s",
+                 backend_labels[type], (breaker.retry_in_ms + 999) / 1000);
+    } else {
+        snprintf(msg, sizeof(msg), "%s skipped after repeated failures; a trial request is under way",
+                 backend_labels[type]);
+    }
     AIResponse *response = calloc(1, sizeof(AIResponse));
-    CURL *curl;
-    CURLcode res;
-    struct MemoryChunk chunk = {0};
-    char *api_key = getenv("DEEPSEEK_API_KEY");
-    
-    if (!api_key) {
+    response->error_message = strdup(msg);
+    return response;
+}
+
+/* Build the request and configure a pooled handle; returns an error response on failure */
+static AIResponse *transfer_start(BackendTransfer *t, AIBackendType type, const char *model,
+                                  const AIRequest *q) {
+    memset(t, 0, sizeof(*t));
+    int admit = ai_breaker_allow(type);
+    if (!admit) {
+        t->endpoint = -1;
+        return breaker_refused_response(type);
+    }
+    t->trial = admit == AI_BREAKER_TRIAL;
+    t->type = type;
+    t->model = model;
+    t->stream = q->on_text && q->client.stream;
+    t->rate_key = rate_key_for(type);
+    ai_rate_headers_init(&t->rate);
+    t->endpoint = ai_endpoint_acquire(type, model);
+    t->req.base = ai_endpoint_url(type, t->endpoint);
+    
+    const char *build_error = build_backend_request(type, &t->req, model, q->prompt, q->conv, t->stream);
+    if (!build_error && !(t->curl = curl_pool_acquire(type))) {
+        build_error = "Failed to initialize CURL";
+    }
+    if (build_error) {
+        AIResponse *response = calloc(1, sizeof(AIResponse));
         response->success = 0;
-        response->error_message = strdup("DEEPSEEK_API_KEY not set");
+        response->error_message = strdup(build_error);
+        ai_endpoint_release(type, t->endpoint, -1, 0);
+        if (t->trial) ai_breaker_release(type);
+        backend_request_free(&t->req);
         return response;
     }
     
+    t->st.backend = type;
+    t->st.on_text = q->on_text;
+    t->st.userdata = q->userdata;
+    
+    curl_easy_setopt(t->curl, CURLOPT_URL, t->req.url);
+    curl_easy_setopt(t->curl, CURLOPT_HTTPHEADER, t->req.headers);
+    curl_easy_setopt(t->curl, CURLOPT_POSTFIELDS, t->req.payload);
+    curl_easy_setopt(t->curl, CURLOPT_PRIVATE, t);
+    curl_easy_setopt(t->curl, CURLOPT_HEADERFUNCTION, rate_header_callback);
+    curl_easy_setopt(t->curl, CURLOPT_HEADERDATA, t);
+    if (t->stream) {
+        curl_easy_setopt(t->curl, CURLOPT_WRITEFUNCTION, stream_write_callback);
+        curl_easy_setopt(t->curl, CURLOPT_WRITEDATA, &t->st);
+    } else {
+        extract_init_for(&t->extract, type);
+        curl_easy_setopt(t->curl, CURLOPT_WRITEFUNCTION, extract_write_callback);
+        curl_easy_setopt(t->curl, CURLOPT_WRITEDATA, t);
+    }
+    set_curl_performance_options(t->curl, connect_timeout_for(type), stall_timeout_for(type, model, t->stream),
+                                 q->client.timeout_ms > 0 ? q->client.timeout_ms : REQUEST_TIMEOUT_MAX_MS);
+    return NULL;
+}
+
+/* Has the server sent anything yet? */
+static int transfer_has_first_byte(BackendTransfer *t) {
+    curl_off_t downloaded = 0;
+    curl_easy_getinfo(t->curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+    return downloaded > 0;
+}
+
+/* Drop a transfer that will not be completed */
+static void transfer_abort(BackendTransfer *t) {
+    if (t->endpoint >= 0) {
+        ai_endpoint_release(t->type, t->endpoint, -1, 0);
+        t->endpoint = -1;
+    }
+    if (t->trial) {
+        ai_breaker_release(t->type);
+        t->trial = 0;
+    }
+    if (t->curl) {
+        curl_pool_release(t->type, t->curl);
+        t->curl = NULL;
+    }
+    stream_state_free(&t->st);
+    json_extract_free(&t->extract);
+    free(t->chunk.memory);
+    t->chunk.memory = NULL;
+    backend_request_free(&t->req);
+}
+
+/* Turn a completed transfer into a response and return the handle to its pool */
+static AIResponse *transfer_finish(BackendTransfer *t, CURLcode res) {
+    AIResponse *response = calloc(1, sizeof(AIResponse));
+    AIBackendType type = t->type;
     
-    curl = curl_easy_init();
-    
-    if (curl) {
-        json_t *root = json_object();
-        json_t *messages = json_array();
-        
-        if (context && strlen(context) > 0) {
-            json_array_append_new(messages,
-                json_pack("{s:s, s:s}", "role", "system", "content", context));
-        }
-        
-        json_array_append_new(messages,
-            json_pack("{s:s, s:s}", "role", "user", "content", prompt));
-        
-        json_object_set_new(root, "model", json_string(current_model));
-        json_object_set_new(root, "messages", messages);
-        json_object_set_new(root, "max_tokens", json_integer(2048));
-        
-        char *payload = json_dumps(root, JSON_COMPACT);
-        
-        struct curl_slist *headers = NULL;
-        headers = curl_slist_append(headers, "Content-Type: application/json");
-        headers = curl_slist_append(headers, "Connection: keep-alive");
-        char auth_header[256];
-        snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", api_key);
-        headers = curl_slist_append(headers, auth_header);
-        
-        curl_easy_setopt(curl, CURLOPT_URL, backends[AI_BACKEND_DEEPSEEK].api_url);
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &chunk);
-        set_curl_performance_options(curl, 30L);
-        
-        res = curl_easy_perform(curl);
-        
-        if (res == CURLE_OK && chunk.memory) {
-            json_error_t error;
-            json_t *resp_root = json_loads(chunk.memory, 0, &error);
-            if (resp_root) {
-                /* Check for API error response first */
-                json_t *api_error = json_object_get(resp_root, "error");
-                if (api_error) {
-                    json_t *err_msg = json_object_get(api_error, "message");
-                    if (err_msg && json_is_string(err_msg)) {
-                        response->success = 0;
-                        response->error_message = strdup(json_string_value(err_msg));
-                    } else {
-                        response->success = 0;
-                        response->error_message = strdup("Unknown DeepSeek API error");
-                    }
-                } else {
-                    json_t *choices = json_object_get(resp_root, "choices");
-                    if (choices && json_array_size(choices) > 0) {
-                        json_t *first = json_array_get(choices, 0);
-                        json_t *message = first ? json_object_get(first, "message") : NULL;
-                        json_t *content = message ? json_object_get(message, "content") : NULL;
-                        if (content && json_is_string(content)) {
-                            response->content = strdup(json_string_value(content));
-                            response->success = 1;
-                        } else {
-                            response->success = 0;
-                            response->error_message = strdup("Invalid response format from DeepSeek");
-                        }
-                    } else {
-                        response->success = 0;
-                        response->error_message = strdup("No choices in DeepSeek response");
-                    }
-                }
-                json_decref(resp_root);
-            } else {
-                response->success = 0;
-                response->error_message = strdup("Failed to parse DeepSeek response");
-            }
+    if (res != CURLE_OK) {
+        response->success = 0;
+        response->error_message = strdup(curl_easy_strerror(res));
+    } else if (t->stream) {
+        stream_finish(&t->st, response);
+    } else if (json_extract_ok(&t->extract)) {
+        response->content = json_extract_take(&t->extract);
+        response->success = 1;
+    } else if (t->extract.started) {
+        /* The text began but the body broke off; the raw copy is incomplete */
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Invalid response format from %s", backend_labels[type]);
+        response->success = 0;
+        response->error_message = strdup(msg);
+    } else if (t->chunk.memory) {
+        json_error_t error;
+        json_t *resp_root = json_loads(t->chunk.memory, 0, &error);
+        if (resp_root) {
+            parse_backend_body(type, resp_root, response);
+            json_decref(resp_root);
         } else {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "Failed to parse %s response", backend_labels[type]);
             response->success = 0;
-            response->error_message = strdup(curl_easy_strerror(res));
+            response->error_message = strdup(msg);
         }
-        
-        curl_easy_cleanup(curl);
-        curl_slist_free_all(headers);
-        free(payload);
-        free(chunk.memory);
-        json_decref(root);
+    } else {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Empty response from %s", backend_labels[type]);
+        response->success = 0;
+        response->error_message = strdup(msg);
     }
     
+    curl_off_t ttfb_us = 0, total_us = 0, connect_us = 0;
+    curl_easy_getinfo(t->curl, CURLINFO_STARTTRANSFER_TIME_T, &ttfb_us);
+    curl_easy_getinfo(t->curl, CURLINFO_TOTAL_TIME_T, &total_us);
+    ai_router_record(type, t->model, (long)(ttfb_us / 1000), (long)(total_us / 1000),
+                     response->success ? ROUTE_OK :
+                     res == CURLE_OPERATION_TIMEDOUT ? ROUTE_TIMEOUT : ROUTE_ERROR);
+    
+    /* A failing server is set aside; the backend only trips once none is left */
+    int at_fault = backend_at_fault(t->curl, res, response);
+    ai_endpoint_release(type, t->endpoint, res == CURLE_OK ? (long)(ttfb_us / 1000) : 0, at_fault);
+    t->endpoint = -1;
+    ai_breaker_record(type, at_fault && !ai_endpoint_usable(type));
+    t->trial = 0;
+    
+    long code = 0;
+    curl_easy_getinfo(t->curl, CURLINFO_RESPONSE_CODE, &code);
+    ai_ratelimit_observe(type, t->rate_key, code, &t->rate);
+    if (code == 429) response->rate_limited = 1;
+    
+    /* Setup time ends after the TLS handshake; 0 when a warm connection was reused */
+    curl_easy_getinfo(t->curl, CURLINFO_APPCONNECT_TIME_T, &connect_us);
+    if (connect_us == 0) curl_easy_getinfo(t->curl, CURLINFO_CONNECT_TIME_T, &connect_us);
+    if (res == CURLE_OK && connect_us > 0) ring_record(&backend_connect[type], (long)(connect_us / 1000));
+    
+    if (response->success) {
+        ring_record(&backend_ttfb[type], (long)(ttfb_us / 1000));
+    } else if (res == CURLE_OPERATION_TIMEDOUT && !transfer_has_first_byte(t)) {
+        /* Sent but unanswered: the first byte takes at least this long now, so the limit grows */
+        curl_off_t sent_us = 0;
+        curl_easy_getinfo(t->curl, CURLINFO_PRETRANSFER_TIME_T, &sent_us);
+        if (sent_us > 0) ring_record(&backend_ttfb[type], (long)(total_us / 1000));
+    }
+    if (!response->success && type == AI_BACKEND_OLLAMA) {
+        /* A model may have been removed or the server restarted */
+        ai_ollama_invalidate_models();
+    }
     
+    transfer_abort(t);
     return response;
 }
 
-/* Query Ollama (local) */
-static AIResponse *query_ollama(const char *prompt, const char *context) {
-    AIResponse *response = calloc(1, sizeof(AIResponse));
-    CURL *curl;
-    CURLcode res;
-    struct MemoryChunk chunk = {0};
+/* Generate in-process; recorded like a transfer so routing and breakers see it */
+static AIResponse *query_local(const char *model, const AIRequest *q) {
+    if (!ai_breaker_allow(AI_BACKEND_LOCAL)) return breaker_refused_response(AI_BACKEND_LOCAL);
+    long start = monotonic_ms();
+    long first_ms;
+    long timeout_ms = q->client.timeout_ms > 0 ? q->client.timeout_ms : REQUEST_TIMEOUT_MAX_MS;
+    AIResponse *response = ai_local_query(model, q->prompt, q->conv, q->on_text, q->userdata,
+                                          timeout_ms, &first_ms);
+    long total_ms = monotonic_ms() - start;
+    
+    ai_router_record(AI_BACKEND_LOCAL, model, first_ms >= 0 ? first_ms : total_ms, total_ms,
+                     response->success ? ROUTE_OK : ROUTE_ERROR);
+    ai_breaker_record(AI_BACKEND_LOCAL, !response->success);
+    if (response->success && first_ms >= 0) ring_record(&backend_ttfb[AI_BACKEND_LOCAL], first_ms);
+    return response;
+}
+
+/* Send one request to a backend, streaming text to on_text when given */
+static AIResponse *query_backend(AIBackendType type, const char *model, const AIRequest *q) {
+    if (type == AI_BACKEND_LOCAL) return query_local(model, q);
+    
+    BackendTransfer t;
+    AIResponse *response = NULL;
+    
+    /* A server that refuses the connection sent nothing, so another one may take the request */
+    for (int attempt = 0; !response; attempt++) {
+        response = transfer_start(&t, type, model, q);
+        if (response) return response;
+        
+        CURLcode res = curl_easy_perform(t.curl);
+        response = transfer_finish(&t, res);
+        if ((res == CURLE_COULDNT_CONNECT || res == CURLE_COULDNT_RESOLVE_HOST) &&
+            attempt + 1 < ai_endpoint_count(type) && ai_endpoint_usable(type)) {
+            ai_response_free(response);
+            response = NULL;
+        }
+    }
+    return response;
+}
+
+/* Hedging: how long the primary may stay silent before the backup is sent */
+static long hedge_delay_for(AIBackendType type) {
+    if (hedge_delay_ms > 0) return hedge_delay_ms;
+    
+    long p95 = ring_percentile(&backend_ttfb[type], 95);
+    if (p95 < 0) return HEDGE_DEFAULT_DELAY_MS;
+    if (p95 < HEDGE_MIN_DELAY_MS) return HEDGE_MIN_DELAY_MS;
+    return p95;
+}
+
+/* One side of a hedged request */
+typedef struct HedgeLeg {
+    BackendTransfer t;
+    int active;
+    struct HedgeState *hedge;
+} HedgeLeg;
+
+typedef struct HedgeState {
+    HedgeLeg legs[2];
+    HedgeLeg *leader;          /* First leg to stream text; the only one shown */
+    AIStreamCallback on_text;
+    void *userdata;
+} HedgeState;
+
+/* Forward text only from the leg that spoke first */
+static void hedge_on_text(const char *text, size_t len, void *userdata) {
+    HedgeLeg *leg = (HedgeLeg *)userdata;
+    HedgeState *h = leg->hedge;
     
-    char *host = getenv("OLLAMA_HOST");
-    if (!host) host = "http://localhost:11434";
+    if (!h->leader) h->leader = leg;
+    if (h->leader == leg && h->on_text) h->on_text(text, len, h->userdata);
+}
+
+static void hedge_cancel(CURLM *multi, HedgeLeg *leg) {
+    if (!leg->active) return;
+    curl_multi_remove_handle(multi, leg->t.curl);
+    transfer_abort(&leg->t);
+    leg->active = 0;
+}
+
+/*
+ * Send to primary; if it has not produced a byte within the hedge delay,
+ * send the same request to secondary too. The first good answer wins and
+ * the other transfer is cancelled. *secondary_used reports whether the
+ * backup was actually sent.
+ */
+static AIResponse *query_hedged(AIBackendType primary, const char *primary_model,
+                                AIBackendType secondary, const char *secondary_model,
+                                const AIRequest *q, int *secondary_used) {
+    HedgeState h;
+    AIRequest leg_q[2];
+    AIResponse *winner = NULL, *failure = NULL;
+    CURLM *multi = curl_multi_init();
+    
+    *secondary_used = 0;
+    if (!multi) return query_backend(primary, primary_model, q);
+    
+    memset(&h, 0, sizeof(h));
+    h.on_text = q->on_text;
+    h.userdata = q->userdata;
+    for (int i = 0; i < 2; i++) {
+        h.legs[i].hedge = &h;
+        leg_q[i] = *q;
+        leg_q[i].on_text = q->on_text ? hedge_on_text : NULL;
+        leg_q[i].userdata = &h.legs[i];
+    }
     
+    failure = transfer_start(&h.legs[0].t, primary, primary_model, &leg_q[0]);
+    if (failure) {
+        curl_multi_cleanup(multi);
+        return failure;
+    }
+    curl_multi_add_handle(multi, h.legs[0].t.curl);
+    h.legs[0].active = 1;
     
-    curl = curl_easy_init();
+    long delay = hedge_delay_for(primary);
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
     
-    if (curl) {
-        json_t *root = json_object();
+    while (!winner && (h.legs[0].active || h.legs[1].active)) {
+        int running = 0;
+        curl_multi_perform(multi, &running);
         
-        /* Build prompt with context */
-        size_t full_len = strlen(prompt) + (context ? strlen(context) : 0) + 100;
-        char *full_prompt = malloc(full_len);
-        if (context && strlen(context) > 0) {
-            snprintf(full_prompt, full_len, "%s\n\nUser: %s", context, prompt);
-        } else {
-            strncpy(full_prompt, prompt, full_len - 1);
+        /* Collect finished transfers */
+        CURLMsg *msg;
+        int queued;
+        while (!winner && (msg = curl_multi_info_read(multi, &queued))) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            HedgeLeg *leg = NULL;
+            for (int i = 0; i < 2; i++) {
+                if (h.legs[i].active && h.legs[i].t.curl == msg->easy_handle) leg = &h.legs[i];
+            }
+            if (!leg) continue;
+            
+            CURLcode res = msg->data.result;
+            curl_multi_remove_handle(multi, leg->t.curl);
+            AIResponse *response = transfer_finish(&leg->t, res);
+            leg->active = 0;
+            
+            if (response->success) {
+                winner = response;
+            } else {
+                ai_response_free(failure);
+                failure = response;
+            }
         }
+        if (winner) break;
         
-        json_object_set_new(root, "model", json_string(current_model));
-        json_object_set_new(root, "prompt", json_string(full_prompt));
-        json_object_set_new(root, "stream", json_false());
+        /* Once one leg is streaming to the user the other is wasted work */
+        if (h.leader) {
+            hedge_cancel(multi, h.leader == &h.legs[0] ? &h.legs[1] : &h.legs[0]);
+        }
         
-        char *payload = json_dumps(root, JSON_COMPACT);
+        /* Primary failed before the hedge fired - leave it to normal fallback */
+        if (!h.legs[0].active && !*secondary_used) break;
         
-        char url[256];
-        snprintf(url, sizeof(url), "%s/api/generate", host);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
         
-        struct curl_slist *headers = NULL;
-        headers = curl_slist_append(headers, "Content-Type: application/json");
-        headers = curl_slist_append(headers, "Connection: keep-alive");
+        if (!*secondary_used && elapsed >= delay && !transfer_has_first_byte(&h.legs[0].t)) {
+            *secondary_used = 1;
+            AIResponse *err = rate_limit_now(secondary);
+            if (!err) err = transfer_start(&h.legs[1].t, secondary, secondary_model, &leg_q[1]);
+            if (err) {
+                ai_response_free(err);
+            } else {
+                curl_multi_add_handle(multi, h.legs[1].t.curl);
+                h.legs[1].active = 1;
+            }
+        }
         
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &chunk);
-        set_curl_performance_options(curl, 120L);  /* Longer timeout for local */
+        int wait_ms = 100;
+        if (!*secondary_used && delay - elapsed < wait_ms) wait_ms = delay - elapsed > 0 ? (int)(delay - elapsed) : 1;
+        curl_multi_poll(multi, NULL, 0, wait_ms, NULL);
+    }
+    
+    /* The loser is cancelled */
+    for (int i = 0; i < 2; i++) hedge_cancel(multi, &h.legs[i]);
+    curl_multi_cleanup(multi);
+    
+    if (winner) {
+        ai_response_free(failure);
+        return winner;
+    }
+    return failure;
+}
+
+void ai_set_hedging(int enabled) {
+    pthread_mutex_lock(&client_lock);
+    default_client.hedge = enabled ? 1 : 0;
+    pthread_mutex_unlock(&client_lock);
+}
+
+int ai_get_hedging(void) {
+    pthread_mutex_lock(&client_lock);
+    int enabled = default_client.hedge;
+    pthread_mutex_unlock(&client_lock);
+    return enabled;
+}
+
+long ai_get_hedge_delay_ms(AIBackendType type) {
+    if (type < 0 || type >= AI_BACKEND_COUNT) return HEDGE_DEFAULT_DELAY_MS;
+    return hedge_delay_for(type);
+}
+
+/* One backend in a parallel fallback round */
+typedef struct {
+    BackendTransfer t;
+    int active;
+    AIResponse *response;
+} FallbackLeg;
+
+/*
+ * Send the request to every listed backend at once and return the success
+ * of the earliest-listed (highest-priority) one. Lower-priority transfers
+ * are cancelled as soon as a better one succeeds, so the whole round takes
+ * about one timeout however many backends fail. Responses are buffered;
+ * nothing is passed to on_text, the winner's text is in the response.
+ */
+static AIResponse *query_parallel(const AIBackendType *types, const char **models, int count,
+                                  const AIRequest *q) {
+    FallbackLeg legs[AI_BACKEND_COUNT];
+    AIRequest buffered = *q;
+    CURLM *multi = curl_multi_init();
+    AIResponse *result = NULL;
+    
+    if (count <= 0) return NULL;
+    memset(legs, 0, sizeof(legs));
+    buffered.on_text = NULL;
+    buffered.userdata = NULL;
+    
+    for (int i = 0; i < count; i++) {
+        /* A fallback never waits for a rate-limit slot; another backend may answer */
+        legs[i].response = rate_limit_now(types[i]);
+        if (!legs[i].response) {
+            legs[i].response = transfer_start(&legs[i].t, types[i], models[i], &buffered);
+        }
+        if (legs[i].response) continue;
+        if (!multi || curl_multi_add_handle(multi, legs[i].t.curl) != CURLM_OK) {
+            transfer_abort(&legs[i].t);
+            legs[i].response = calloc(1, sizeof(AIResponse));
+            legs[i].response->error_message = strdup("Failed to start fallback request");
+            continue;
+        }
+        legs[i].active = 1;
+    }
+    
+    while (multi) {
+        int running = 0;
+        curl_multi_perform(multi, &running);
         
-        res = curl_easy_perform(curl);
+        CURLMsg *msg;
+        int queued;
+        while ((msg = curl_multi_info_read(multi, &queued))) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            for (int i = 0; i < count; i++) {
+                if (!legs[i].active || legs[i].t.curl != msg->easy_handle) continue;
+                CURLcode res = msg->data.result;
+                curl_multi_remove_handle(multi, legs[i].t.curl);
+                legs[i].response = transfer_finish(&legs[i].t, res);
+                legs[i].active = 0;
+                break;
+            }
+        }
         
-        if (res == CURLE_OK && chunk.memory) {
-            json_error_t error;
-            json_t *resp_root = json_loads(chunk.memory, 0, &error);
-            if (resp_root) {
-                /* Check for API error response first */
-                json_t *api_error = json_object_get(resp_root, "error");
-                if (api_error && json_is_string(api_error)) {
-                    response->success = 0;
-                    response->error_message = strdup(json_string_value(api_error));
-                } else {
-                    json_t *resp_text = json_object_get(resp_root, "response");
-                    if (resp_text && json_is_string(resp_text)) {
-                        response->content = strdup(json_string_value(resp_text));
-                        response->success = 1;
-                    } else {
-                        response->success = 0;
-                        response->error_message = strdup("No response from Ollama");
-                    }
-                }
-                json_decref(resp_root);
-            } else {
-                response->success = 0;
-                response->error_message = strdup("Failed to parse Ollama response");
+        /* Done once every leg ahead of the best success has finished */
+        int best = -1, waiting = 0;
+        for (int i = 0; i < count; i++) {
+            if (legs[i].active) {
+                waiting = 1;
+                continue;
+            }
+            if (legs[i].response && legs[i].response->success) {
+                best = i;
+                break;
             }
-        } else {
-            response->success = 0;
-            response->error_message = strdup(curl_easy_strerror(res));
         }
+        if (best >= 0) {
+            for (int i = best + 1; i < count; i++) {
+                if (!legs[i].active) continue;
+                curl_multi_remove_handle(multi, legs[i].t.curl);
+                transfer_abort(&legs[i].t);
+                legs[i].active = 0;
+            }
+            if (!waiting) break;
+        }
+        if (!running && !waiting) break;
         
-        curl_easy_cleanup(curl);
-        curl_slist_free_all(headers);
-        free(payload);
-        free(chunk.memory);
-        json_decref(root);
-        free(full_prompt);
+        curl_multi_poll(multi, NULL, 0, 100, NULL);
     }
     
-    
-    return response;
+    /* Pick the winner, or the highest-priority failure */
+    for (int i = 0; i < count; i++) {
+        if (legs[i].active) {
+            curl_multi_remove_handle(multi, legs[i].t.curl);
+            transfer_abort(&legs[i].t);
+            legs[i].active = 0;
+        }
+        if (!result && legs[i].response && legs[i].response->success) {
+            result = legs[i].response;
+            legs[i].response = NULL;
+        }
+    }
+    for (int i = 0; i < count && !result; i++) {
+        if (legs[i].response) {
+            result = legs[i].response;
+            legs[i].response = NULL;
+        }
+    }
+    for (int i = 0; i < count; i++) ai_response_free(legs[i].response);
+    if (multi) curl_multi_cleanup(multi);
+    return result;
+}
+
+static void sleep_ms(long ms) {
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
 }
 
-/* Internal query function with fallback tracking */
-static AIResponse *ai_query_internal(const char *prompt, const char *context, 
-                                      int tried_backends[], int *retry_count) {
+/*
+ * Send to the primary (hedged when a backup is given) within its rate
+ * limit: wait for a free slot, and after a 429 wait out Retry-After or the
+ * shared backoff and try again, while the total wait fits the deadline.
+ * Waits get random jitter so processes released together do not all send
+ * at the same instant.
+ */
+static AIResponse *query_paced(AIBackendType primary, const char *model, AIBackendType backup,
+                               AIRequest *q, int *backup_used) {
+    long deadline = monotonic_ms() + ratelimit_wait_ms;
+    unsigned long long key = rate_key_for(primary);
     AIResponse *response = NULL;
     
-    /* Mark current backend as tried */
-    tried_backends[active_backend] = 1;
-    
-    switch (active_backend) {
-        case AI_BACKEND_GEMINI:
-            response = query_gemini(prompt, context);
-            break;
-        case AI_BACKEND_OPENAI:
-            response = query_openai(prompt, context);
-            break;
-        case AI_BACKEND_CLAUDE:
-            response = query_claude(prompt, context);
-            break;
-        case AI_BACKEND_DEEPSEEK:
-            response = query_deepseek(prompt, context);
-            break;
-        case AI_BACKEND_OLLAMA:
-            response = query_ollama(prompt, context);
+    for (int attempt = 0; attempt <= RATELIMIT_RETRIES; attempt++) {
+        long wait_ms;
+        if (!ai_ratelimit_acquire(key, deadline - monotonic_ms(), &wait_ms)) {
+            ai_response_free(response);
+            response = rate_limited_response(primary, wait_ms);
             break;
-        default:
-            response = calloc(1, sizeof(AIResponse));
-            response->success = 0;
-            response->error_message = strdup("Unknown backend");
+        }
+        if (wait_ms > 0) {
+            wait_ms += rand_r(&q->seed) % (wait_ms / 4 + 100);
+            if (wait_ms >= RATELIMIT_NOTICE_MS && !q->client.quiet) {
+                char msg[128];
+                snprintf(msg, sizeof(msg), COLOR_YELLOW "Waiting %ld s for the %s rate limit...\n" COLOR_RESET,
+                         (wait_ms + 999) / 1000, backend_labels[primary]);
+                _puts(msg);
+            }
+            sleep_ms(wait_ms);
+        }
+        
+        ai_response_free(response);
+        if (backup < AI_BACKEND_COUNT) {
+            int used = 0;
+            response = query_hedged(primary, model, backup, backends[backup].default_model, q, &used);
+            if (used) *backup_used = 1;
+        } else {
+            response = query_backend(primary, model, q);
+        }
+        if (!response->rate_limited) break;
     }
-    
-    /* Try fallback if failed - but only once per backend */
-    if (!response->success && *retry_count < AI_BACKEND_COUNT) {
-        /* Find next untried backend */
-        AIBackendType fallback = AI_BACKEND_COUNT;
-        for (int i = 0; i < AI_BACKEND_COUNT; i++) {
-            if (backends[i].enabled && !tried_backends[i]) {
-                fallback = (AIBackendType)i;
+    return response;
+}
+
+/* Query the client's backend, then fan out to the others if it fails */
+static AIResponse *ai_query_internal(AIRequest *q) {
+    AIResponse *response = NULL;
+    int tried_backends[AI_BACKEND_COUNT] = {0};
+    AIBackendType primary = q->client.backend;
+    const char *model = q->client.model;
+    
+    tried_backends[primary] = 1;
+    
+    /*
+     * With hedging, the next enabled backend backs up a slow primary. The
+     * local model is neither hedged nor a backup: it is not an HTTP
+     * transfer, and it is slow only while it has every core busy.
+     */
+    AIBackendType backup = AI_BACKEND_COUNT;
+    if (q->client.hedge && primary != AI_BACKEND_LOCAL) {
+        for (int i = 0; i < AI_BACKEND_LOCAL; i++) {
+            if (backends[i].enabled && !tried_backends[i] && ai_breaker_available((AIBackendType)i)) {
+                backup = (AIBackendType)i;
                 break;
             }
         }
+    }
+    
+    if (!ai_breaker_available(primary)) {
+        /* Known to be failing: no request, straight to the fallbacks */
+        response = breaker_refused_response(primary);
+    } else {
+        int backup_used = 0;
+        response = query_paced(primary, model, backup, q, &backup_used);
+        if (backup_used) tried_backends[backup] = 1;
+    }
+    
+    if (response->success) return response;
+    
+    /* Fall back to every remaining enabled server in parallel */
+    AIBackendType rest[AI_BACKEND_COUNT];
+    const char *rest_models[AI_BACKEND_COUNT];
+    int rest_count = 0;
+    for (int i = 0; i < AI_BACKEND_LOCAL; i++) {
+        if (backends[i].enabled && !tried_backends[i] && ai_breaker_available((AIBackendType)i)) {
+            rest[rest_count] = (AIBackendType)i;
+            rest_models[rest_count] = backends[i].default_model;
+            rest_count++;
+        }
+    }
+    
+    /* Whatever the failed attempt streamed is void before a fallback answers */
+    if (q->on_text && (rest_count > 0 ||
+                       (backends[AI_BACKEND_LOCAL].enabled && !tried_backends[AI_BACKEND_LOCAL]))) {
+        q->on_text(NULL, 0, q->userdata);
+    }
+    
+    AIResponse *fallback = query_parallel(rest, rest_models, rest_count, q);
+    
+    /* Then the local model, which needs no network at all */
+    if ((!fallback || !fallback->success) && backends[AI_BACKEND_LOCAL].enabled &&
+        !tried_backends[AI_BACKEND_LOCAL] && ai_breaker_available(AI_BACKEND_LOCAL)) {
+        ai_response_free(fallback);
+        fallback = query_local(backends[AI_BACKEND_LOCAL].default_model, q);
+    }
+    if (fallback && fallback->success) {
+        ai_response_free(response);
+        return fallback;
+    }
+    ai_response_free(fallback);
+    return response;
+}
+
+unsigned long long ai_conversation_hash(const AIConversation *conv) {
+    unsigned long long hash = 1469598103934665603ULL;
+    if (!conv) return hash;
+    
+    hash = fnv_string(hash, conv->system);
+    for (int i = 0; i < conv->turn_count; i++) {
+        hash = fnv_string(hash, conv->turns[i].user);
+        hash = fnv_field(hash, conv->turns[i].assistant, conv->turns[i].assistant_len);
+    }
+    return hash;
+}
+
+static unsigned long long flight_key(AIBackendType type, const char *model,
+                                     const char *prompt, const AIConversation *conv) {
+    unsigned long long hash = ai_conversation_hash(conv);
+    
+    hash ^= (unsigned long long)type;
+    hash *= 1099511628211ULL;
+    hash = fnv_string(hash, model);
+    return fnv_string(hash, prompt);
+}
+
+static void flight_slot_clear(FlightSlot *slot) {
+    free(slot->content);
+    free(slot->error_message);
+    memset(slot, 0, sizeof(*slot));
+}
+
+/* Find the slot for key, or claim one for a new flight (lock held) */
+static FlightSlot *flight_find(unsigned long long key, long now, int *created) {
+    FlightSlot *free_slot = NULL;
+    
+    *created = 0;
+    for (int i = 0; i < FLIGHT_SLOTS; i++) {
+        FlightSlot *slot = &flights[i];
         
-        if (fallback < AI_BACKEND_COUNT) {
-            ai_response_free(response);
-            AIBackendType old_backend = active_backend;
-            char old_model[256];
-            strncpy(old_model, current_model, sizeof(old_model) - 1);
-            old_model[sizeof(old_model) - 1] = '\0';
-            
-            active_backend = fallback;
-            strncpy(current_model, backends[fallback].default_model, sizeof(current_model) - 1);
-            current_model[sizeof(current_model) - 1] = '\0';
-            (*retry_count)++;
-            response = ai_query_internal(prompt, context, tried_backends, retry_count);
-            
-            active_backend = old_backend;
-            strncpy(current_model, old_model, sizeof(current_model) - 1);
-            current_model[sizeof(current_model) - 1] = '\0';
+        /* Results past the window are only kept for callers still waiting */
+        if (slot->state == FLIGHT_DONE && slot->waiters == 0 &&
+            (!slot->success || now - slot->done_ms > flight_window_ms)) {
+            flight_slot_clear(slot);
         }
+        if (slot->state != FLIGHT_EMPTY && slot->key == key) return slot;
+        if (slot->state == FLIGHT_EMPTY && !free_slot) free_slot = slot;
     }
     
+    /* Full of fresh results: reuse the oldest one nobody is waiting on */
+    if (!free_slot) {
+        for (int i = 0; i < FLIGHT_SLOTS; i++) {
+            FlightSlot *slot = &flights[i];
+            if (slot->state == FLIGHT_DONE && slot->waiters == 0 &&
+                (!free_slot || slot->done_ms < free_slot->done_ms)) {
+                free_slot = slot;
+            }
+        }
+        if (free_slot) flight_slot_clear(free_slot);
+    }
+    
+    if (free_slot) {
+        free_slot->key = key;
+        free_slot->state = FLIGHT_RUNNING;
+        *created = 1;
+    }
+    return free_slot;
+}
+
+/* Copy a finished flight into a new response (lock held) */
+static AIResponse *flight_copy(const FlightSlot *slot) {
+    AIResponse *response = calloc(1, sizeof(AIResponse));
+    if (!response) return NULL;
+    response->success = slot->success;
+    if (slot->content) response->content = strdup(slot->content);
+    if (slot->error_message) response->error_message = strdup(slot->error_message);
     return response;
 }
 
 /* Main query function */
 AIResponse *ai_query(const char *prompt, const char *context) {
-    int tried_backends[AI_BACKEND_COUNT] = {0};
-    int retry_count = 0;
-    return ai_query_internal(prompt, context, tried_backends, &retry_count);
+    return ai_query_stream(prompt, context, NULL, NULL);
+}
+
+/* Query with incremental delivery of the response text */
+AIResponse *ai_query_stream(const char *prompt, const char *context,
+                            AIStreamCallback on_text, void *userdata) {
+    AIConversation conv = {context, NULL, 0};
+    return ai_query_chat(prompt, &conv, on_text, userdata);
+}
+
+/* Query with a system prompt and earlier turns sent as separate messages */
+AIResponse *ai_query_chat(const char *prompt, const AIConversation *conv,
+                          AIStreamCallback on_text, void *userdata) {
+    AIClient client;
+    ai_client_init(&client);
+    return ai_client_query(&client, prompt, conv, on_text, userdata);
+}
+
+void ai_client_init(AIClient *client) {
+    backend_probe_wait();
+    pthread_mutex_lock(&client_lock);
+    *client = default_client;
+    pthread_mutex_unlock(&client_lock);
+}
+
+AIResponse *ai_client_query(const AIClient *client, const char *prompt, const AIConversation *conv,
+                            AIStreamCallback on_text, void *userdata) {
+    AIRequest q = {*client, prompt, conv, on_text, userdata, 0};
+    
+    backend_probe_wait();
+    q.seed = (unsigned int)getpid() * 2654435761u ^ (unsigned int)monotonic_ms() ^ (unsigned int)(size_t)&q;
+    
+    unsigned long long key = flight_key(client->backend, client->model, prompt, conv);
+    int created;
+    
+    pthread_mutex_lock(&flight_lock);
+    flight_stats.queries++;
+    FlightSlot *slot = flight_find(key, monotonic_ms(), &created);
+    
+    if (slot && !created) {
+        /* Follow the leader: wait for it, then take a copy */
+        slot->waiters++;
+        while (slot->state == FLIGHT_RUNNING) {
+            pthread_cond_wait(&flight_cond, &flight_lock);
+        }
+        slot->waiters--;
+        AIResponse *shared = flight_copy(slot);
+        flight_stats.shared++;
+        pthread_mutex_unlock(&flight_lock);
+        
+        if (shared && shared->success && shared->content && on_text) {
+            on_text(shared->content, strlen(shared->content), userdata);
+        }
+        return shared;
+    }
+    pthread_mutex_unlock(&flight_lock);
+    
+    AIResponse *response = ai_query_internal(&q);
+    
+    /* No slot free (all in flight): the query simply ran uncoalesced */
+    if (!slot) return response;
+    
+    pthread_mutex_lock(&flight_lock);
+    slot->success = response && response->success;
+    if (response && response->content) slot->content = strdup(response->content);
+    if (response && response->error_message) {
+        slot->error_message = strdup(response->error_message);
+    }
+    slot->done_ms = monotonic_ms();
+    slot->state = FLIGHT_DONE;
+    pthread_cond_broadcast(&flight_cond);
+    pthread_mutex_unlock(&flight_lock);
+    
+    return response;
+}
+
+/* Forget finished results so the next identical query goes out again */
+void ai_flight_reset(void) {
+    pthread_mutex_lock(&flight_lock);
+    for (int i = 0; i < FLIGHT_SLOTS; i++) {
+        if (flights[i].state == FLIGHT_DONE && flights[i].waiters == 0) {
+            flight_slot_clear(&flights[i]);
+        }
+    }
+    pthread_mutex_unlock(&flight_lock);
+}
+
+void ai_get_flight_stats(AIFlightStats *stats) {
+    pthread_mutex_lock(&flight_lock);
+    *stats = flight_stats;
+    pthread_mutex_unlock(&flight_lock);
+}
+
+void ai_set_streaming(int enabled) {
+    pthread_mutex_lock(&client_lock);
+    default_client.stream = enabled ? 1 : 0;
+    pthread_mutex_unlock(&client_lock);
+}
+
+int ai_get_streaming(void) {
+    pthread_mutex_lock(&client_lock);
+    int enabled = default_client.stream;
+    pthread_mutex_unlock(&client_lock);
+    return enabled;
 }
 
 void ai_response_free(AIResponse *response) {
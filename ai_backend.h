@@ -10,6 +10,7 @@ typedef enum {
     AI_BACKEND_CLAUDE,
     AI_BACKEND_DEEPSEEK,
     AI_BACKEND_OLLAMA,
+    AI_BACKEND_LOCAL,        /* GGUF model run in-process (make LLAMA=1) */
     AI_BACKEND_COUNT
 } AIBackendType;
 
@@ -55,30 +56,136 @@ typedef struct {
     int count;
 } OllamaModelList;
 
+/* Ollama model list cache counters */
+typedef struct {
+    long hits;           /* Lookups answered without a request */
+    long fetches;        /* /api/tags requests made */
+    long not_modified;   /* Fetches that found the list unchanged */
+} AIModelCacheStats;
+
 /* AI Response */
 typedef struct {
     char *content;
     int success;
     char *error_message;
+    int rate_limited;    /* Refused by the provider's rate limit (429) */
 } AIResponse;
 
+/* Connection pool counters (per backend) */
+typedef struct {
+    long handle_hits;     /* Easy handle taken from the idle pool */
+    long handle_misses;   /* Easy handle had to be created */
+    long conn_reused;     /* Transfers that reused a warm connection */
+    long conn_new;        /* New connections opened (DNS + TCP + TLS) */
+} AIPoolStats;
+
+/* Query coalescing counters */
+typedef struct {
+    long queries;        /* Calls to ai_query / ai_query_stream */
+    long shared;         /* Answered from an identical in-flight or recent query */
+} AIFlightStats;
+
 /* Backend Functions */
 void ai_backend_init(void);
 void ai_backend_cleanup(void);
 
 AIBackendType ai_get_active_backend(void);
 int ai_set_backend(AIBackendType type);
-int ai_set_backend_by_name(const char *name);
+int ai_set_backend_by_name(const char *name);    /* "auto" turns on auto routing */
 const char *ai_get_backend_name(AIBackendType type);
 
 /* Check if backend is available (API key set) */
 int ai_backend_available(AIBackendType type);
 AIBackendType ai_get_fallback_backend(void);
 
+/*
+ * Receives each piece of response text as it streams in. A call with
+ * text NULL withdraws everything passed so far: that attempt failed and
+ * a fallback is about to be asked. Its answer may stream in afterwards,
+ * or arrive whole in the response only.
+ */
+typedef void (*AIStreamCallback)(const char *text, size_t len, void *userdata);
+
+/* One earlier exchange of the session */
+typedef struct {
+    const char *user;
+    const char *assistant;
+    size_t assistant_len;   /* May stop short of the stored response */
+} AITurn;
+
+/*
+ * System prompt plus earlier turns, oldest first. Sent as the provider's
+ * message array; the system text should stay byte-identical between calls
+ * so provider-side prompt caches can reuse it.
+ */
+typedef struct {
+    const char *system;
+    const AITurn *turns;
+    int turn_count;
+} AIConversation;
+
+/*
+ * Query settings: which backend and model to ask, and how. The functions
+ * below that take no client (ai_query_chat, ai_set_model, ...) act on the
+ * shell's default client. A caller running queries of its own - on
+ * another thread, or with a different model - takes a copy with
+ * ai_client_init and changes that; queries on separate clients may run
+ * at the same time.
+ */
+typedef struct {
+    AIBackendType backend;
+    char model[256];
+    int stream;             /* Stream text to on_text as it arrives */
+    int hedge;              /* Race a backup backend when this one is slow */
+    int auto_route;         /* ai_client_select_model picks the backend too */
+    long timeout_ms;        /* Total per request, 0 = the 10 min backstop */
+    int quiet;              /* No progress notes on the terminal (background jobs) */
+} AIClient;
+
+/* Copy of the default client's current settings */
+void ai_client_init(AIClient *client);
+
+/* Best backend (with auto routing) and model of the client for a task */
+void ai_client_select_model(AIClient *client, TaskType task);
+
+AIResponse *ai_client_query(const AIClient *client, const char *prompt, const AIConversation *conv,
+                            AIStreamCallback on_text, void *userdata);
+
 /* Main AI query function */
 AIResponse *ai_query(const char *prompt, const char *context);
+AIResponse *ai_query_stream(const char *prompt, const char *context,
+                            AIStreamCallback on_text, void *userdata);
+AIResponse *ai_query_chat(const char *prompt, const AIConversation *conv,
+                          AIStreamCallback on_text, void *userdata);
+
+/* Stable hash of a conversation (for cache keys) */
+unsigned long long ai_conversation_hash(const AIConversation *conv);
 void ai_response_free(AIResponse *response);
 
+/* Token streaming (SSE / NDJSON) */
+void ai_set_streaming(int enabled);
+int ai_get_streaming(void);
+
+/* Hedged requests: back up a slow primary with the next enabled backend */
+void ai_set_hedging(int enabled);
+int ai_get_hedging(void);
+long ai_get_hedge_delay_ms(AIBackendType type);
+
+/*
+ * Timeouts a request would get now, from observed latency: connection
+ * setup, and the longest the server may send nothing (non-streamed and
+ * streamed requests)
+ */
+void ai_get_timeouts(AIBackendType type, const char *model, long *connect_ms,
+                     long *stall_ms, long *stream_stall_ms);
+
+/* Identical queries share one request (CORTEX_COALESCE_MS reuse window) */
+void ai_flight_reset(void);
+void ai_get_flight_stats(AIFlightStats *stats);
+
+/* Connection reuse statistics */
+void ai_get_pool_stats(AIBackendType type, AIPoolStats *stats);
+
 /* List available backends */
 void ai_list_backends(void);
 
@@ -96,12 +203,30 @@ void ai_ollama_model_list_free(OllamaModelList *list);
 const char *ai_ollama_select_best_model(TaskType task);
 int ai_ollama_check_available(void);
 void ai_list_ollama_models(void);
+void ai_ollama_invalidate_models(void);
+void ai_ollama_get_cache_stats(AIModelCacheStats *stats);
+
+/* Embedding of text from an Ollama embedding model (caller frees), NULL on failure */
+float *ai_ollama_embed(const char *model, const char *text, int *dim);
 
 /* Intelligent model selection */
 void ai_auto_select_model(TaskType task);
+
+/* Auto routing: each query goes to the fastest backend able to handle its task */
+void ai_set_auto_routing(int enabled);
+int ai_get_auto_routing(void);
 const char *ai_get_recommended_model(AIBackendType backend, TaskType task);
 
+/* Cascade: simple queries go to a fast model first, escalating only if its answer is rejected */
+void ai_set_cascade(int enabled);
+int ai_get_cascade(void);
+const char *ai_get_fast_model(AIBackendType backend, TaskType task);
+
 /* Get model-specific system prompt */
 const char *ai_get_optimized_prompt(TaskType task);
 
+/* Context sizing: token estimate for text, and the budget for one prompt */
+int ai_estimate_tokens(AIBackendType type, const char *text, size_t len);
+int ai_get_context_budget(AIBackendType type, const char *model);
+
 #endif /* AI_BACKEND_H */
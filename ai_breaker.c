@@ -0,0 +1,169 @@
+#include "ai_breaker.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BREAKER_FAILURES 3              /* Consecutive failures that open it */
+#define BREAKER_WINDOW 20               /* Outcomes behind the error rate */
+#define BREAKER_WINDOW_MIN 10           /* Rate is judged only past this many */
+#define BREAKER_ERROR_RATE 50           /* Percent of the window that opens it */
+#define BREAKER_COOLDOWN_MS 30000L
+#define BREAKER_COOLDOWN_MAX_MS 300000L /* Failed trials double it up to this */
+
+typedef struct {
+    AIBreakerState state;
+    int consecutive;
+    unsigned char window[BREAKER_WINDOW];
+    int window_count;
+    int window_next;
+    long opened_ms;
+    long cooldown_ms;
+    long trips;
+    int trial;                  /* Half-open, with its trial request in flight */
+} Breaker;
+
+static Breaker breakers[AI_BACKEND_COUNT];
+static int failure_threshold = BREAKER_FAILURES;   /* 0 = breaker off */
+static long base_cooldown_ms = BREAKER_COOLDOWN_MS;
+static pthread_mutex_t breaker_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static int window_failures(const Breaker *b) {
+    int failures = 0;
+    for (int i = 0; i < b->window_count; i++) failures += b->window[i];
+    return failures;
+}
+
+static void breaker_open(Breaker *b, long cooldown_ms) {
+    b->state = BREAKER_OPEN;
+    b->trial = 0;
+    b->opened_ms = now_ms();
+    b->cooldown_ms = cooldown_ms > BREAKER_COOLDOWN_MAX_MS ? BREAKER_COOLDOWN_MAX_MS : cooldown_ms;
+    b->trips++;
+}
+
+static void breaker_close(Breaker *b) {
+    long trips = b->trips;
+    memset(b, 0, sizeof(*b));
+    b->trips = trips;
+}
+
+void ai_breaker_init(void) {
+    memset(breakers, 0, sizeof(breakers));
+
+    char *failures = getenv("CORTEX_BREAKER_FAILURES");
+    if (failures && atoi(failures) >= 0) {
+        failure_threshold = atoi(failures);
+    }
+    char *cooldown = getenv("CORTEX_BREAKER_COOLDOWN");
+    if (cooldown && atol(cooldown) > 0) {
+        base_cooldown_ms = atol(cooldown) * 1000L;
+    }
+}
+
+/* Caller holds the lock */
+static int breaker_admits(const Breaker *b) {
+    switch (b->state) {
+        case BREAKER_CLOSED: return 1;
+        case BREAKER_OPEN: return now_ms() - b->opened_ms >= b->cooldown_ms;
+        default: return !b->trial;
+    }
+}
+
+int ai_breaker_available(AIBackendType backend) {
+    if (backend < 0 || backend >= AI_BACKEND_COUNT) return 0;
+
+    pthread_mutex_lock(&breaker_lock);
+    int available = breaker_admits(&breakers[backend]);
+    pthread_mutex_unlock(&breaker_lock);
+    return available;
+}
+
+int ai_breaker_allow(AIBackendType backend) {
+    if (backend < 0 || backend >= AI_BACKEND_COUNT) return 0;
+    Breaker *b = &breakers[backend];
+    int allow = 0;
+
+    pthread_mutex_lock(&breaker_lock);
+    if (breaker_admits(b)) {
+        allow = 1;
+        if (b->state != BREAKER_CLOSED) {
+            b->state = BREAKER_HALF_OPEN;
+            b->trial = 1;
+            allow = AI_BREAKER_TRIAL;
+        }
+    }
+    pthread_mutex_unlock(&breaker_lock);
+    return allow;
+}
+
+void ai_breaker_release(AIBackendType backend) {
+    if (backend < 0 || backend >= AI_BACKEND_COUNT) return;
+
+    pthread_mutex_lock(&breaker_lock);
+    if (breakers[backend].state == BREAKER_HALF_OPEN) breakers[backend].trial = 0;
+    pthread_mutex_unlock(&breaker_lock);
+}
+
+void ai_breaker_record(AIBackendType backend, int failed) {
+    if (backend < 0 || backend >= AI_BACKEND_COUNT || failure_threshold == 0) return;
+    Breaker *b = &breakers[backend];
+
+    pthread_mutex_lock(&breaker_lock);
+    if (b->state == BREAKER_HALF_OPEN) {
+        if (failed) breaker_open(b, b->cooldown_ms * 2);
+        else breaker_close(b);
+        pthread_mutex_unlock(&breaker_lock);
+        return;
+    }
+    /* A request sent before the breaker opened may still be finishing */
+    if (b->state == BREAKER_OPEN) {
+        pthread_mutex_unlock(&breaker_lock);
+        return;
+    }
+
+    b->window[b->window_next] = failed ? 1 : 0;
+    b->window_next = (b->window_next + 1) % BREAKER_WINDOW;
+    if (b->window_count < BREAKER_WINDOW) b->window_count++;
+    b->consecutive = failed ? b->consecutive + 1 : 0;
+
+    /* A dead backend trips the first test, a flaky one the second */
+    if (b->consecutive >= failure_threshold ||
+        (b->window_count >= BREAKER_WINDOW_MIN &&
+         window_failures(b) * 100 >= b->window_count * BREAKER_ERROR_RATE)) {
+        breaker_open(b, base_cooldown_ms);
+    }
+    pthread_mutex_unlock(&breaker_lock);
+}
+
+void ai_breaker_get_stats(AIBackendType backend, AIBreakerStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (backend < 0 || backend >= AI_BACKEND_COUNT) return;
+    Breaker *b = &breakers[backend];
+
+    pthread_mutex_lock(&breaker_lock);
+    stats->state = b->state;
+    stats->consecutive_failures = b->consecutive;
+    stats->window_requests = b->window_count;
+    stats->window_failures = window_failures(b);
+    stats->trips = b->trips;
+    if (b->state == BREAKER_OPEN) {
+        long left = b->cooldown_ms - (now_ms() - b->opened_ms);
+        stats->retry_in_ms = left > 0 ? left : 0;
+    }
+    pthread_mutex_unlock(&breaker_lock);
+}
+
+const char *ai_breaker_state_name(AIBreakerState state) {
+    switch (state) {
+        case BREAKER_OPEN: return "open";
+        case BREAKER_HALF_OPEN: return "half-open";
+        default: return "closed";
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef AI_BREAKER_H
+#define AI_BREAKER_H
+
+#include "ai_backend.h"
+
+/*
+ * Per-backend circuit breaker. Closed: requests flow. Open: the backend
+ * failed repeatedly and is skipped without a request until its cooldown
+ * ends. Half-open: the cooldown ended; exactly one request is let through
+ * as a trial, and the rest are refused until it closes the breaker on
+ * success or reopens it, with a longer cooldown, on failure.
+ */
+typedef enum {
+    BREAKER_CLOSED = 0,
+    BREAKER_OPEN,
+    BREAKER_HALF_OPEN
+} AIBreakerState;
+
+typedef struct {
+    AIBreakerState state;
+    int consecutive_failures;
+    int window_requests;        /* Recent outcomes behind the error rate */
+    int window_failures;
+    long retry_in_ms;           /* Open: time left before the trial request */
+    long trips;                 /* Times the breaker has opened */
+} AIBreakerStats;
+
+/* Thresholds from CORTEX_BREAKER_FAILURES and CORTEX_BREAKER_COOLDOWN */
+void ai_breaker_init(void);
+
+#define AI_BREAKER_TRIAL 2
+
+/* Would a request be let through now? No state changes: for choosing among backends */
+int ai_breaker_available(AIBackendType backend);
+
+/*
+ * Admit a request about to be sent: 0 = refused, 1 = admitted, or
+ * AI_BREAKER_TRIAL when it is the one trial of a half-open breaker. A
+ * trial must end in ai_breaker_record or, if abandoned, ai_breaker_release.
+ */
+int ai_breaker_allow(AIBackendType backend);
+
+/* Outcome of a request that was sent; failed = the backend, not the request, was at fault */
+void ai_breaker_record(AIBackendType backend, int failed);
+
+/* A trial dropped before its outcome was known; the next request may try instead */
+void ai_breaker_release(AIBackendType backend);
+
+void ai_breaker_get_stats(AIBackendType backend, AIBreakerStats *stats);
+const char *ai_breaker_state_name(AIBreakerState state);
+
+#endif /* AI_BREAKER_H */
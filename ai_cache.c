@@ -0,0 +1,428 @@
+#include "ai_cache.h"
+#include "shell.h"
+#include <stdint.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#define CACHE_MAGIC 0x31435843u        /* "CXC1" */
+#define CACHE_SLOTS 1024
+#define CACHE_DEFAULT_TTL (24 * 60 * 60)
+#define CACHE_DEFAULT_MAX_BYTES (16ULL * 1024 * 1024)
+
+/* One index slot - the value lives in its own file named after the key */
+typedef struct {
+    uint64_t key;
+    uint64_t check;        /* Second hash to rule out key collisions */
+    int64_t created;
+    int64_t last_used;
+    uint32_t size;
+    uint32_t used;         /* 0 with key != 0 marks a deleted slot */
+} CacheSlot;
+
+/* Memory-mapped index file */
+typedef struct {
+    uint32_t magic;
+    uint32_t slot_count;
+    uint64_t total_bytes;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stores;
+    uint64_t evictions;
+    CacheSlot slots[CACHE_SLOTS];
+} CacheIndex;
+
+static int cache_enabled = 1;
+static char cache_dir[512] = {0};
+static int index_fd = -1;
+static CacheIndex *cache_index = NULL;
+static long cache_ttl = CACHE_DEFAULT_TTL;
+static unsigned long long cache_max_bytes = CACHE_DEFAULT_MAX_BYTES;
+
+/* Create each missing directory along path */
+static int make_dirs(const char *path) {
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    for (char *p = tmp + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            if (mkdir(tmp, 0700) != 0 && errno != EEXIST) return -1;
+            *p = '/';
+        }
+    }
+    if (mkdir(tmp, 0700) != 0 && errno != EEXIST) return -1;
+    return 0;
+}
+
+void ai_cache_init(void) {
+    char *disabled = getenv("CORTEX_CACHE");
+    if (disabled && strcmp(disabled, "0") == 0) {
+        cache_enabled = 0;
+    }
+
+    char *ttl = getenv("CORTEX_CACHE_TTL");
+    if (ttl && atol(ttl) > 0) {
+        cache_ttl = atol(ttl);
+    }
+
+    char *max_mb = getenv("CORTEX_CACHE_MAX_MB");
+    if (max_mb && atol(max_mb) > 0) {
+        cache_max_bytes = (unsigned long long)atol(max_mb) * 1024 * 1024;
+    }
+
+    /* Follow XDG, defaulting to ~/.cache */
+    char *xdg = getenv("XDG_CACHE_HOME");
+    char *home = getenv("HOME");
+    if (xdg && *xdg) {
+        snprintf(cache_dir, sizeof(cache_dir), "%s/cortexcli", xdg);
+    } else if (home) {
+        snprintf(cache_dir, sizeof(cache_dir), "%s/.cache/cortexcli", home);
+    } else {
+        snprintf(cache_dir, sizeof(cache_dir), "/tmp/cortexcli-cache-%d", (int)getuid());
+    }
+
+    if (make_dirs(cache_dir) != 0) return;
+
+    char index_path[600];
+    snprintf(index_path, sizeof(index_path), "%s/index", cache_dir);
+    index_fd = open(index_path, O_RDWR | O_CREAT, 0600);
+    if (index_fd < 0) return;
+
+    flock(index_fd, LOCK_EX);
+    struct stat st;
+    int fresh = fstat(index_fd, &st) == 0 && st.st_size != (off_t)sizeof(CacheIndex);
+    if (fresh && ftruncate(index_fd, sizeof(CacheIndex)) != 0) {
+        flock(index_fd, LOCK_UN);
+        close(index_fd);
+        index_fd = -1;
+        return;
+    }
+
+    void *map = mmap(NULL, sizeof(CacheIndex), PROT_READ | PROT_WRITE, MAP_SHARED, index_fd, 0);
+    if (map == MAP_FAILED) {
+        flock(index_fd, LOCK_UN);
+        close(index_fd);
+        index_fd = -1;
+        return;
+    }
+    cache_index = (CacheIndex *)map;
+
+    /* New or incompatible index - start empty */
+    if (fresh || cache_index->magic != CACHE_MAGIC || cache_index->slot_count != CACHE_SLOTS) {
+        memset(cache_index, 0, sizeof(CacheIndex));
+        cache_index->magic = CACHE_MAGIC;
+        cache_index->slot_count = CACHE_SLOTS;
+    }
+    flock(index_fd, LOCK_UN);
+}
+
+void ai_cache_cleanup(void) {
+    if (cache_index) {
+        munmap(cache_index, sizeof(CacheIndex));
+        cache_index = NULL;
+    }
+    if (index_fd >= 0) {
+        close(index_fd);
+        index_fd = -1;
+    }
+}
+
+/* FNV-1a over a field, with a separator so fields cannot run together */
+static uint64_t hash_field(uint64_t h, const char *s) {
+    for (; s && *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 0x100000001b3ULL;
+    }
+    h ^= 0xff;
+    h *= 0x100000001b3ULL;
+    return h;
+}
+
+/* Lowercase and collapse whitespace so trivial variations share an entry */
+char *ai_cache_normalize(const char *prompt) {
+    char *out = malloc(strlen(prompt) + 1);
+    if (!out) return NULL;
+
+    size_t n = 0;
+    int space = 0;
+    for (const char *p = prompt; *p; p++) {
+        if (isspace((unsigned char)*p)) {
+            space = n > 0;
+            continue;
+        }
+        if (space) out[n++] = ' ';
+        out[n++] = (char)tolower((unsigned char)*p);
+        space = 0;
+    }
+    out[n] = '\0';
+    return out;
+}
+
+static void cache_key(AIBackendType backend, const char *model, TaskType task,
+                      const char *prompt, const char *context,
+                      uint64_t *key, uint64_t *check) {
+    char task_str[16];
+    snprintf(task_str, sizeof(task_str), "%d", (int)task);
+
+    char *norm = ai_cache_normalize(prompt);
+    uint64_t seeds[2] = {0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL};
+    uint64_t out[2];
+
+    for (int i = 0; i < 2; i++) {
+        uint64_t h = seeds[i];
+        h = hash_field(h, ai_get_backend_name(backend));
+        h = hash_field(h, model);
+        h = hash_field(h, task_str);
+        h = hash_field(h, norm ? norm : prompt);
+        h = hash_field(h, context);
+        out[i] = h ? h : 1;
+    }
+    free(norm);
+
+    *key = out[0];
+    *check = out[1];
+}
+
+static void value_path(uint64_t key, char *path, size_t size) {
+    snprintf(path, size, "%s/%016llx", cache_dir, (unsigned long long)key);
+}
+
+/* Find the slot holding key, or -1 */
+static int find_slot(uint64_t key, uint64_t check) {
+    int start = (int)(key % CACHE_SLOTS);
+    for (int i = 0; i < CACHE_SLOTS; i++) {
+        CacheSlot *slot = &cache_index->slots[(start + i) % CACHE_SLOTS];
+        if (!slot->used && !slot->key) return -1;   /* Never-used slot ends the probe */
+        if (slot->used && slot->key == key && slot->check == check) {
+            return (start + i) % CACHE_SLOTS;
+        }
+    }
+    return -1;
+}
+
+/* Drop a slot and its value file (index lock held) */
+static void remove_slot(CacheSlot *slot) {
+    char path[600];
+    value_path(slot->key, path, sizeof(path));
+    unlink(path);
+
+    if (cache_index->total_bytes >= slot->size) cache_index->total_bytes -= slot->size;
+    else cache_index->total_bytes = 0;
+    slot->used = 0;   /* Keep key as a tombstone for probing */
+}
+
+/* Evict the least recently used entry (index lock held) */
+static int evict_lru(void) {
+    int victim = -1;
+    for (int i = 0; i < CACHE_SLOTS; i++) {
+        CacheSlot *slot = &cache_index->slots[i];
+        if (slot->used && (victim < 0 || slot->last_used < cache_index->slots[victim].last_used)) {
+            victim = i;
+        }
+    }
+    if (victim < 0) return -1;
+
+    remove_slot(&cache_index->slots[victim]);
+    cache_index->evictions++;
+    return victim;
+}
+
+char *ai_cache_lookup(AIBackendType backend, const char *model, TaskType task,
+                      const char *prompt, const char *context) {
+    if (!cache_enabled || !cache_index || !prompt) return NULL;
+
+    uint64_t key, check;
+    cache_key(backend, model, task, prompt, context, &key, &check);
+
+    flock(index_fd, LOCK_EX);
+    int idx = find_slot(key, check);
+    if (idx < 0) {
+        cache_index->misses++;
+        flock(index_fd, LOCK_UN);
+        return NULL;
+    }
+
+    CacheSlot *slot = &cache_index->slots[idx];
+    time_t now = time(NULL);
+    if (now - slot->created > cache_ttl) {
+        remove_slot(slot);
+        cache_index->misses++;
+        flock(index_fd, LOCK_UN);
+        return NULL;
+    }
+
+    char path[600];
+    value_path(key, path, sizeof(path));
+    char *content = NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size == (off_t)slot->size) {
+            content = malloc(slot->size + 1);
+            if (content && read(fd, content, slot->size) == (ssize_t)slot->size) {
+                content[slot->size] = '\0';
+            } else {
+                free(content);
+                content = NULL;
+            }
+        }
+        close(fd);
+    }
+
+    if (content) {
+        slot->last_used = now;
+        cache_index->hits++;
+    } else {
+        /* Value file missing or damaged */
+        remove_slot(slot);
+        cache_index->misses++;
+    }
+    flock(index_fd, LOCK_UN);
+    return content;
+}
+
+void ai_cache_store(AIBackendType backend, const char *model, TaskType task,
+                    const char *prompt, const char *context, const char *content) {
+    if (!cache_enabled || !cache_index || !prompt || !content) return;
+
+    size_t size = strlen(content);
+    if (size == 0 || size > cache_max_bytes) return;
+
+    uint64_t key, check;
+    cache_key(backend, model, task, prompt, context, &key, &check);
+
+    flock(index_fd, LOCK_EX);
+
+    int idx = find_slot(key, check);
+    if (idx >= 0) remove_slot(&cache_index->slots[idx]);
+
+    /* Make room under the size cap */
+    while (cache_index->total_bytes + size > cache_max_bytes && evict_lru() >= 0)
+        ;
+
+    /* Claim the first free slot along the probe chain, evicting if the table is full */
+    idx = -1;
+    int start = (int)(key % CACHE_SLOTS);
+    for (int i = 0; i < CACHE_SLOTS; i++) {
+        int pos = (start + i) % CACHE_SLOTS;
+        if (!cache_index->slots[pos].used) {
+            idx = pos;
+            break;
+        }
+    }
+    if (idx < 0) idx = evict_lru();
+    if (idx < 0) {
+        flock(index_fd, LOCK_UN);
+        return;
+    }
+
+    /* Write the value atomically, then publish it in the index */
+    char path[600], tmp_path[640];
+    value_path(key, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        flock(index_fd, LOCK_UN);
+        return;
+    }
+    int ok = write(fd, content, size) == (ssize_t)size;
+    close(fd);
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        flock(index_fd, LOCK_UN);
+        return;
+    }
+
+    CacheSlot *slot = &cache_index->slots[idx];
+    time_t now = time(NULL);
+    slot->key = key;
+    slot->check = check;
+    slot->created = now;
+    slot->last_used = now;
+    slot->size = (uint32_t)size;
+    slot->used = 1;
+    cache_index->total_bytes += size;
+    cache_index->stores++;
+
+    flock(index_fd, LOCK_UN);
+}
+
+const char *ai_cache_dir(void) {
+    return cache_dir;
+}
+
+void ai_cache_set_enabled(int enabled) {
+    cache_enabled = enabled;
+}
+
+int ai_cache_is_enabled(void) {
+    return cache_enabled;
+}
+
+void ai_cache_clear(void) {
+    if (!cache_index) return;
+
+    flock(index_fd, LOCK_EX);
+    for (int i = 0; i < CACHE_SLOTS; i++) {
+        if (cache_index->slots[i].used) remove_slot(&cache_index->slots[i]);
+    }
+    memset(cache_index->slots, 0, sizeof(cache_index->slots));
+    cache_index->total_bytes = 0;
+    flock(index_fd, LOCK_UN);
+}
+
+void ai_cache_get_stats(AICacheStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (!cache_index) return;
+
+    for (int i = 0; i < CACHE_SLOTS; i++) {
+        if (cache_index->slots[i].used) stats->entries++;
+    }
+    stats->bytes = cache_index->total_bytes;
+    stats->hits = cache_index->hits;
+    stats->misses = cache_index->misses;
+    stats->stores = cache_index->stores;
+    stats->evictions = cache_index->evictions;
+}
+
+void ai_cache_show_stats(void) {
+    AICacheStats stats;
+    char line[256];
+
+    ai_cache_get_stats(&stats);
+
+    _puts("\n");
+    _puts(COLOR_CYAN);
+    _puts("Response Cache:\n");
+    _puts(COLOR_RESET);
+    _puts("───────────────────────────\n");
+    _puts("Status:    ");
+    if (!cache_index) {
+        _puts(COLOR_RED);
+        _puts("unavailable");
+    } else if (cache_enabled) {
+        _puts(COLOR_GREEN);
+        _puts("on");
+    } else {
+        _puts(COLOR_YELLOW);
+        _puts("off");
+    }
+    _puts(COLOR_RESET);
+    _puts("\n");
+
+    _puts("Location:  ");
+    _puts(cache_dir);
+    _puts("\n");
+    snprintf(line, sizeof(line), "Entries:   %d (%.1f KB of %.1f MB)\n",
+             stats.entries, stats.bytes / 1024.0, cache_max_bytes / (1024.0 * 1024.0));
+    _puts(line);
+
+    unsigned long long lookups = stats.hits + stats.misses;
+    snprintf(line, sizeof(line), "Hits:      %llu / %llu lookups (%.0f%%)\n",
+             stats.hits, lookups, lookups ? 100.0 * stats.hits / lookups : 0.0);
+    _puts(line);
+    snprintf(line, sizeof(line), "Stores:    %llu, evictions: %llu, TTL: %lds\n",
+             stats.stores, stats.evictions, cache_ttl);
+    _puts(line);
+}
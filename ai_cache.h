@@ -0,0 +1,41 @@
+#ifndef AI_CACHE_H
+#define AI_CACHE_H
+
+#include "ai_backend.h"
+
+/* Cache statistics */
+typedef struct {
+    int entries;
+    unsigned long long bytes;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long stores;
+    unsigned long long evictions;
+} AICacheStats;
+
+/* Initialize response cache (~/.cache/cortexcli) */
+void ai_cache_init(void);
+void ai_cache_cleanup(void);
+
+/* Look up a cached response; returns malloc'd content or NULL */
+char *ai_cache_lookup(AIBackendType backend, const char *model, TaskType task,
+                      const char *prompt, const char *context);
+
+/* Store a successful response */
+void ai_cache_store(AIBackendType backend, const char *model, TaskType task,
+                    const char *prompt, const char *context, const char *content);
+
+/* Prompt as cache keys see it: lowercase, whitespace collapsed (caller frees) */
+char *ai_cache_normalize(const char *prompt);
+
+/* Directory the caches live in, "" before ai_cache_init */
+const char *ai_cache_dir(void);
+
+/* Configure cache */
+void ai_cache_set_enabled(int enabled);
+int ai_cache_is_enabled(void);
+void ai_cache_clear(void);
+void ai_cache_get_stats(AICacheStats *stats);
+void ai_cache_show_stats(void);
+
+#endif /* AI_CACHE_H */
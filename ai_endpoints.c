@@ -0,0 +1,305 @@
+#include "ai_endpoints.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ENDPOINT_URL_SIZE 256
+#define ENDPOINT_BACKOFF_MS 5000L       /* First time set aside after a failure */
+#define ENDPOINT_BACKOFF_MAX_MS 60000L
+#define ENDPOINT_EWMA_WEIGHT 0.3        /* Share of a new sample in the average */
+
+typedef struct {
+    char url[ENDPOINT_URL_SIZE];
+    int healthy;
+    int trial;                  /* Unhealthy, with its trial request in flight */
+    int outstanding;
+    int consecutive;            /* Failures in a row */
+    double ewma_ms;             /* 0 until measured */
+    long retry_at_ms;
+    long requests;
+    long failures;
+    unsigned long long *models; /* Hashes of the names it serves */
+    int model_count;            /* -1 = unknown */
+} Endpoint;
+
+typedef struct {
+    Endpoint endpoints[AI_ENDPOINT_MAX];
+    int count;
+} EndpointPool;
+
+static EndpointPool pools[AI_BACKEND_COUNT];
+static AIEndpointPolicy policy = ENDPOINT_LEAST_OUTSTANDING;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int pick_seed = 0;
+
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* Ollama lists "llama3.2:latest" for what requests call "llama3.2" */
+static unsigned long long model_hash(const char *name) {
+    unsigned long long hash = 1469598103934665603ULL;
+    size_t len = strlen(name);
+    if (len > 7 && strcmp(name + len - 7, ":latest") == 0) len -= 7;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+void ai_endpoints_init(void) {
+    char *name = getenv("CORTEX_ENDPOINT_POLICY");
+    if (name && strcmp(name, "latency") == 0) {
+        policy = ENDPOINT_LATENCY;
+    }
+    /* Processes started together should not all favour the same server */
+    pick_seed = (unsigned int)getpid() * 2654435761u ^ (unsigned int)time(NULL);
+}
+
+void ai_endpoints_cleanup(void) {
+    pthread_mutex_lock(&pool_lock);
+    for (int b = 0; b < AI_BACKEND_COUNT; b++) {
+        for (int i = 0; i < pools[b].count; i++) free(pools[b].endpoints[i].models);
+        memset(&pools[b], 0, sizeof(pools[b]));
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static void add_endpoint(EndpointPool *pool, const char *url, size_t len) {
+    while (len > 0 && (url[len - 1] == '/' || url[len - 1] == ' ')) len--;
+    if (len == 0 || len >= ENDPOINT_URL_SIZE || pool->count == AI_ENDPOINT_MAX) return;
+
+    Endpoint *e = &pool->endpoints[pool->count++];
+    memset(e, 0, sizeof(*e));
+    memcpy(e->url, url, len);
+    e->healthy = 1;
+    e->model_count = -1;
+}
+
+void ai_endpoint_configure(AIBackendType backend, const char *list, const char *fallback) {
+    if (backend < 0 || backend >= AI_BACKEND_COUNT) return;
+
+    pthread_mutex_lock(&pool_lock);
+    EndpointPool *pool = &pools[backend];
+    for (int i = 0; i < pool->count; i++) free(pool->endpoints[i].models);
+    memset(pool, 0, sizeof(*pool));
+
+    for (const char *p = list; p && *p;) {
+        while (*p == ' ' || *p == ',') p++;
+        size_t len = strcspn(p, ",");
+        add_endpoint(pool, p, len);
+        p += len;
+    }
+    if (pool->count == 0 && fallback && *fallback) add_endpoint(pool, fallback, strlen(fallback));
+    pthread_mutex_unlock(&pool_lock);
+}
+
+int ai_endpoint_count(AIBackendType backend) {
+    if (backend < 0 || backend >= AI_BACKEND_COUNT) return 0;
+    return pools[backend].count;
+}
+
+/* URLs are fixed once configured, so no lock is needed to read one */
+const char *ai_endpoint_url(AIBackendType backend, int index) {
+    if (backend < 0 || backend >= AI_BACKEND_COUNT || index < 0 || index >= pools[backend].count) {
+        return "";
+    }
+    return pools[backend].endpoints[index].url;
+}
+
+static int serves_model(const Endpoint *e, unsigned long long hash) {
+    for (int i = 0; i < e->model_count; i++) {
+        if (e->models[i] == hash) return 1;
+    }
+    return 0;
+}
+
+/* Healthy, or due its one trial request */
+static int endpoint_usable(const Endpoint *e, long now) {
+    return e->healthy || (!e->trial && now >= e->retry_at_ms);
+}
+
+/* Caller holds the lock */
+static int pick_locked(EndpointPool *pool, const char *model, long now) {
+    if (pool->count <= 1) return pool->count - 1;
+
+    /* Where no endpoint lists the model, inventories are not consulted */
+    unsigned long long hash = model ? model_hash(model) : 0;
+    int listed = 0;
+    for (int i = 0; model && i < pool->count; i++) {
+        if (endpoint_usable(&pool->endpoints[i], now) && serves_model(&pool->endpoints[i], hash)) listed = 1;
+    }
+
+    /* Unmeasured endpoints are weighted like the fastest measured one */
+    double fastest = 0.0;
+    for (int i = 0; i < pool->count; i++) {
+        double ms = pool->endpoints[i].ewma_ms;
+        if (ms > 0 && (fastest == 0.0 || ms < fastest)) fastest = ms;
+    }
+    if (fastest == 0.0) fastest = 1.0;
+
+    int best = -1, ties = 0;
+    double total = 0.0;
+    for (int i = 0; i < pool->count; i++) {
+        Endpoint *e = &pool->endpoints[i];
+        if (!endpoint_usable(e, now) || (listed && !serves_model(e, hash))) continue;
+
+        if (policy == ENDPOINT_LATENCY) {
+            /* Weighted draw: share of requests ~ 1 / (latency * load) */
+            double weight = 1.0 / ((e->ewma_ms > 0 ? e->ewma_ms : fastest) * (e->outstanding + 1));
+            total += weight;
+            if ((double)rand_r(&pick_seed) / ((double)RAND_MAX + 1.0) * total < weight) best = i;
+        } else if (best < 0 || e->outstanding < pool->endpoints[best].outstanding) {
+            best = i;
+            ties = 1;
+        } else if (e->outstanding == pool->endpoints[best].outstanding &&
+                   rand_r(&pick_seed) % ++ties == 0) {
+            /* Ties are broken at random so idle processes spread out */
+            best = i;
+        }
+    }
+    if (best >= 0) return best;
+
+    /* Every endpoint is set aside: the one due back soonest */
+    best = 0;
+    for (int i = 1; i < pool->count; i++) {
+        if (pool->endpoints[i].retry_at_ms < pool->endpoints[best].retry_at_ms) best = i;
+    }
+    return best;
+}
+
+int ai_endpoint_pick(AIBackendType backend, const char *model) {
+    if (backend < 0 || backend >= AI_BACKEND_COUNT) return -1;
+    pthread_mutex_lock(&pool_lock);
+    int index = pick_locked(&pools[backend], model, now_ms());
+    pthread_mutex_unlock(&pool_lock);
+    return index;
+}
+
+int ai_endpoint_acquire(AIBackendType backend, const char *model) {
+    if (backend < 0 || backend >= AI_BACKEND_COUNT) return -1;
+    pthread_mutex_lock(&pool_lock);
+    int index = pick_locked(&pools[backend], model, now_ms());
+    if (index >= 0) {
+        Endpoint *e = &pools[backend].endpoints[index];
+        e->outstanding++;
+        e->requests++;
+        if (!e->healthy) e->trial = 1;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return index;
+}
+
+/* Caller holds the lock */
+static void set_aside(Endpoint *e, long now) {
+    long backoff = ENDPOINT_BACKOFF_MS << (e->consecutive < 4 ? e->consecutive : 4);
+    e->healthy = 0;
+    e->trial = 0;
+    e->consecutive++;
+    e->retry_at_ms = now + (backoff < ENDPOINT_BACKOFF_MAX_MS ? backoff : ENDPOINT_BACKOFF_MAX_MS);
+}
+
+static void set_healthy(Endpoint *e) {
+    e->healthy = 1;
+    e->trial = 0;
+    e->consecutive = 0;
+}
+
+void ai_endpoint_release(AIBackendType backend, int index, long first_byte_ms, int failed) {
+    if (backend < 0 || backend >= AI_BACKEND_COUNT || index < 0 || index >= pools[backend].count) return;
+
+    pthread_mutex_lock(&pool_lock);
+    Endpoint *e = &pools[backend].endpoints[index];
+    if (e->outstanding > 0) e->outstanding--;
+    if (first_byte_ms < 0) {
+        e->trial = 0;
+    } else if (failed) {
+        e->failures++;
+        set_aside(e, now_ms());
+    } else {
+        set_healthy(e);
+        e->ewma_ms = e->ewma_ms > 0 ?
+                     e->ewma_ms + ENDPOINT_EWMA_WEIGHT * ((double)first_byte_ms - e->ewma_ms) :
+                     (double)(first_byte_ms > 0 ? first_byte_ms : 1);
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void ai_endpoint_report(AIBackendType backend, int index, int healthy) {
+    if (backend < 0 || backend >= AI_BACKEND_COUNT || index < 0 || index >= pools[backend].count) return;
+
+    pthread_mutex_lock(&pool_lock);
+    Endpoint *e = &pools[backend].endpoints[index];
+    if (healthy) {
+        set_healthy(e);
+    } else if (e->healthy || !e->trial) {
+        set_aside(e, now_ms());
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void ai_endpoint_set_models(AIBackendType backend, int index, const OllamaModelList *list) {
+    if (backend < 0 || backend >= AI_BACKEND_COUNT || index < 0 || index >= pools[backend].count) return;
+
+    unsigned long long *models = NULL;
+    int count = -1;
+    if (list) {
+        models = malloc(sizeof(unsigned long long) * (list->count > 0 ? list->count : 1));
+        count = 0;
+        for (int i = 0; models && i < list->count; i++) {
+            if (list->models[i].name) models[count++] = model_hash(list->models[i].name);
+        }
+        if (!models) count = -1;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    Endpoint *e = &pools[backend].endpoints[index];
+    free(e->models);
+    e->models = models;
+    e->model_count = count;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+int ai_endpoint_usable(AIBackendType backend) {
+    if (backend < 0 || backend >= AI_BACKEND_COUNT) return 0;
+
+    long now = now_ms();
+    int usable = 0;
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < pools[backend].count; i++) {
+        usable += endpoint_usable(&pools[backend].endpoints[i], now);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return usable;
+}
+
+int ai_endpoint_get_stats(AIBackendType backend, AIEndpointStats *stats, int max) {
+    if (backend < 0 || backend >= AI_BACKEND_COUNT) return 0;
+
+    long now = now_ms();
+    int count = 0;
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < pools[backend].count && count < max; i++) {
+        const Endpoint *e = &pools[backend].endpoints[i];
+        stats[count].url = e->url;
+        stats[count].healthy = e->healthy;
+        stats[count].outstanding = e->outstanding;
+        stats[count].ewma_ms = e->ewma_ms > 0 ? (long)e->ewma_ms : -1;
+        stats[count].requests = e->requests;
+        stats[count].failures = e->failures;
+        stats[count].retry_in_ms = !e->healthy && e->retry_at_ms > now ? e->retry_at_ms - now : 0;
+        stats[count].models = e->model_count;
+        count++;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return count;
+}
+
+const char *ai_endpoint_policy_name(void) {
+    return policy == ENDPOINT_LATENCY ? "latency-weighted" : "least outstanding";
+}
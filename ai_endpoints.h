@@ -0,0 +1,63 @@
+#ifndef AI_ENDPOINTS_H
+#define AI_ENDPOINTS_H
+
+#include "ai_backend.h"
+
+#define AI_ENDPOINT_MAX 8
+
+/*
+ * Endpoint pool per backend: the servers one backend's requests are
+ * spread over (CORTEX_<BACKEND>_ENDPOINTS, or a comma-separated
+ * OLLAMA_HOST). Each request takes the endpoint with the fewest requests
+ * outstanding, or with CORTEX_ENDPOINT_POLICY=latency one drawn with
+ * probability inversely proportional to its recent first-byte time and
+ * load. A failing endpoint is set aside with a growing backoff and then
+ * given one trial request. Endpoints may also report which models they
+ * serve; a request goes to one that has its model when any does.
+ */
+typedef enum {
+    ENDPOINT_LEAST_OUTSTANDING = 0,
+    ENDPOINT_LATENCY
+} AIEndpointPolicy;
+
+typedef struct {
+    const char *url;
+    int healthy;
+    int outstanding;            /* Requests of this process in flight */
+    long ewma_ms;               /* Smoothed first-byte time, -1 until measured */
+    long requests;
+    long failures;
+    long retry_in_ms;           /* Unhealthy: time left before the trial */
+    int models;                 /* Inventory size, -1 if unknown */
+} AIEndpointStats;
+
+void ai_endpoints_init(void);   /* Reads CORTEX_ENDPOINT_POLICY */
+void ai_endpoints_cleanup(void);
+
+/* Set a backend's pool from a comma-separated list, or the single fallback URL */
+void ai_endpoint_configure(AIBackendType backend, const char *list, const char *fallback);
+int ai_endpoint_count(AIBackendType backend);
+const char *ai_endpoint_url(AIBackendType backend, int index);
+
+/* Best endpoint for model now; acquire also counts the request as outstanding */
+int ai_endpoint_pick(AIBackendType backend, const char *model);
+int ai_endpoint_acquire(AIBackendType backend, const char *model);
+
+/*
+ * End a request from ai_endpoint_acquire. first_byte_ms < 0 means it was
+ * abandoned before an outcome; failed = the server, not the request, was
+ * at fault.
+ */
+void ai_endpoint_release(AIBackendType backend, int index, long first_byte_ms, int failed);
+
+/* Result of a health check, and the models the endpoint serves (NULL = unknown) */
+void ai_endpoint_report(AIBackendType backend, int index, int healthy);
+void ai_endpoint_set_models(AIBackendType backend, int index, const OllamaModelList *list);
+
+/* Endpoints that would take a request now */
+int ai_endpoint_usable(AIBackendType backend);
+
+int ai_endpoint_get_stats(AIBackendType backend, AIEndpointStats *stats, int max);
+const char *ai_endpoint_policy_name(void);
+
+#endif /* AI_ENDPOINTS_H */
@@ -0,0 +1,276 @@
+#include "ai_jobs.h"
+#include "shell.h"
+#include <pthread.h>
+#include <time.h>
+
+#define JOB_PREVIEW_CHARS 40           /* Prompt shown in the table, in bytes */
+
+static AIJob *jobs[AI_JOB_MAX];         /* NULL = free slot */
+static int next_id = 1;
+static int running = 0;
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobs_cond = PTHREAD_COND_INITIALIZER;
+
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* The caller's conversation points into buffers the next query reuses */
+static int conv_copy(AIConversation *dst, const AIConversation *src) {
+    AITurn *turns = NULL;
+
+    memset(dst, 0, sizeof(*dst));
+    if (src->system && !(dst->system = strdup(src->system))) return -1;
+    if (src->turn_count > 0) {
+        turns = calloc((size_t)src->turn_count, sizeof(AITurn));
+        if (!turns) return -1;
+        dst->turns = turns;
+    }
+    for (int i = 0; i < src->turn_count; i++) {
+        turns[i].user = strdup(src->turns[i].user);
+        turns[i].assistant = strndup(src->turns[i].assistant, src->turns[i].assistant_len);
+        turns[i].assistant_len = src->turns[i].assistant_len;
+        dst->turn_count++;
+        if (!turns[i].user || !turns[i].assistant) return -1;
+    }
+    return 0;
+}
+
+static void conv_free(AIConversation *conv) {
+    for (int i = 0; i < conv->turn_count; i++) {
+        free((char *)conv->turns[i].user);
+        free((char *)conv->turns[i].assistant);
+    }
+    free((AITurn *)conv->turns);
+    free((char *)conv->system);
+    memset(conv, 0, sizeof(*conv));
+}
+
+void ai_job_free(AIJob *job) {
+    if (!job) return;
+    free(job->prompt);
+    conv_free(&job->conv);
+    ai_response_free(job->response);
+    free(job);
+}
+
+/* Worker: the request is all it does; the job is not touched once finished */
+static void *job_main(void *arg) {
+    AIJob *job = (AIJob *)arg;
+    AIResponse *response = ai_client_query(&job->client, job->prompt, &job->conv, NULL, NULL);
+
+    pthread_mutex_lock(&jobs_lock);
+    job->response = response;
+    job->elapsed_ms = now_ms() - job->started_ms;
+    job->state = response && response->success && response->content ? AI_JOB_DONE : AI_JOB_FAILED;
+    running--;
+    pthread_cond_broadcast(&jobs_cond);
+    pthread_mutex_unlock(&jobs_lock);
+    return NULL;
+}
+
+int ai_job_submit(const AIClient *client, TaskType task, const char *prompt, const AIConversation *conv) {
+    AIJob *job = calloc(1, sizeof(AIJob));
+    if (!job) return -1;
+
+    job->client = *client;
+    job->client.stream = 0;
+    job->client.quiet = 1;
+    job->task = task;
+    job->prompt = strdup(prompt);
+    if (!job->prompt || conv_copy(&job->conv, conv) != 0) {
+        ai_job_free(job);
+        return -1;
+    }
+
+    pthread_mutex_lock(&jobs_lock);
+    int slot = -1;
+    for (int i = 0; i < AI_JOB_MAX && slot < 0; i++) {
+        if (!jobs[i]) slot = i;
+    }
+    if (slot < 0) {
+        pthread_mutex_unlock(&jobs_lock);
+        ai_job_free(job);
+        return -1;
+    }
+
+    job->id = next_id++;
+    job->state = AI_JOB_RUNNING;
+    job->started_ms = now_ms();
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, job_main, job) != 0) {
+        pthread_attr_destroy(&attr);
+        next_id--;
+        pthread_mutex_unlock(&jobs_lock);
+        ai_job_free(job);
+        return -1;
+    }
+    pthread_attr_destroy(&attr);
+    jobs[slot] = job;
+    running++;
+    int id = job->id;
+    pthread_mutex_unlock(&jobs_lock);
+    return id;
+}
+
+const AIJob *ai_job_next_finished(void) {
+    AIJob *next = NULL;
+
+    pthread_mutex_lock(&jobs_lock);
+    for (int i = 0; i < AI_JOB_MAX; i++) {
+        AIJob *job = jobs[i];
+        if (job && job->state != AI_JOB_RUNNING && !job->announced &&
+            (!next || job->id < next->id)) {
+            next = job;
+        }
+    }
+    if (next) next->announced = 1;
+    pthread_mutex_unlock(&jobs_lock);
+    return next;
+}
+
+/* Slot of job id, or with id 0 the newest finished job, else the newest (lock held) */
+static int find_slot(int id) {
+    int best = -1;
+    for (int i = 0; i < AI_JOB_MAX; i++) {
+        AIJob *job = jobs[i];
+        if (!job) continue;
+        if (id > 0) {
+            if (job->id == id) return i;
+            continue;
+        }
+        if (best < 0) {
+            best = i;
+            continue;
+        }
+        int finished = job->state != AI_JOB_RUNNING;
+        int best_finished = jobs[best]->state != AI_JOB_RUNNING;
+        if (finished > best_finished || (finished == best_finished && job->id > jobs[best]->id)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+AIJob *ai_job_claim(int id) {
+    pthread_mutex_lock(&jobs_lock);
+    int slot = find_slot(id);
+    if (slot < 0) {
+        pthread_mutex_unlock(&jobs_lock);
+        return NULL;
+    }
+
+    AIJob *job = jobs[slot];
+    if (job->state == AI_JOB_RUNNING) {
+        char note[64];
+        snprintf(note, sizeof(note), COLOR_YELLOW "Waiting for [%d]...\n" COLOR_RESET, job->id);
+        _puts(note);
+    }
+    while (job->state == AI_JOB_RUNNING) {
+        pthread_cond_wait(&jobs_cond, &jobs_lock);
+    }
+    jobs[slot] = NULL;
+    pthread_mutex_unlock(&jobs_lock);
+    return job;
+}
+
+int ai_job_running(void) {
+    pthread_mutex_lock(&jobs_lock);
+    int count = running;
+    pthread_mutex_unlock(&jobs_lock);
+    return count;
+}
+
+const char *ai_job_state_name(AIJobState state) {
+    switch (state) {
+        case AI_JOB_RUNNING: return "running";
+        case AI_JOB_DONE: return "done";
+        default: return "failed";
+    }
+}
+
+/* Start of the prompt, cut at a character boundary; out holds JOB_PREVIEW_CHARS + 4 */
+static void job_preview(const char *prompt, char *out, size_t size) {
+    size_t cut = strlen(prompt);
+    if (cut <= JOB_PREVIEW_CHARS) {
+        snprintf(out, size, "%s", prompt);
+        return;
+    }
+    cut = JOB_PREVIEW_CHARS;
+    while (cut > 0 && (prompt[cut] & 0xC0) == 0x80) cut--;
+    snprintf(out, size, "%.*s...", (int)cut, prompt);
+}
+
+/* One table row: number, state, backend, time and prompt, plus an optional hint */
+static void job_print(const AIJob *job, long elapsed_ms, const char *hint) {
+    char line[320];
+    char preview[JOB_PREVIEW_CHARS + 4];
+
+    job_preview(job->prompt, preview, sizeof(preview));
+    snprintf(line, sizeof(line), "  [%d] %-8s %-9s %6.1f s  %s%s\n", job->id,
+             ai_job_state_name(job->state), ai_get_backend_name(job->client.backend),
+             elapsed_ms / 1000.0, preview, hint);
+    _puts(job->state == AI_JOB_FAILED ? COLOR_RED :
+          job->state == AI_JOB_DONE ? COLOR_GREEN : COLOR_RESET);
+    _puts(line);
+    _puts(COLOR_RESET);
+}
+
+void ai_job_announce(const AIJob *job) {
+    char hint[32];
+    snprintf(hint, sizeof(hint), "  (ai fg %d)", job->id);
+    job_print(job, job->elapsed_ms, hint);
+}
+
+void ai_jobs_show(void) {
+    AIJob *order[AI_JOB_MAX];
+    int count = 0;
+    long now = now_ms();
+
+    _puts("\n");
+    _puts(COLOR_CYAN);
+    _puts("Background AI jobs:\n");
+    _puts(COLOR_RESET);
+    _puts("───────────────────────────\n");
+
+    pthread_mutex_lock(&jobs_lock);
+    for (int i = 0; i < AI_JOB_MAX; i++) {
+        if (!jobs[i]) continue;
+        int at = count++;
+        while (at > 0 && order[at - 1]->id > jobs[i]->id) {
+            order[at] = order[at - 1];
+            at--;
+        }
+        order[at] = jobs[i];
+    }
+    if (count == 0) _puts("  none\n");
+    for (int i = 0; i < count; i++) {
+        const AIJob *job = order[i];
+        job_print(job, job->state == AI_JOB_RUNNING ? now - job->started_ms : job->elapsed_ms, "");
+    }
+    pthread_mutex_unlock(&jobs_lock);
+}
+
+void ai_jobs_cleanup(void) {
+    pthread_mutex_lock(&jobs_lock);
+    if (running > 0) {
+        char note[96];
+        snprintf(note, sizeof(note), COLOR_YELLOW "Waiting for %d background AI job%s...\n" COLOR_RESET,
+                 running, running == 1 ? "" : "s");
+        _puts(note);
+    }
+    while (running > 0) {
+        pthread_cond_wait(&jobs_cond, &jobs_lock);
+    }
+    for (int i = 0; i < AI_JOB_MAX; i++) {
+        ai_job_free(jobs[i]);
+        jobs[i] = NULL;
+    }
+    pthread_mutex_unlock(&jobs_lock);
+}
@@ -0,0 +1,58 @@
+#ifndef AI_JOBS_H
+#define AI_JOBS_H
+
+#include "ai_backend.h"
+
+#define AI_JOB_MAX 8
+
+/*
+ * Background AI jobs: a query sent with 'ai bg' or a trailing '&' runs on
+ * a worker thread while the shell takes more input. A finished job waits
+ * in the table until 'ai fg' collects it; the shell announces it at the
+ * next prompt. Workers only run the request; caching, session memory and
+ * acting on the answer happen on the shell's thread.
+ */
+typedef enum {
+    AI_JOB_RUNNING = 0,
+    AI_JOB_DONE,
+    AI_JOB_FAILED
+} AIJobState;
+
+typedef struct {
+    int id;                     /* Number shown to the user, from 1 */
+    AIJobState state;
+    AIClient client;
+    TaskType task;
+    char *prompt;
+    AIConversation conv;        /* Owned copy of what was sent */
+    AIResponse *response;       /* Set once the job is no longer running */
+    long started_ms;
+    long elapsed_ms;            /* Final once finished */
+    int announced;
+} AIJob;
+
+/* Start a query on a worker thread; returns the job number, or -1 when the table is full */
+int ai_job_submit(const AIClient *client, TaskType task, const char *prompt, const AIConversation *conv);
+
+/*
+ * Next finished job not yet announced, or NULL. The job stays in the
+ * table; its fields no longer change.
+ */
+const AIJob *ai_job_next_finished(void);
+void ai_job_announce(const AIJob *job);
+
+/*
+ * Take job id (0 = the most recent) out of the table, waiting for it if
+ * still running. NULL if there is no such job. Free with ai_job_free.
+ */
+AIJob *ai_job_claim(int id);
+void ai_job_free(AIJob *job);
+
+int ai_job_running(void);
+const char *ai_job_state_name(AIJobState state);
+void ai_jobs_show(void);
+
+/* Wait for running jobs, then drop every job */
+void ai_jobs_cleanup(void);
+
+#endif /* AI_JOBS_H */
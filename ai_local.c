@@ -0,0 +1,392 @@
+#include "ai_local.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOCAL_CTX_DEFAULT 4096
+#define LOCAL_CTX_MIN 512
+#define LOCAL_PREDICT_DEFAULT 512
+
+static int local_ctx = LOCAL_CTX_DEFAULT;
+static int local_threads = 1;
+static int local_predict = LOCAL_PREDICT_DEFAULT;
+
+static AIResponse *local_error(const char *message) {
+    AIResponse *response = calloc(1, sizeof(AIResponse));
+    if (response) response->error_message = strdup(message);
+    return response;
+}
+
+int ai_local_context_size(void) {
+    return local_ctx;
+}
+
+#ifdef CORTEX_LLAMA
+#include <llama.h>
+
+static long local_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* Generated text shared between the worker and the caller */
+typedef struct {
+    llama_token *tokens;        /* Prompt */
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char *text;
+    size_t size;
+    int done;
+    int cancel;
+    char error[128];
+} LocalJob;
+
+static struct llama_model *model = NULL;
+static struct llama_context *ctx = NULL;
+static char model_file[512] = {0};
+static llama_token *cached = NULL;      /* Tokens whose KV entries ctx holds */
+static int cached_count = 0;
+static pthread_mutex_t local_lock = PTHREAD_MUTEX_INITIALIZER;     /* One generation at a time */
+
+/* llama.cpp reports every tensor it loads; only errors are worth showing */
+static void local_log(enum ggml_log_level level, const char *text, void *userdata) {
+    (void)userdata;
+    if (level == GGML_LOG_LEVEL_ERROR) fputs(text, stderr);
+}
+
+int ai_local_supported(void) {
+    return 1;
+}
+
+static void unload_model(void) {
+    if (ctx) llama_free(ctx);
+    if (model) llama_model_free(model);
+    free(cached);
+    ctx = NULL;
+    model = NULL;
+    cached = NULL;
+    cached_count = 0;
+    model_file[0] = '\0';
+}
+
+/* Map the model file; its pages are read in as inference touches them */
+static int load_model(const char *path, char *err, size_t size) {
+    if (model && strcmp(model_file, path) == 0) return 1;
+    unload_model();
+
+    struct llama_model_params mp = llama_model_default_params();
+    mp.use_mmap = true;
+    mp.n_gpu_layers = 0;
+    model = llama_model_load_from_file(path, mp);
+    if (!model) {
+        snprintf(err, size, "Cannot load GGUF model %s", path);
+        return 0;
+    }
+
+    struct llama_context_params cp = llama_context_default_params();
+    cp.n_ctx = (uint32_t)local_ctx;
+    cp.n_threads = local_threads;
+    cp.n_threads_batch = local_threads;
+    cp.no_perf = true;
+    ctx = llama_init_from_model(model, cp);
+    cached = malloc(sizeof(llama_token) * local_ctx);
+    if (!ctx || !cached) {
+        unload_model();
+        snprintf(err, size, "Cannot create a %d-token context for %s", local_ctx, path);
+        return 0;
+    }
+    snprintf(model_file, sizeof(model_file), "%s", path);
+    return 1;
+}
+
+/* Apply the model's chat template, ChatML if it has none */
+static char *apply_template(const llama_chat_message *messages, int count, size_t total) {
+    const char *tmpl = llama_model_chat_template(model, NULL);
+    if (!tmpl) tmpl = "chatml";
+
+    int32_t size = (int32_t)(total * 2 + 256);
+    char *buf = malloc(size);
+    int32_t len = buf ? llama_chat_apply_template(tmpl, messages, count, true, buf, size) : -1;
+    if (len >= size) {
+        char *grown = realloc(buf, len + 1);
+        if (!grown) {
+            free(buf);
+            return NULL;
+        }
+        buf = grown;
+        len = llama_chat_apply_template(tmpl, messages, count, true, buf, len + 1);
+    }
+    if (len < 0) {
+        free(buf);
+        return NULL;
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+/* The conversation as one prompt in the model's chat format */
+static char *render_chat(const char *prompt, const AIConversation *conv) {
+    int turns = conv ? conv->turn_count : 0;
+    llama_chat_message *messages = calloc(turns * 2 + 2, sizeof(llama_chat_message));
+    char **answers = calloc(turns + 1, sizeof(char *));
+    size_t total = strlen(prompt);
+    int count = 0, complete = messages && answers;
+
+    if (complete && conv && conv->system && conv->system[0]) {
+        messages[count].role = "system";
+        messages[count++].content = conv->system;
+        total += strlen(conv->system);
+    }
+    for (int i = 0; complete && i < turns; i++) {
+        /* Stored answers may be cut short and are not terminated there */
+        answers[i] = strndup(conv->turns[i].assistant, conv->turns[i].assistant_len);
+        complete = answers[i] != NULL;
+        messages[count].role = "user";
+        messages[count++].content = conv->turns[i].user;
+        messages[count].role = "assistant";
+        messages[count++].content = answers[i];
+        total += strlen(conv->turns[i].user) + conv->turns[i].assistant_len;
+    }
+
+    char *chat = NULL;
+    if (complete) {
+        messages[count].role = "user";
+        messages[count++].content = prompt;
+        chat = apply_template(messages, count, total);
+    }
+    for (int i = 0; answers && i < turns; i++) free(answers[i]);
+    free(answers);
+    free(messages);
+    return chat;
+}
+
+static void job_append(LocalJob *job, const char *piece, int len) {
+    pthread_mutex_lock(&job->lock);
+    char *grown = realloc(job->text, job->size + len + 1);
+    if (grown) {
+        memcpy(grown + job->size, piece, len);
+        job->size += len;
+        grown[job->size] = '\0';
+        job->text = grown;
+    }
+    pthread_cond_signal(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+}
+
+static int job_cancelled(LocalJob *job) {
+    pthread_mutex_lock(&job->lock);
+    int cancel = job->cancel;
+    pthread_mutex_unlock(&job->lock);
+    return cancel;
+}
+
+/* A timeout noted by the caller stays the reason given */
+static void job_finish(LocalJob *job, const char *error) {
+    pthread_mutex_lock(&job->lock);
+    if (error && !job->error[0]) snprintf(job->error, sizeof(job->error), "%s", error);
+    job->done = 1;
+    pthread_cond_signal(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+}
+
+/* Worker: prefill the prompt, then sample until end of turn */
+static void *generate_main(void *arg) {
+    LocalJob *job = (LocalJob *)arg;
+    const struct llama_vocab *vocab = llama_model_get_vocab(model);
+    int n_batch = (int)llama_n_batch(ctx);
+
+    /*
+     * The system prompt and earlier turns repeat from one question to the
+     * next; their KV entries are kept and only the new tail is prefilled.
+     * The last prompt token is always decoded again to get fresh logits.
+     */
+    int keep = 0;
+    while (keep < cached_count && keep < job->count - 1 && cached[keep] == job->tokens[keep]) keep++;
+    llama_memory_seq_rm(llama_get_memory(ctx), -1, keep, -1);
+    cached_count = keep;
+
+    for (int i = keep; i < job->count; i += n_batch) {
+        int n = job->count - i < n_batch ? job->count - i : n_batch;
+        if (job_cancelled(job) || llama_decode(ctx, llama_batch_get_one(job->tokens + i, n)) != 0) {
+            job_finish(job, "Local model failed to process the prompt");
+            return NULL;
+        }
+        memcpy(cached + i, job->tokens + i, sizeof(llama_token) * n);
+        cached_count = i + n;
+    }
+
+    /* Low temperature: commands should be the likely ones, not creative ones */
+    struct llama_sampler *sampler = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    llama_sampler_chain_add(sampler, llama_sampler_init_top_k(40));
+    llama_sampler_chain_add(sampler, llama_sampler_init_top_p(0.9f, 1));
+    llama_sampler_chain_add(sampler, llama_sampler_init_temp(0.2f));
+    llama_sampler_chain_add(sampler, llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
+
+    for (int n = 0; n < local_predict && cached_count < local_ctx && !job_cancelled(job); n++) {
+        llama_token token = llama_sampler_sample(sampler, ctx, -1);
+        if (llama_vocab_is_eog(vocab, token)) break;
+
+        char piece[256];
+        int len = llama_token_to_piece(vocab, token, piece, sizeof(piece), 0, false);
+        if (len > 0) job_append(job, piece, len);
+        if (llama_decode(ctx, llama_batch_get_one(&token, 1)) != 0) break;
+        cached[cached_count++] = token;
+    }
+    llama_sampler_free(sampler);
+    job_finish(job, NULL);
+    return NULL;
+}
+
+/* Tokens of text, or NULL with count set to the size needed */
+static llama_token *tokenize(const char *text, int *count) {
+    const struct llama_vocab *vocab = llama_model_get_vocab(model);
+    int32_t len = (int32_t)strlen(text);
+    int32_t n = -llama_tokenize(vocab, text, len, NULL, 0, true, true);
+    llama_token *tokens = n > 0 ? malloc(sizeof(llama_token) * n) : NULL;
+    if (!tokens || llama_tokenize(vocab, text, len, tokens, n, true, true) != n) {
+        free(tokens);
+        return NULL;
+    }
+    *count = n;
+    return tokens;
+}
+
+AIResponse *ai_local_query(const char *model_path, const char *prompt, const AIConversation *conv,
+                           AIStreamCallback on_text, void *userdata, long timeout_ms, long *first_ms) {
+    long start = local_now_ms();
+    char err[256];
+    *first_ms = -1;
+
+    if (!model_path || !model_path[0]) return local_error("No local model set (CORTEX_LOCAL_MODEL)");
+
+    pthread_mutex_lock(&local_lock);
+    if (!load_model(model_path, err, sizeof(err))) {
+        pthread_mutex_unlock(&local_lock);
+        return local_error(err);
+    }
+
+    LocalJob job;
+    memset(&job, 0, sizeof(job));
+    char *chat = render_chat(prompt, conv);
+    job.tokens = chat ? tokenize(chat, &job.count) : NULL;
+    free(chat);
+    if (!job.tokens || job.count >= local_ctx) {
+        free(job.tokens);
+        pthread_mutex_unlock(&local_lock);
+        snprintf(err, sizeof(err), "Prompt does not fit the %d-token local context", local_ctx);
+        return local_error(err);
+    }
+
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.cond, NULL);
+    pthread_t worker;
+    int started = pthread_create(&worker, NULL, generate_main, &job) == 0;
+    if (!started) snprintf(job.error, sizeof(job.error), "Cannot start the local generation thread");
+
+    /* Pass text on as it comes, on this thread, like a streamed response */
+    size_t delivered = 0;
+    long deadline = start + timeout_ms;
+    while (started) {
+        pthread_mutex_lock(&job.lock);
+        while (!job.done && job.size == delivered && local_now_ms() < deadline) {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += 100000000L;
+            if (until.tv_nsec >= 1000000000L) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&job.cond, &job.lock, &until);
+        }
+        size_t size = job.size;
+        char *fresh = size > delivered ? strndup(job.text + delivered, size - delivered) : NULL;
+        int done = job.done;
+        if (!done && local_now_ms() >= deadline) {
+            job.cancel = 1;
+            snprintf(job.error, sizeof(job.error), "Local model timed out after %ld s", timeout_ms / 1000);
+        }
+        pthread_mutex_unlock(&job.lock);
+
+        if (fresh) {
+            if (*first_ms < 0) *first_ms = local_now_ms() - start;
+            if (on_text) on_text(fresh, size - delivered, userdata);
+            free(fresh);
+            delivered = size;
+        }
+        if (done || job.cancel) break;
+    }
+    if (started) pthread_join(worker, NULL);
+    pthread_mutex_unlock(&local_lock);
+
+    AIResponse *response = calloc(1, sizeof(AIResponse));
+    if (response && job.text && job.size > 0 && !job.error[0]) {
+        response->success = 1;
+        response->content = job.text;
+        job.text = NULL;
+    } else if (response) {
+        response->error_message = strdup(job.error[0] ? job.error : "Empty response from the local model");
+    }
+    free(job.text);
+    free(job.tokens);
+    pthread_cond_destroy(&job.cond);
+    pthread_mutex_destroy(&job.lock);
+    return response;
+}
+
+#else
+
+int ai_local_supported(void) {
+    return 0;
+}
+
+AIResponse *ai_local_query(const char *model_path, const char *prompt, const AIConversation *conv,
+                           AIStreamCallback on_text, void *userdata, long timeout_ms, long *first_ms) {
+    (void)model_path;
+    (void)prompt;
+    (void)conv;
+    (void)on_text;
+    (void)userdata;
+    (void)timeout_ms;
+    *first_ms = -1;
+    return local_error("Built without the local backend (rebuild with make LLAMA=1)");
+}
+
+#endif /* CORTEX_LLAMA */
+
+void ai_local_init(void) {
+    char *n_ctx = getenv("CORTEX_LOCAL_CTX");
+    if (n_ctx && atoi(n_ctx) >= LOCAL_CTX_MIN) {
+        local_ctx = atoi(n_ctx);
+    }
+    char *predict = getenv("CORTEX_LOCAL_PREDICT");
+    if (predict && atoi(predict) > 0) {
+        local_predict = atoi(predict);
+    }
+
+    /* Every online core unless told otherwise */
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    local_threads = cores > 0 ? (int)cores : 1;
+    char *threads = getenv("CORTEX_LOCAL_THREADS");
+    if (threads && atoi(threads) > 0) {
+        local_threads = atoi(threads);
+    }
+
+#ifdef CORTEX_LLAMA
+    llama_log_set(local_log, NULL);
+    llama_backend_init();
+#endif
+}
+
+void ai_local_cleanup(void) {
+#ifdef CORTEX_LLAMA
+    pthread_mutex_lock(&local_lock);
+    unload_model();
+    pthread_mutex_unlock(&local_lock);
+    llama_backend_free();
+#endif
+}
@@ -0,0 +1,28 @@
+#ifndef AI_LOCAL_H
+#define AI_LOCAL_H
+
+#include "ai_backend.h"
+
+/*
+ * In-process inference on a GGUF model through llama.cpp (build with
+ * 'make LLAMA=1'). The model file (CORTEX_LOCAL_MODEL) is memory-mapped
+ * on first use and stays loaded; tokens are generated on a worker thread
+ * using every core (CORTEX_LOCAL_THREADS) and handed to the caller as
+ * they come. Without llama.cpp the backend is reported as unavailable.
+ */
+int ai_local_supported(void);
+void ai_local_init(void);
+void ai_local_cleanup(void);
+
+/* Context window the model is run with, in tokens */
+int ai_local_context_size(void);
+
+/*
+ * Answer prompt with the GGUF model at model_path, passing text to
+ * on_text as it is generated. Gives up after timeout_ms; the time to the
+ * first token goes to first_ms (-1 if none came).
+ */
+AIResponse *ai_local_query(const char *model_path, const char *prompt, const AIConversation *conv,
+                           AIStreamCallback on_text, void *userdata, long timeout_ms, long *first_ms);
+
+#endif /* AI_LOCAL_H */
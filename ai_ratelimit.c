@@ -0,0 +1,390 @@
+#include "ai_ratelimit.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RATELIMIT_SHM_NAME "/cortexcli-ratelimit"   /* Followed by -<uid> or -g<gid> */
+#define RATELIMIT_MAGIC 0x434c5231u     /* Layout version; a new one starts afresh */
+#define RATELIMIT_BUCKETS 32
+#define RATELIMIT_BACKOFF_MS 1000L      /* First 429 without Retry-After */
+#define RATELIMIT_BACKOFF_MAX_MS 60000L
+#define RATELIMIT_BLOCK_MAX_MS 3600000L /* Cap on any advertised wait */
+#define RATELIMIT_LIMIT_MAX 1000000.0  /* Requests per minute no provider exceeds */
+
+typedef struct {
+    unsigned long long key;     /* Hash of backend and API key, 0 = free */
+    int backend;
+    double tokens;
+    double capacity;
+    double rate;                /* Tokens per second, 0 = no limit known */
+    long long updated_ms;       /* Monotonic clock, shared by all processes */
+    long long blocked_until_ms;
+    long long last_used_ms;
+    int backoff_step;           /* 429s in a row */
+    long limited;
+} Bucket;
+
+typedef struct {
+    unsigned int magic;
+    Bucket buckets[RATELIMIT_BUCKETS];
+} Segment;
+
+static Segment local_segment;           /* When no shared segment can be had */
+static Segment *segment = &local_segment;
+static int segment_fd = -1;
+static pthread_mutex_t segment_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000LL;
+}
+
+/*
+ * Another process may have written anything into a shared bucket. One
+ * that could not come from this code is dropped instead of stalling or
+ * flooding the key.
+ */
+static int bucket_valid(const Bucket *b, long long now) {
+    if (b->key == 0) return 1;
+    if (b->backend < 0 || b->backend >= AI_BACKEND_COUNT) return 0;
+    if (!isfinite(b->tokens) || !isfinite(b->capacity) || !isfinite(b->rate)) return 0;
+    if (b->capacity < 0 || b->capacity > RATELIMIT_LIMIT_MAX) return 0;
+    if (b->rate < 0 || b->rate > b->capacity / 60.0 + 1e-9) return 0;
+    if (b->tokens > RATELIMIT_LIMIT_MAX) return 0;
+    if (b->tokens < 0 && (b->rate == 0 || -b->tokens / b->rate * 1000.0 > RATELIMIT_BLOCK_MAX_MS)) return 0;
+    if (b->updated_ms > now || b->last_used_ms > now) return 0;
+    if (b->blocked_until_ms > now + RATELIMIT_BLOCK_MAX_MS) return 0;
+    if (b->backoff_step < 0 || b->limited < 0) return 0;
+    return 1;
+}
+
+/*
+ * An flock is dropped by the kernel if its holder dies, unlike a mutex in
+ * the segment. It belongs to the open file, so it does not keep this
+ * process's own threads apart; the mutex does that.
+ */
+static void segment_lock(void) {
+    pthread_mutex_lock(&segment_mutex);
+    if (segment_fd >= 0) flock(segment_fd, LOCK_EX);
+    if (segment->magic != RATELIMIT_MAGIC) {
+        memset(segment, 0, sizeof(*segment));
+        segment->magic = RATELIMIT_MAGIC;
+    }
+    if (segment_fd >= 0) {
+        long long now = now_ms();
+        for (int i = 0; i < RATELIMIT_BUCKETS; i++) {
+            Bucket *b = &segment->buckets[i];
+            if (!bucket_valid(b, now)) memset(b, 0, sizeof(*b));
+        }
+    }
+}
+
+static void segment_unlock(void) {
+    if (segment_fd >= 0) flock(segment_fd, LOCK_UN);
+    pthread_mutex_unlock(&segment_mutex);
+}
+
+/*
+ * Owner-only by default, one segment per user. CORTEX_RATELIMIT_GROUP
+ * shares it with a group (mode 0660) so a team on one key shares its
+ * pace. A segment with other permissions or owner is not used.
+ */
+static int segment_trusted(int fd, int shared, gid_t gid) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (st.st_mode & S_IRWXO)) return 0;
+    if (shared) return st.st_gid == gid;
+    return st.st_uid == geteuid() && !(st.st_mode & S_IRWXG);
+}
+
+void ai_ratelimit_init(void) {
+    char *name = getenv("CORTEX_RATELIMIT_SHM");
+    char *group = getenv("CORTEX_RATELIMIT_GROUP");
+    char fallback[64];
+    int shared = group && *group;
+    gid_t gid = 0;
+
+    if (segment_fd >= 0 || (name && strcmp(name, "off") == 0)) return;
+    if (shared) {
+        struct group *gr = getgrnam(group);
+        if (!gr) return;
+        gid = gr->gr_gid;
+    }
+    if (!name || !*name) {
+        if (shared) {
+            snprintf(fallback, sizeof(fallback), "%s-g%u", RATELIMIT_SHM_NAME, (unsigned)gid);
+        } else {
+            snprintf(fallback, sizeof(fallback), "%s-%u", RATELIMIT_SHM_NAME, (unsigned)geteuid());
+        }
+        name = fallback;
+    }
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+        if (shared && (fchown(fd, (uid_t)-1, gid) != 0 || fchmod(fd, 0660) != 0)) {
+            close(fd);
+            shm_unlink(name);
+            return;
+        }
+    } else {
+        fd = shm_open(name, O_RDWR, 0);
+    }
+    if (fd < 0) return;
+    if (!segment_trusted(fd, shared, gid)) {
+        close(fd);
+        return;
+    }
+
+    /* Growing an existing segment is harmless; shrinking never happens */
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        ((size_t)st.st_size < sizeof(Segment) && ftruncate(fd, sizeof(Segment)) != 0)) {
+        close(fd);
+        return;
+    }
+    void *map = mmap(NULL, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return;
+    }
+    segment = map;
+    segment_fd = fd;
+}
+
+void ai_ratelimit_cleanup(void) {
+    if (segment_fd < 0) return;
+    munmap(segment, sizeof(Segment));
+    close(segment_fd);
+    segment = &local_segment;
+    segment_fd = -1;
+}
+
+/* Caller holds the lock */
+static Bucket *find_bucket(unsigned long long key) {
+    for (int i = 0; i < RATELIMIT_BUCKETS; i++) {
+        if (segment->buckets[i].key == key) return &segment->buckets[i];
+    }
+    return NULL;
+}
+
+static Bucket *get_bucket(AIBackendType backend, unsigned long long key, long long now) {
+    Bucket *bucket = find_bucket(key);
+    if (bucket) return bucket;
+
+    /* A free slot, else the one idle longest */
+    bucket = &segment->buckets[0];
+    for (int i = 0; i < RATELIMIT_BUCKETS; i++) {
+        Bucket *b = &segment->buckets[i];
+        if (b->key == 0) {
+            bucket = b;
+            break;
+        }
+        if (b->last_used_ms < bucket->last_used_ms) bucket = b;
+    }
+    memset(bucket, 0, sizeof(*bucket));
+    bucket->key = key;
+    bucket->backend = backend;
+    bucket->updated_ms = now;
+    return bucket;
+}
+
+static void refill(Bucket *b, long long now) {
+    if (b->rate > 0 && now > b->updated_ms) {
+        b->tokens += b->rate * (double)(now - b->updated_ms) / 1000.0;
+        if (b->tokens > b->capacity) b->tokens = b->capacity;
+    }
+    b->updated_ms = now;
+}
+
+int ai_ratelimit_acquire(unsigned long long key, long max_wait_ms, long *wait_ms) {
+    long long now = now_ms();
+    *wait_ms = 0;
+    if (key == 0) return 1;
+
+    segment_lock();
+    Bucket *b = find_bucket(key);
+    if (!b) {
+        segment_unlock();
+        return 1;
+    }
+    refill(b, now);
+
+    /* Queue behind earlier reservations: the slot is free once tokens return to 0 */
+    long long need = b->blocked_until_ms > now ? b->blocked_until_ms - now : 0;
+    if (b->rate > 0 && b->tokens < 1.0) {
+        long long queued = (long long)((1.0 - b->tokens) / b->rate * 1000.0);
+        if (queued > need) need = queued;
+    }
+    *wait_ms = (long)need;
+    if (need > max_wait_ms) {
+        segment_unlock();
+        return 0;
+    }
+    if (b->rate > 0) b->tokens -= 1.0;
+    b->last_used_ms = now;
+    segment_unlock();
+    return 1;
+}
+
+void ai_ratelimit_observe(AIBackendType backend, unsigned long long key,
+                          long http_code, const AIRateHeaders *h) {
+    long long now = now_ms();
+    int limited = http_code == 429;
+    if (key == 0) return;
+    if (!limited && h->limit < 0 && h->remaining < 0) return;
+
+    segment_lock();
+    Bucket *b = get_bucket(backend, key, now);
+    refill(b, now);
+    b->last_used_ms = now;
+
+    /* Limits are per minute; the whole minute may be used as a burst */
+    if (h->limit > 0) {
+        if (b->rate == 0) b->tokens = (double)h->limit;
+        b->capacity = (double)h->limit;
+        b->rate = (double)h->limit / 60.0;
+    }
+    /* The provider's count is authoritative: it includes use of the key elsewhere */
+    if (h->remaining >= 0 && !limited) {
+        b->tokens = (double)h->remaining;
+    }
+
+    long long block = 0;
+    if (limited) {
+        b->limited++;
+        if (h->retry_after_ms >= 0) {
+            block = h->retry_after_ms;
+        } else if (h->reset_ms > 0) {
+            block = h->reset_ms;
+        } else {
+            /* No hint: back off exponentially, together with every other process */
+            block = RATELIMIT_BACKOFF_MS << (b->backoff_step < 6 ? b->backoff_step : 6);
+            if (block > RATELIMIT_BACKOFF_MAX_MS) block = RATELIMIT_BACKOFF_MAX_MS;
+        }
+        b->backoff_step++;
+        if (b->tokens > 0) b->tokens = 0;
+    } else {
+        b->backoff_step = 0;
+        if (h->remaining == 0 && h->reset_ms > 0) block = h->reset_ms;
+    }
+    if (block > RATELIMIT_BLOCK_MAX_MS) block = RATELIMIT_BLOCK_MAX_MS;
+    if (block > 0 && now + block > b->blocked_until_ms) b->blocked_until_ms = now + block;
+    segment_unlock();
+}
+
+int ai_ratelimit_get_stats(AIRateStats *stats, int max) {
+    long long now = now_ms();
+    int count = 0;
+
+    segment_lock();
+    for (int i = 0; i < RATELIMIT_BUCKETS && count < max; i++) {
+        Bucket *b = &segment->buckets[i];
+        if (b->key == 0) continue;
+        refill(b, now);
+        stats[count].backend = (AIBackendType)b->backend;
+        stats[count].tokens = b->tokens;
+        stats[count].per_minute = b->rate * 60.0;
+        stats[count].blocked_ms = b->blocked_until_ms > now ? (long)(b->blocked_until_ms - now) : 0;
+        stats[count].limited = b->limited;
+        count++;
+    }
+    segment_unlock();
+    return count;
+}
+
+void ai_rate_headers_init(AIRateHeaders *h) {
+    h->limit = -1;
+    h->remaining = -1;
+    h->reset_ms = -1;
+    h->retry_after_ms = -1;
+}
+
+/* "1h2m3.5s", "120ms", "20" (seconds); -1 if unreadable */
+static long parse_duration_ms(const char *s) {
+    double total = 0.0;
+    int parts = 0;
+
+    while (*s && !isspace((unsigned char)*s)) {
+        char *end;
+        double n = strtod(s, &end);
+        if (end == s) return -1;
+        s = end;
+        if (strncmp(s, "ms", 2) == 0) {
+            s += 2;
+        } else if (*s == 'h') {
+            n *= 3600000.0;
+            s++;
+        } else if (*s == 'm') {
+            n *= 60000.0;
+            s++;
+        } else {
+            n *= 1000.0;
+            if (*s == 's') s++;
+        }
+        total += n;
+        parts++;
+    }
+    return parts ? (long)total : -1;
+}
+
+/* RFC 3339 UTC time ("2024-05-01T12:00:30Z") as ms from now */
+static long parse_reset_time_ms(const char *s) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (sscanf(s, "%d-%d-%dT%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+               &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6) {
+        return -1;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    double ms = difftime(timegm(&tm), time(NULL)) * 1000.0;
+    return ms > 0 ? (long)ms : 0;
+}
+
+static long parse_count(const char *s) {
+    char *end;
+    long n = strtol(s, &end, 10);
+    return end == s || n < 0 ? -1 : n;
+}
+
+void ai_rate_headers_parse(AIRateHeaders *h, const char *line, size_t len) {
+    char buf[256];
+    if (len >= sizeof(buf)) return;
+    memcpy(buf, line, len);
+    buf[len] = '\0';
+
+    char *colon = strchr(buf, ':');
+    if (!colon) return;
+    *colon = '\0';
+    char *value = colon + 1;
+    while (isspace((unsigned char)*value)) value++;
+
+    /* OpenAI and DeepSeek: x-ratelimit-*-requests; Anthropic: anthropic-ratelimit-requests-* */
+    if (strcasecmp(buf, "retry-after") == 0) {
+        long seconds = parse_count(value);
+        if (seconds >= 0) h->retry_after_ms = seconds * 1000;
+    } else if (strcasecmp(buf, "retry-after-ms") == 0) {
+        h->retry_after_ms = parse_count(value);
+    } else if (strcasecmp(buf, "x-ratelimit-limit-requests") == 0 ||
+               strcasecmp(buf, "anthropic-ratelimit-requests-limit") == 0) {
+        h->limit = parse_count(value);
+    } else if (strcasecmp(buf, "x-ratelimit-remaining-requests") == 0 ||
+               strcasecmp(buf, "anthropic-ratelimit-requests-remaining") == 0) {
+        h->remaining = parse_count(value);
+    } else if (strcasecmp(buf, "x-ratelimit-reset-requests") == 0) {
+        h->reset_ms = parse_duration_ms(value);
+    } else if (strcasecmp(buf, "anthropic-ratelimit-requests-reset") == 0) {
+        h->reset_ms = parse_reset_time_ms(value);
+    }
+}
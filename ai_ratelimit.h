@@ -0,0 +1,51 @@
+#ifndef AI_RATELIMIT_H
+#define AI_RATELIMIT_H
+
+#include "ai_backend.h"
+
+/* Rate-limit information from one response's headers; -1 = not sent */
+typedef struct {
+    long limit;             /* Requests allowed per minute */
+    long remaining;         /* Requests left in the current window */
+    long reset_ms;          /* Until the window refills */
+    long retry_after_ms;    /* Retry-After on a 429 */
+} AIRateHeaders;
+
+/* Snapshot of one bucket, for 'ai detect' */
+typedef struct {
+    AIBackendType backend;
+    double tokens;          /* Negative while requests are queued */
+    double per_minute;      /* 0 until a limit header was seen */
+    long blocked_ms;        /* Time left of a Retry-After or exhausted window */
+    long limited;           /* 429 answers seen, by any process */
+} AIRateStats;
+
+/*
+ * Token buckets per backend and API key, kept in a shared memory segment
+ * (CORTEX_RATELIMIT_SHM, default /cortexcli-ratelimit-<uid>; "off" keeps
+ * them in this process) so every dynamo of the user paces one key
+ * together. CORTEX_RATELIMIT_GROUP shares the segment with a group.
+ * Keys are stored only as hashes.
+ */
+void ai_ratelimit_init(void);
+void ai_ratelimit_cleanup(void);
+
+void ai_rate_headers_init(AIRateHeaders *h);
+/* Feed one raw header line; unrelated headers are ignored */
+void ai_rate_headers_parse(AIRateHeaders *h, const char *line, size_t len);
+
+/*
+ * Take a request slot. Returns 1 and the time to wait before sending
+ * (the slot is reserved), or 0 and the time needed if that exceeds
+ * max_wait_ms (nothing reserved). Unknown keys are never held back.
+ */
+int ai_ratelimit_acquire(unsigned long long key, long max_wait_ms, long *wait_ms);
+
+/* Learn from a response: limit headers, and 429s with their backoff */
+void ai_ratelimit_observe(AIBackendType backend, unsigned long long key,
+                          long http_code, const AIRateHeaders *h);
+
+/* Buckets of this host, up to max; returns the count */
+int ai_ratelimit_get_stats(AIRateStats *stats, int max);
+
+#endif /* AI_RATELIMIT_H */
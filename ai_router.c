@@ -0,0 +1,312 @@
+#include "ai_router.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ROUTER_MAX_ENTRIES 48
+#define ROUTER_ALPHA 0.2                /* EWMA weight of the newest sample */
+
+/* Latency histogram: bucket i ends at 50 ms * 1.25^i (about 5 minutes at the top) */
+#define ROUTER_BUCKETS 40
+#define ROUTER_BUCKET_BASE_MS 50.0
+#define ROUTER_BUCKET_GROWTH 1.25
+#define ROUTER_MIN_SAMPLES 5
+#define ROUTER_DECAY_SAMPLES 256        /* Halve the histogram past this, so it follows the day */
+
+/* Time lost when a query fails before the fallback answers */
+#define ROUTER_FAILURE_COST_MS 10000.0
+/* A failure rate counts half after this long without requests, so bad pairs get retried */
+#define ROUTER_ERROR_HALF_LIFE 3600.0
+
+typedef struct {
+    AIRouteStats s;
+    unsigned int hist[ROUTER_BUCKETS];
+    unsigned int samples;
+    time_t last_used;
+} RouteEntry;
+
+static RouteEntry entries[ROUTER_MAX_ENTRIES];
+static int entry_count = 0;
+static int dirty = 0;
+static char router_path[512] = {0};
+static pthread_mutex_t router_lock = PTHREAD_MUTEX_INITIALIZER;   /* Guards entries */
+
+static RouteEntry *find_entry(AIBackendType backend, const char *model) {
+    for (int i = 0; i < entry_count; i++) {
+        if (entries[i].s.backend == backend && strcmp(entries[i].s.model, model) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+/* Find or add an entry, replacing the least recently used one when full */
+static RouteEntry *get_entry(AIBackendType backend, const char *model) {
+    RouteEntry *entry = find_entry(backend, model);
+    if (entry) return entry;
+
+    if (entry_count < ROUTER_MAX_ENTRIES) {
+        entry = &entries[entry_count++];
+    } else {
+        entry = &entries[0];
+        for (int i = 1; i < entry_count; i++) {
+            if (entries[i].last_used < entry->last_used) entry = &entries[i];
+        }
+    }
+    memset(entry, 0, sizeof(*entry));
+    entry->s.backend = backend;
+    snprintf(entry->s.model, sizeof(entry->s.model), "%s", model);
+    return entry;
+}
+
+static int bucket_for(long ms) {
+    double bound = ROUTER_BUCKET_BASE_MS;
+    int i = 0;
+    while (i < ROUTER_BUCKETS - 1 && ms > bound) {
+        bound *= ROUTER_BUCKET_GROWTH;
+        i++;
+    }
+    return i;
+}
+
+static long bucket_bound(int bucket) {
+    double bound = ROUTER_BUCKET_BASE_MS;
+    for (int i = 0; i < bucket; i++) bound *= ROUTER_BUCKET_GROWTH;
+    return (long)bound;
+}
+
+static long entry_percentile(const RouteEntry *entry, int pct) {
+    if (entry->samples < ROUTER_MIN_SAMPLES) return -1;
+
+    unsigned int want = (entry->samples * (unsigned int)pct + 99) / 100;
+    unsigned int seen = 0;
+    for (int i = 0; i < ROUTER_BUCKETS; i++) {
+        seen += entry->hist[i];
+        if (seen >= want && seen > 0) return bucket_bound(i);
+    }
+    return bucket_bound(ROUTER_BUCKETS - 1);
+}
+
+static double ewma(double current, double sample, int first) {
+    return first ? sample : current + ROUTER_ALPHA * (sample - current);
+}
+
+/* Add an answer time; older samples fade by halving */
+static void hist_add(RouteEntry *entry, long total_ms) {
+    entry->hist[bucket_for(total_ms)]++;
+    if (++entry->samples > ROUTER_DECAY_SAMPLES) {
+        entry->samples = 0;
+        for (int i = 0; i < ROUTER_BUCKETS; i++) {
+            entry->hist[i] /= 2;
+            entry->samples += entry->hist[i];
+        }
+    }
+}
+
+void ai_router_record(AIBackendType backend, const char *model,
+                      long ttfb_ms, long total_ms, AIRouteOutcome outcome) {
+    if (!model) model = "";
+    pthread_mutex_lock(&router_lock);
+    RouteEntry *entry = get_entry(backend, model);
+    int first = entry->s.requests == 0;
+
+    entry->s.requests++;
+    entry->last_used = time(NULL);
+    entry->s.ewma_error = ewma(entry->s.ewma_error, outcome == ROUTE_OK ? 0.0 : 1.0, first);
+    if (outcome != ROUTE_OK) {
+        entry->s.errors++;
+        /*
+         * A timed-out answer would have taken at least this long. Counting
+         * that in the percentiles lets the timeouts derived from them grow
+         * for a model that has become slower.
+         */
+        if (outcome == ROUTE_TIMEOUT) {
+            entry->s.timeouts++;
+            hist_add(entry, total_ms);
+        }
+        dirty = 1;
+        pthread_mutex_unlock(&router_lock);
+        return;
+    }
+
+    /* Latency only from answers; an error's time says nothing about speed */
+    int first_ok = entry->s.requests - entry->s.errors == 1;
+    entry->s.ewma_ttfb_ms = ewma(entry->s.ewma_ttfb_ms, (double)ttfb_ms, first_ok);
+    entry->s.ewma_total_ms = ewma(entry->s.ewma_total_ms, (double)total_ms, first_ok);
+    hist_add(entry, total_ms);
+    dirty = 1;
+    pthread_mutex_unlock(&router_lock);
+}
+
+double ai_router_expected_ms(AIBackendType backend, const char *model) {
+    double expected = 0.0;
+
+    pthread_mutex_lock(&router_lock);
+    RouteEntry *entry = find_entry(backend, model ? model : "");
+    if (entry && entry->s.requests > 0) {
+        double idle = difftime(time(NULL), entry->last_used);
+        double error = entry->s.ewma_error;
+        if (idle > 0) error /= 1.0 + idle / ROUTER_ERROR_HALF_LIFE;
+
+        /* Never answered: all that is known is the failures */
+        double latency = entry->samples > 0 ? entry->s.ewma_total_ms : 0.0;
+        expected = latency + error * ROUTER_FAILURE_COST_MS;
+    }
+    pthread_mutex_unlock(&router_lock);
+    return expected;
+}
+
+long ai_router_percentile(AIBackendType backend, const char *model, int pct) {
+    pthread_mutex_lock(&router_lock);
+    RouteEntry *entry = find_entry(backend, model ? model : "");
+    long ms = entry ? entry_percentile(entry, pct) : -1;
+    pthread_mutex_unlock(&router_lock);
+    return ms;
+}
+
+static int compare_requests(const void *a, const void *b) {
+    long x = ((const AIRouteStats *)a)->requests, y = ((const AIRouteStats *)b)->requests;
+    return (y > x) - (y < x);
+}
+
+int ai_router_get_stats(AIRouteStats *stats, int max) {
+    int count = 0;
+    pthread_mutex_lock(&router_lock);
+    for (int i = 0; i < entry_count && count < max; i++) {
+        stats[count] = entries[i].s;
+        stats[count].p50_ms = entry_percentile(&entries[i], 50);
+        stats[count].p95_ms = entry_percentile(&entries[i], 95);
+        count++;
+    }
+    pthread_mutex_unlock(&router_lock);
+    qsort(stats, count, sizeof(AIRouteStats), compare_requests);
+    return count;
+}
+
+static int backend_from_name(const char *name) {
+    for (int i = 0; i < AI_BACKEND_COUNT; i++) {
+        if (strcasecmp(ai_get_backend_name((AIBackendType)i), name) == 0) return i;
+    }
+    return -1;
+}
+
+/* One entry per line: backend model counters EWMAs last-used histogram */
+static void load_file(void) {
+    FILE *fp = fopen(router_path, "r");
+    if (!fp) return;
+
+    char line[1024];
+    while (fgets(line, sizeof(line), fp) && entry_count < ROUTER_MAX_ENTRIES) {
+        if (line[0] == '#') continue;
+
+        char name[32], model[96];
+        long long last_used;
+        RouteEntry e;
+        int used = 0;
+        memset(&e, 0, sizeof(e));
+        if (sscanf(line, "%31s %95s %ld %ld %ld %lf %lf %lf %lld%n", name, model,
+                   &e.s.requests, &e.s.errors, &e.s.timeouts, &e.s.ewma_ttfb_ms,
+                   &e.s.ewma_total_ms, &e.s.ewma_error, &last_used, &used) != 9) {
+            continue;
+        }
+        int backend = backend_from_name(name);
+        if (backend < 0) continue;
+
+        char *p = line + used;
+        for (int i = 0; i < ROUTER_BUCKETS; i++) {
+            char *end;
+            e.hist[i] = (unsigned int)strtoul(p, &end, 10);
+            if (end == p) break;
+            e.samples += e.hist[i];
+            p = end;
+        }
+        e.s.backend = (AIBackendType)backend;
+        snprintf(e.s.model, sizeof(e.s.model), "%s", strcmp(model, "-") == 0 ? "" : model);
+        e.last_used = (time_t)last_used;
+        entries[entry_count++] = e;
+    }
+    fclose(fp);
+}
+
+void ai_router_init(void) {
+    char *custom = getenv("CORTEX_ROUTER_FILE");
+    char *xdg = getenv("XDG_CACHE_HOME");
+    char *home = getenv("HOME");
+    if (custom && *custom) {
+        snprintf(router_path, sizeof(router_path), "%s", custom);
+    } else if (xdg && *xdg) {
+        snprintf(router_path, sizeof(router_path), "%s/cortexcli/router", xdg);
+    } else if (home) {
+        snprintf(router_path, sizeof(router_path), "%s/.cache/cortexcli/router", home);
+    }
+
+    entry_count = 0;
+    dirty = 0;
+    if (router_path[0]) load_file();
+}
+
+/* Create the directory holding the file (and its parent) */
+static void make_router_dir(void) {
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%s", router_path);
+    char *slash = strrchr(dir, '/');
+    if (!slash || slash == dir) return;
+    *slash = '\0';
+
+    char *parent = strrchr(dir, '/');
+    if (parent && parent != dir) {
+        *parent = '\0';
+        mkdir(dir, 0700);
+        *parent = '/';
+    }
+    mkdir(dir, 0700);
+}
+
+void ai_router_save(void) {
+    if (!router_path[0]) return;
+    pthread_mutex_lock(&router_lock);
+    if (!dirty) {
+        pthread_mutex_unlock(&router_lock);
+        return;
+    }
+    make_router_dir();
+
+    /* Write a temporary file and rename it, so readers never see half a file */
+    char tmp[600];
+    snprintf(tmp, sizeof(tmp), "%s.%d", router_path, (int)getpid());
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) {
+        pthread_mutex_unlock(&router_lock);
+        return;
+    }
+
+    fprintf(fp, "# CortexCLI routing statistics\n");
+    for (int i = 0; i < entry_count; i++) {
+        RouteEntry *e = &entries[i];
+        fprintf(fp, "%s %s %ld %ld %ld %.1f %.1f %.4f %lld",
+                ai_get_backend_name(e->s.backend), e->s.model[0] ? e->s.model : "-",
+                e->s.requests, e->s.errors, e->s.timeouts, e->s.ewma_ttfb_ms,
+                e->s.ewma_total_ms, e->s.ewma_error, (long long)e->last_used);
+        for (int b = 0; b < ROUTER_BUCKETS; b++) fprintf(fp, " %u", e->hist[b]);
+        fputc('\n', fp);
+    }
+
+    if (fclose(fp) == 0 && rename(tmp, router_path) == 0) {
+        dirty = 0;
+    } else {
+        unlink(tmp);
+    }
+    pthread_mutex_unlock(&router_lock);
+}
+
+void ai_router_cleanup(void) {
+    ai_router_save();
+    pthread_mutex_lock(&router_lock);
+    entry_count = 0;
+    pthread_mutex_unlock(&router_lock);
+}
@@ -0,0 +1,49 @@
+#ifndef AI_ROUTER_H
+#define AI_ROUTER_H
+
+#include "ai_backend.h"
+
+/* How a request ended */
+typedef enum {
+    ROUTE_OK = 0,
+    ROUTE_ERROR,
+    ROUTE_TIMEOUT
+} AIRouteOutcome;
+
+/* Latency and reliability of one backend/model pair */
+typedef struct {
+    AIBackendType backend;
+    char model[96];
+    long requests;
+    long errors;            /* Includes timeouts */
+    long timeouts;
+    double ewma_ttfb_ms;    /* Time to first byte */
+    double ewma_total_ms;
+    double ewma_error;      /* Recent failure rate, 0..1 */
+    long p50_ms;            /* Total time percentiles, -1 without samples */
+    long p95_ms;
+} AIRouteStats;
+
+/* Load statistics from ~/.cache/cortexcli/router (CORTEX_ROUTER_FILE) */
+void ai_router_init(void);
+/* Save them for the next session */
+void ai_router_save(void);
+void ai_router_cleanup(void);
+
+void ai_router_record(AIBackendType backend, const char *model,
+                      long ttfb_ms, long total_ms, AIRouteOutcome outcome);
+
+/*
+ * Expected wait for a query in ms: recent total latency plus the time a
+ * failure costs, weighted by the recent error rate. 0 if never tried, so
+ * new pairs get explored once.
+ */
+double ai_router_expected_ms(AIBackendType backend, const char *model);
+
+/* Total time percentile in ms, or -1 with too few samples */
+long ai_router_percentile(AIBackendType backend, const char *model, int pct);
+
+/* Copy up to max entries, most used first; returns the count */
+int ai_router_get_stats(AIRouteStats *stats, int max);
+
+#endif /* AI_ROUTER_H */
@@ -0,0 +1,682 @@
+#include "ai_semcache.h"
+#include "ai_cache.h"
+#include "shell.h"
+#include <stdint.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SEM_X86 1
+#endif
+
+#define SEM_MAGIC 0x31455343u           /* "CSE1" */
+#define SEM_DEFAULT_CAPACITY 10000
+#define SEM_MAX_CAPACITY 1000000
+#define SEM_DEFAULT_THRESHOLD 0.90f
+#define SEM_DEFAULT_TTL (24 * 60 * 60)
+#define SEM_DEFAULT_MODEL "nomic-embed-text"
+#define SEM_MAX_DIM 8192
+#define SEM_SKETCH_WORDS 4              /* 256 sign bits per entry */
+#define SEM_SKETCH_BITS (SEM_SKETCH_WORDS * 64)
+#define SEM_RERANK 32                   /* Sketch-nearest entries compared exactly */
+
+/* Index file: header, sketch rows, entry metadata, then the vectors */
+typedef struct {
+    uint32_t magic;
+    uint32_t dim;
+    uint32_t capacity;
+    uint32_t count;         /* Rows filled so far, up to capacity */
+    uint32_t next;          /* Row the next store replaces */
+    uint32_t reserved;
+    uint64_t model;         /* Hash of the embedding model name */
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stores;
+} SemHeader;
+
+/* Read for every entry on every lookup, so only the task and the sketch */
+typedef struct {
+    uint64_t tag;           /* TaskType + 1, 0 = empty */
+    uint64_t sketch[SEM_SKETCH_WORDS];
+} SemRow;
+
+typedef struct {
+    int64_t created;
+    uint64_t key;           /* Names the value file */
+} SemMeta;
+
+static int sem_enabled = 0;
+static float sem_threshold = SEM_DEFAULT_THRESHOLD;
+static long sem_ttl = SEM_DEFAULT_TTL;
+static uint32_t sem_capacity = SEM_DEFAULT_CAPACITY;
+static char sem_model[128] = SEM_DEFAULT_MODEL;
+static int sem_fd = -1;
+static unsigned char *sem_map = NULL;
+static size_t sem_map_size = 0;
+static long last_search_us = -1;
+
+/* Embedding of the last prompt looked up, reused when its answer is stored */
+static char *last_text = NULL;
+static float *last_vec = NULL;
+static int last_dim = 0;
+
+/* Fixed random hyperplanes the sketches are taken against, per dimension */
+static float *planes = NULL;
+static int planes_dim = 0;
+
+static float dot_scalar(const float *a, const float *b, int n);
+static int scan_generic(const SemRow *rows, uint32_t count, uint64_t tag, const uint64_t *sketch,
+                        uint32_t *best, int max);
+static float (*dot)(const float *, const float *, int) = dot_scalar;
+static int (*scan)(const SemRow *, uint32_t, uint64_t, const uint64_t *, uint32_t *, int) = scan_generic;
+static const char *kernel_name = "scalar";
+
+/* Four running sums so the loop is not one long dependency chain */
+static float dot_scalar(const float *a, const float *b, int n) {
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; i++) s0 += a[i] * b[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+/* Hamming distances to every sketch of a task, keeping the max nearest rows */
+static inline __attribute__((always_inline))
+int scan_body(const SemRow *rows, uint32_t count, uint64_t tag, const uint64_t *sketch,
+              uint32_t *best, int max) {
+    int dist[SEM_RERANK];
+    int found = 0;
+
+    for (uint32_t r = 0; r < count; r++) {
+        if (rows[r].tag != tag) continue;
+        int d = __builtin_popcountll(rows[r].sketch[0] ^ sketch[0]) +
+                __builtin_popcountll(rows[r].sketch[1] ^ sketch[1]) +
+                __builtin_popcountll(rows[r].sketch[2] ^ sketch[2]) +
+                __builtin_popcountll(rows[r].sketch[3] ^ sketch[3]);
+        if (found == max && d >= dist[found - 1]) continue;
+
+        /* Insertion into the short sorted list */
+        int pos = found < max ? found++ : found - 1;
+        while (pos > 0 && dist[pos - 1] > d) {
+            dist[pos] = dist[pos - 1];
+            best[pos] = best[pos - 1];
+            pos--;
+        }
+        dist[pos] = d;
+        best[pos] = r;
+    }
+    return found;
+}
+
+static int scan_generic(const SemRow *rows, uint32_t count, uint64_t tag, const uint64_t *sketch,
+                        uint32_t *best, int max) {
+    return scan_body(rows, count, tag, sketch, best, max);
+}
+
+#ifdef SEM_X86
+__attribute__((target("avx2,fma")))
+static float dot_avx2(const float *a, const float *b, int n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    acc0 = _mm256_add_ps(acc0, acc1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+    sum = _mm_hadd_ps(sum, sum);
+    sum = _mm_hadd_ps(sum, sum);
+
+    float total = _mm_cvtss_f32(sum);
+    for (; i < n; i++) total += a[i] * b[i];
+    return total;
+}
+
+/* Same scan with the popcnt instruction instead of a bit-twiddling routine */
+__attribute__((target("popcnt")))
+static int scan_popcnt(const SemRow *rows, uint32_t count, uint64_t tag, const uint64_t *sketch,
+                       uint32_t *best, int max) {
+    return scan_body(rows, count, tag, sketch, best, max);
+}
+#endif
+
+void ai_semcache_init(void) {
+    char *enabled = getenv("CORTEX_SEMCACHE");
+    sem_enabled = enabled && strcmp(enabled, "1") == 0;
+
+    char *threshold = getenv("CORTEX_SEMCACHE_THRESHOLD");
+    if (threshold) {
+        float value = strtof(threshold, NULL);
+        if (value > 0.0f && value <= 1.0f) sem_threshold = value;
+    }
+    char *max = getenv("CORTEX_SEMCACHE_MAX");
+    if (max && atol(max) > 0) {
+        sem_capacity = atol(max) < SEM_MAX_CAPACITY ? (uint32_t)atol(max) : SEM_MAX_CAPACITY;
+    }
+    char *model = getenv("CORTEX_EMBED_MODEL");
+    if (model && *model) snprintf(sem_model, sizeof(sem_model), "%s", model);
+
+    /* Entries live as long as the response cache's */
+    char *ttl = getenv("CORTEX_CACHE_TTL");
+    if (ttl && atol(ttl) > 0) sem_ttl = atol(ttl);
+
+#ifdef SEM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        dot = dot_avx2;
+        kernel_name = "AVX2";
+    }
+    if (__builtin_cpu_supports("popcnt")) scan = scan_popcnt;
+#endif
+}
+
+void ai_semcache_cleanup(void) {
+    if (sem_map) {
+        munmap(sem_map, sem_map_size);
+        sem_map = NULL;
+        sem_map_size = 0;
+    }
+    if (sem_fd >= 0) {
+        close(sem_fd);
+        sem_fd = -1;
+    }
+    free(last_text);
+    free(last_vec);
+    free(planes);
+    last_text = NULL;
+    last_vec = NULL;
+    planes = NULL;
+    planes_dim = 0;
+}
+
+static uint64_t hash_string(const char *s) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; s && *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 0x100000001b3ULL;
+    }
+    return h ? h : 1;
+}
+
+/* Byte offsets of each part of an index with this shape; returns the file size */
+static size_t sem_layout(uint32_t capacity, uint32_t dim, size_t *rows, size_t *meta, size_t *vecs) {
+    *rows = (sizeof(SemHeader) + 63) & ~(size_t)63;
+    *meta = *rows + (size_t)capacity * sizeof(SemRow);
+    *vecs = (*meta + (size_t)capacity * sizeof(SemMeta) + 63) & ~(size_t)63;
+    return *vecs + (size_t)capacity * dim * sizeof(float);
+}
+
+static SemHeader *sem_header(void) {
+    return (SemHeader *)sem_map;
+}
+
+static SemRow *sem_rows(void) {
+    size_t rows, meta, vecs;
+    sem_layout(sem_header()->capacity, sem_header()->dim, &rows, &meta, &vecs);
+    return (SemRow *)(sem_map + rows);
+}
+
+static SemMeta *sem_meta(void) {
+    size_t rows, meta, vecs;
+    sem_layout(sem_header()->capacity, sem_header()->dim, &rows, &meta, &vecs);
+    return (SemMeta *)(sem_map + meta);
+}
+
+static float *sem_vector(uint32_t row) {
+    size_t rows, meta, vecs;
+    sem_layout(sem_header()->capacity, sem_header()->dim, &rows, &meta, &vecs);
+    return (float *)(sem_map + vecs) + (size_t)row * sem_header()->dim;
+}
+
+static void value_path(uint64_t key, char *path, size_t size) {
+    snprintf(path, size, "%s/sem-%016llx", ai_cache_dir(), (unsigned long long)key);
+}
+
+/* Open the index file and take its lock; 0 if there is no cache directory */
+static int sem_lock(int operation) {
+    if (sem_fd < 0) {
+        if (!ai_cache_dir()[0]) return 0;
+        char path[600];
+        snprintf(path, sizeof(path), "%s/semantic", ai_cache_dir());
+        sem_fd = open(path, O_RDWR | O_CREAT, 0600);
+        if (sem_fd < 0) return 0;
+    }
+    flock(sem_fd, operation);
+    return 1;
+}
+
+static void sem_unlock(void) {
+    flock(sem_fd, LOCK_UN);
+}
+
+/*
+ * Map the index as it is on disk now (lock held); another session may
+ * have created or reset it since. Returns 1 if it holds a valid index.
+ */
+static int sem_remap(void) {
+    struct stat st;
+    if (fstat(sem_fd, &st) != 0) return 0;
+
+    if (sem_map && sem_map_size != (size_t)st.st_size) {
+        munmap(sem_map, sem_map_size);
+        sem_map = NULL;
+        sem_map_size = 0;
+    }
+    if (!sem_map && (size_t)st.st_size >= sizeof(SemHeader)) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, sem_fd, 0);
+        if (map == MAP_FAILED) return 0;
+        sem_map = map;
+        sem_map_size = (size_t)st.st_size;
+    }
+    if (!sem_map) return 0;
+
+    SemHeader *h = sem_header();
+    size_t rows, meta, vecs;
+    return h->magic == SEM_MAGIC && h->dim > 0 && h->dim <= SEM_MAX_DIM &&
+           h->capacity > 0 && h->capacity <= SEM_MAX_CAPACITY && h->count <= h->capacity &&
+           h->next < h->capacity && sem_layout(h->capacity, h->dim, &rows, &meta, &vecs) == sem_map_size;
+}
+
+/* Start an empty index for vectors of dim (exclusive lock held) */
+static int sem_create(uint32_t dim) {
+    if (sem_remap()) {
+        /* Answers of the index being replaced go with it */
+        SemRow *rows = sem_rows();
+        SemMeta *meta = sem_meta();
+        for (uint32_t r = 0; r < sem_header()->count; r++) {
+            char path[600];
+            if (!rows[r].tag) continue;
+            value_path(meta[r].key, path, sizeof(path));
+            unlink(path);
+        }
+    }
+    if (sem_map) {
+        munmap(sem_map, sem_map_size);
+        sem_map = NULL;
+        sem_map_size = 0;
+    }
+
+    size_t rows, meta, vecs;
+    size_t size = sem_layout(sem_capacity, dim, &rows, &meta, &vecs);
+    if (ftruncate(sem_fd, 0) != 0 || ftruncate(sem_fd, (off_t)size) != 0) return 0;
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, sem_fd, 0);
+    if (map == MAP_FAILED) return 0;
+    sem_map = map;
+    sem_map_size = size;
+
+    SemHeader *h = sem_header();
+    h->magic = SEM_MAGIC;
+    h->dim = dim;
+    h->capacity = sem_capacity;
+    h->model = hash_string(sem_model);
+    return 1;
+}
+
+/* Deterministic, so every session sketches the same way */
+static int sem_planes(int dim) {
+    if (planes && planes_dim == dim) return 1;
+
+    free(planes);
+    planes = malloc((size_t)SEM_SKETCH_BITS * dim * sizeof(float));
+    planes_dim = planes ? dim : 0;
+    if (!planes) return 0;
+
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    for (size_t i = 0; i < (size_t)SEM_SKETCH_BITS * dim; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        planes[i] = (state >> 63) ? 1.0f : -1.0f;
+    }
+    return 1;
+}
+
+/* Which side of each hyperplane vec lies on; close vectors share most bits */
+static void sem_sketch(const float *vec, int dim, uint64_t *sketch) {
+    memset(sketch, 0, SEM_SKETCH_WORDS * sizeof(uint64_t));
+    for (int b = 0; b < SEM_SKETCH_BITS; b++) {
+        if (dot(planes + (size_t)b * dim, vec, dim) >= 0.0f) {
+            sketch[b / 64] |= 1ULL << (b % 64);
+        }
+    }
+}
+
+/* Unit length, so cosine similarity is a dot product */
+static int sem_normalize(float *vec, int dim) {
+    float norm = dot(vec, vec, dim);
+    if (norm <= 0.0f) return 0;
+
+    /* Newton steps from a rough estimate; avoids pulling in libm */
+    float x = norm, r = 1.0f;
+    while (x > 4.0f) { x /= 4.0f; r /= 2.0f; }
+    while (x < 0.25f) { x *= 4.0f; r *= 2.0f; }
+    r *= 1.0f / (0.5f + 0.5f * x);
+    for (int i = 0; i < 4; i++) r = r * (1.5f - 0.5f * norm * r * r);
+
+    for (int i = 0; i < dim; i++) vec[i] *= r;
+    return 1;
+}
+
+/* Embedding of a normalized prompt, kept for the store that may follow */
+static const float *sem_embed(const char *norm, int *dim) {
+    if (last_text && strcmp(last_text, norm) == 0) {
+        *dim = last_dim;
+        return last_vec;
+    }
+
+    free(last_text);
+    free(last_vec);
+    last_text = NULL;
+    last_vec = ai_ollama_embed(sem_model, norm, &last_dim);
+
+    if (last_vec && (last_dim > SEM_MAX_DIM || !sem_normalize(last_vec, last_dim) || !sem_planes(last_dim))) {
+        free(last_vec);
+        last_vec = NULL;
+    }
+    if (!last_vec) {
+        if (ai_ollama_check_available()) {
+            /* Ollama is up, so the model is missing or cannot embed */
+            char note[320];
+            snprintf(note, sizeof(note),
+                     "Semantic cache off: no embeddings from %s (try 'ollama pull %s')\n",
+                     sem_model, sem_model);
+            _puts(COLOR_YELLOW);
+            _puts(note);
+            _puts(COLOR_RESET);
+            sem_enabled = 0;
+        }
+        return NULL;
+    }
+    last_text = strdup(norm);
+    *dim = last_dim;
+    return last_vec;
+}
+
+/*
+ * Words naming something specific (sizes, ports, paths, file names) have
+ * to match: "files over 10MB" and "files over 100MB" embed almost alike.
+ */
+static const char *next_literal(const char *s, size_t *len) {
+    while (*s) {
+        while (*s == ' ') s++;
+        size_t n = strcspn(s, " ");
+        for (size_t i = 0; i < n; i++) {
+            if (isdigit((unsigned char)s[i]) || strchr("./_~'\"", s[i])) {
+                *len = n;
+                return s;
+            }
+        }
+        s += n;
+    }
+    return NULL;
+}
+
+static int same_literals(const char *a, const char *b) {
+    size_t la = 0, lb = 0;
+    for (;;) {
+        a = next_literal(a, &la);
+        b = next_literal(b, &lb);
+        if (!a || !b) return !a && !b;
+        if (la != lb || memcmp(a, b, la) != 0) return 0;
+        a += la;
+        b += lb;
+    }
+}
+
+/* Value file: the normalized prompt, a newline, the answer */
+static char *read_value(uint64_t key, const char *norm) {
+    char path[600];
+    value_path(key, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    char *data = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = malloc((size_t)st.st_size + 1);
+        if (data && read(fd, data, (size_t)st.st_size) == (ssize_t)st.st_size) {
+            data[st.st_size] = '\0';
+        } else {
+            free(data);
+            data = NULL;
+        }
+    }
+    close(fd);
+
+    char *newline = data ? strchr(data, '\n') : NULL;
+    if (!newline) {
+        free(data);
+        return NULL;
+    }
+    *newline = '\0';
+    if (!same_literals(data, norm)) {
+        free(data);
+        return NULL;
+    }
+    char *content = strdup(newline + 1);
+    free(data);
+    return content;
+}
+
+static long elapsed_us(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000L + (now.tv_nsec - start->tv_nsec) / 1000L;
+}
+
+/*
+ * Best entry of task for vec above the threshold (shared lock held):
+ * sketch distances pick SEM_RERANK candidates, exact cosine decides.
+ */
+static char *sem_search(TaskType task, const char *norm, const float *vec, float *score) {
+    SemHeader *h = sem_header();
+    uint64_t sketch[SEM_SKETCH_WORDS];
+    uint32_t best[SEM_RERANK];
+    float sim[SEM_RERANK];
+
+    sem_sketch(vec, (int)h->dim, sketch);
+    int found = scan(sem_rows(), h->count, (uint64_t)task + 1, sketch, best, SEM_RERANK);
+
+    SemMeta *meta = sem_meta();
+    time_t now = time(NULL);
+    for (int i = 0; i < found; i++) {
+        sim[i] = now - meta[best[i]].created > sem_ttl ? -1.0f :
+                 dot(vec, sem_vector(best[i]), (int)h->dim);
+    }
+
+    /* Most similar first; one whose literals differ is passed over */
+    for (;;) {
+        int top = -1;
+        for (int i = 0; i < found; i++) {
+            if (sim[i] >= sem_threshold && (top < 0 || sim[i] > sim[top])) top = i;
+        }
+        if (top < 0) return NULL;
+
+        char *content = read_value(meta[best[top]].key, norm);
+        if (content) {
+            *score = sim[top];
+            return content;
+        }
+        sim[top] = -1.0f;
+    }
+}
+
+char *ai_semcache_lookup(TaskType task, const char *prompt, float *score) {
+    if (!sem_enabled || !prompt) return NULL;
+
+    char *norm = ai_cache_normalize(prompt);
+    int dim = 0;
+    const float *vec = norm ? sem_embed(norm, &dim) : NULL;
+    if (!vec || !sem_lock(LOCK_SH)) {
+        free(norm);
+        return NULL;
+    }
+
+    char *content = NULL;
+    if (sem_remap() && sem_header()->dim == (uint32_t)dim && sem_header()->model == hash_string(sem_model)) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        content = sem_search(task, norm, vec, score);
+        last_search_us = elapsed_us(&start);
+        __atomic_add_fetch(content ? &sem_header()->hits : &sem_header()->misses, 1, __ATOMIC_RELAXED);
+    }
+    sem_unlock();
+    free(norm);
+    return content;
+}
+
+void ai_semcache_store(TaskType task, const char *prompt, const char *content) {
+    if (!sem_enabled || !prompt || !content || !*content) return;
+
+    char *norm = ai_cache_normalize(prompt);
+    int dim = 0;
+    const float *vec = norm ? sem_embed(norm, &dim) : NULL;
+    if (!vec || !sem_lock(LOCK_EX)) {
+        free(norm);
+        return;
+    }
+
+    /* A new embedding model or dimension starts a new index */
+    if (!sem_remap() || sem_header()->dim != (uint32_t)dim || sem_header()->model != hash_string(sem_model)) {
+        if (!sem_create((uint32_t)dim)) {
+            sem_unlock();
+            free(norm);
+            return;
+        }
+    }
+
+    SemHeader *h = sem_header();
+    uint32_t row = h->next;
+    SemRow *rows = sem_rows();
+    SemMeta *meta = sem_meta();
+    char path[600], tmp_path[640];
+
+    /* The oldest entry makes way once the index is full */
+    if (rows[row].tag) {
+        value_path(meta[row].key, path, sizeof(path));
+        unlink(path);
+        rows[row].tag = 0;
+    }
+
+    uint64_t key = hash_string(norm) ^ ((uint64_t)task << 56) ^ (uint64_t)time(NULL);
+    value_path(key, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    int ok = fd >= 0;
+    if (ok) {
+        size_t norm_len = strlen(norm), len = strlen(content);
+        ok = write(fd, norm, norm_len) == (ssize_t)norm_len && write(fd, "\n", 1) == 1 &&
+             write(fd, content, len) == (ssize_t)len;
+        close(fd);
+    }
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        sem_unlock();
+        free(norm);
+        return;
+    }
+
+    memcpy(sem_vector(row), vec, (size_t)dim * sizeof(float));
+    sem_sketch(vec, dim, rows[row].sketch);
+    meta[row].created = time(NULL);
+    meta[row].key = key;
+    rows[row].tag = (uint64_t)task + 1;
+    h->next = (row + 1) % h->capacity;
+    if (h->count < h->capacity && row == h->count) h->count++;
+    h->stores++;
+
+    sem_unlock();
+    free(norm);
+}
+
+void ai_semcache_set_enabled(int enabled) {
+    sem_enabled = enabled;
+}
+
+int ai_semcache_is_enabled(void) {
+    return sem_enabled;
+}
+
+void ai_semcache_clear(void) {
+    if (!sem_lock(LOCK_EX)) return;
+
+    if (sem_remap()) {
+        SemHeader *h = sem_header();
+        SemRow *rows = sem_rows();
+        SemMeta *meta = sem_meta();
+        for (uint32_t r = 0; r < h->count; r++) {
+            char path[600];
+            if (!rows[r].tag) continue;
+            value_path(meta[r].key, path, sizeof(path));
+            unlink(path);
+            rows[r].tag = 0;
+        }
+        h->count = 0;
+        h->next = 0;
+    }
+    sem_unlock();
+}
+
+void ai_semcache_get_stats(AISemCacheStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->capacity = (int)sem_capacity;
+    stats->last_search_us = last_search_us;
+    if (!sem_lock(LOCK_SH)) return;
+
+    if (sem_remap()) {
+        SemHeader *h = sem_header();
+        SemRow *rows = sem_rows();
+        for (uint32_t r = 0; r < h->count; r++) {
+            if (rows[r].tag) stats->entries++;
+        }
+        stats->capacity = (int)h->capacity;
+        stats->dim = (int)h->dim;
+        stats->hits = h->hits;
+        stats->misses = h->misses;
+        stats->stores = h->stores;
+    }
+    sem_unlock();
+}
+
+void ai_semcache_show_stats(void) {
+    AISemCacheStats stats;
+    char line[256];
+
+    ai_semcache_get_stats(&stats);
+
+    _puts("\n");
+    _puts(COLOR_CYAN);
+    _puts("Semantic Cache:\n");
+    _puts(COLOR_RESET);
+    _puts("───────────────────────────\n");
+    _puts("Status:    ");
+    _puts(sem_enabled ? COLOR_GREEN "on" : COLOR_YELLOW "off");
+    _puts(COLOR_RESET);
+    snprintf(line, sizeof(line), " (%s, similarity >= %.2f)\n", sem_model, sem_threshold);
+    _puts(line);
+
+    snprintf(line, sizeof(line), "Entries:   %d of %d (%d dimensions)\n",
+             stats.entries, stats.capacity, stats.dim);
+    _puts(line);
+    unsigned long long lookups = stats.hits + stats.misses;
+    snprintf(line, sizeof(line), "Hits:      %llu / %llu lookups (%.0f%%), stores: %llu\n",
+             stats.hits, lookups, lookups ? 100.0 * stats.hits / lookups : 0.0, stats.stores);
+    _puts(line);
+    if (stats.last_search_us >= 0) {
+        snprintf(line, sizeof(line), "Search:    %.2f ms last lookup (%s kernels)\n",
+                 stats.last_search_us / 1000.0, kernel_name);
+        _puts(line);
+    }
+}
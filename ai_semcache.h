@@ -0,0 +1,44 @@
+#ifndef AI_SEMCACHE_H
+#define AI_SEMCACHE_H
+
+#include "ai_backend.h"
+
+/*
+ * Semantic response cache: a question worded differently from one
+ * answered before ("show big files" / "list files larger than 100MB")
+ * gets the earlier answer when their embeddings are similar enough.
+ * Prompts are embedded by an Ollama embedding model (CORTEX_EMBED_MODEL)
+ * and kept in a memory-mapped index beside the response cache, shared by
+ * every session. Each entry has a 256-bit sign sketch of its vector; a
+ * lookup scans the sketches of its task type and compares the nearest
+ * few vectors exactly. Off unless CORTEX_SEMCACHE=1.
+ */
+typedef struct {
+    int entries;
+    int capacity;
+    int dim;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long stores;
+    long last_search_us;        /* Index search of the last lookup, -1 if none */
+} AISemCacheStats;
+
+void ai_semcache_init(void);
+void ai_semcache_cleanup(void);
+
+/*
+ * Cached answer to a question like prompt, asked for the same task type
+ * (caller frees), or NULL. The similarity of the match goes to score.
+ */
+char *ai_semcache_lookup(TaskType task, const char *prompt, float *score);
+
+/* Remember an answer; reuses the embedding of the last lookup of prompt */
+void ai_semcache_store(TaskType task, const char *prompt, const char *content);
+
+void ai_semcache_set_enabled(int enabled);
+int ai_semcache_is_enabled(void);
+void ai_semcache_clear(void);
+void ai_semcache_get_stats(AISemCacheStats *stats);
+void ai_semcache_show_stats(void);
+
+#endif /* AI_SEMCACHE_H */
@@ -0,0 +1,212 @@
+/*
+ * Non-streamed response bodies: the incremental extractor against the
+ * jansson path it replaced (buffer the whole body, json_loads, strdup the
+ * answer). Canned 10/50/100 KB bodies in each backend's shape are fed in
+ * 16 KB writes, as CURL delivers them. Reports time and heap allocations
+ * per body, after checking that both paths extract the same text.
+ *
+ * make bench    (allocations are counted by wrapping glibc's malloc)
+ */
+#include "json_extract.h"
+#include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define WRITE_SIZE 16384        /* CURL_MAX_WRITE_SIZE */
+#define TARGET_MS 200.0         /* Run each case about this long */
+
+/* Every heap call of the process, jansson and libc included */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static long allocs;
+
+void *malloc(size_t size) {
+    allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    allocs++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+typedef struct {
+    const char *name;
+    const char *const *path;
+    int path_len;
+    const char *head;           /* Body up to the answer string's opening quote */
+    const char *tail;           /* From its closing quote */
+} BodyShape;
+
+static const char *const gemini_path[] = {"candidates", "0", "content", "parts", "0", "text"};
+static const char *const openai_path[] = {"choices", "0", "message", "content"};
+static const char *const claude_path[] = {"content", "0", "text"};
+static const char *const ollama_path[] = {"message", "content"};
+
+static const BodyShape shapes[] = {
+    {"gemini", gemini_path, 6,
+     "{\"candidates\":[{\"content\":{\"parts\":[{\"text\":\"",
+     "\"}],\"role\":\"model\"},\"finishReason\":\"STOP\",\"index\":0,\"safetyRatings\":["
+     "{\"category\":\"HARM_CATEGORY_DANGEROUS_CONTENT\",\"probability\":\"NEGLIGIBLE\"}]}],"
+     "\"usageMetadata\":{\"promptTokenCount\":412,\"candidatesTokenCount\":2048,\"totalTokenCount\":2460},"
+     "\"modelVersion\":\"gemini-2.0-flash\"}"},
+    {"openai", openai_path, 4,
+     "{\"id\":\"chatcmpl-9x1\",\"object\":\"chat.completion\",\"created\":1718000000,"
+     "\"model\":\"gpt-4o-mini\",\"choices\":[{\"index\":0,\"message\":{\"role\":\"assistant\",\"content\":\"",
+     "\",\"refusal\":null},\"logprobs\":null,\"finish_reason\":\"stop\"}],"
+     "\"usage\":{\"prompt_tokens\":412,\"completion_tokens\":2048,\"total_tokens\":2460},"
+     "\"system_fingerprint\":\"fp_0ba0d124f1\"}"},
+    {"claude", claude_path, 3,
+     "{\"id\":\"msg_01\",\"type\":\"message\",\"role\":\"assistant\",\"model\":\"claude-3-5-haiku\","
+     "\"content\":[{\"type\":\"text\",\"text\":\"",
+     "\"}],\"stop_reason\":\"end_turn\",\"stop_sequence\":null,"
+     "\"usage\":{\"input_tokens\":412,\"output_tokens\":2048}}"},
+    {"ollama", ollama_path, 2,
+     "{\"model\":\"llama3.2\",\"created_at\":\"2024-06-10T12:00:00Z\","
+     "\"message\":{\"role\":\"assistant\",\"content\":\"",
+     "\"},\"done_reason\":\"stop\",\"done\":true,\"total_duration\":5191566416,"
+     "\"load_duration\":2154458,\"prompt_eval_count\":412,\"eval_count\":2048,"
+     "\"eval_duration\":4799921000}"},
+};
+
+/* Answer text as JSON string content: commands, escapes and non-ASCII */
+static const char answer_line[] =
+    "COMMAND: find . -name \\\"*.log\\\" -mtime +7 -exec gzip {} \\\\;\\n"
+    "EXPLAIN: Compresses logs older than a week \\u2014 caf\\u00e9 \\ud83d\\ude80\\tdone\\n";
+
+static char *make_body(const BodyShape *shape, size_t size) {
+    size_t head = strlen(shape->head), tail = strlen(shape->tail);
+    size_t line = sizeof(answer_line) - 1;
+    char *body = malloc(size + line + tail + 1);
+    if (!body) return NULL;
+
+    memcpy(body, shape->head, head);
+    size_t len = head;
+    while (len + tail < size) {
+        memcpy(body + len, answer_line, line);
+        len += line;
+    }
+    memcpy(body + len, shape->tail, tail);
+    len += tail;
+    body[len] = '\0';
+    return body;
+}
+
+/* The replaced path: grow a buffer per write, parse it all, copy the answer */
+static char *via_jansson(const BodyShape *shape, const char *body, size_t len) {
+    char *buf = NULL;
+    size_t used = 0;
+    for (size_t i = 0; i < len; i += WRITE_SIZE) {
+        size_t n = len - i < WRITE_SIZE ? len - i : WRITE_SIZE;
+        char *grown = realloc(buf, used + n + 1);
+        if (!grown) break;
+        buf = grown;
+        memcpy(buf + used, body + i, n);
+        used += n;
+        buf[used] = '\0';
+    }
+
+    char *text = NULL;
+    json_error_t error;
+    json_t *root = buf ? json_loads(buf, 0, &error) : NULL;
+    json_t *value = root;
+    for (int i = 0; i < shape->path_len && value; i++) {
+        value = json_is_array(value) ? json_array_get(value, (size_t)atoi(shape->path[i])) :
+                json_object_get(value, shape->path[i]);
+    }
+    if (value && json_is_string(value)) text = strdup(json_string_value(value));
+    json_decref(root);
+    free(buf);
+    return text;
+}
+
+static char *via_extract(const BodyShape *shape, const char *body, size_t len, size_t step) {
+    JsonExtractor x;
+    json_extract_init(&x, shape->path, shape->path_len);
+    for (size_t i = 0; i < len; i += step) {
+        json_extract_feed(&x, body + i, len - i < step ? len - i : step);
+    }
+    char *text = json_extract_ok(&x) ? json_extract_take(&x) : NULL;
+    json_extract_free(&x);
+    return text;
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+typedef struct {
+    double ms;
+    double allocs;
+} Cost;
+
+/* Repeat one path until TARGET_MS has passed; per-body averages */
+static Cost measure(int extractor, const BodyShape *shape, const char *body, size_t len) {
+    Cost cost;
+    long runs = 0;
+    long start_allocs = allocs;
+    double start = now_ms(), elapsed;
+
+    do {
+        char *text = extractor ? via_extract(shape, body, len, WRITE_SIZE) : via_jansson(shape, body, len);
+        free(text);
+        runs++;
+        elapsed = now_ms() - start;
+    } while (elapsed < TARGET_MS);
+
+    cost.ms = elapsed / runs;
+    cost.allocs = (double)(allocs - start_allocs) / runs;
+    return cost;
+}
+
+int main(void) {
+    static const size_t sizes[] = {10 * 1024, 50 * 1024, 100 * 1024};
+    int failed = 0;
+
+    printf("%-7s %7s  %20s  %20s  %7s\n", "backend", "body", "jansson path", "extractor", "speedup");
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        const BodyShape *shape = &shapes[s];
+        for (size_t z = 0; z < sizeof(sizes) / sizeof(sizes[0]); z++) {
+            char *body = make_body(shape, sizes[z]);
+            if (!body) return 1;
+            size_t len = strlen(body);
+
+            /* Same text from both, whatever the write boundaries */
+            char *expected = via_jansson(shape, body, len);
+            static const size_t steps[] = {1, 7, 4096, WRITE_SIZE};
+            for (size_t k = 0; k < sizeof(steps) / sizeof(steps[0]); k++) {
+                char *text = via_extract(shape, body, len, steps[k]);
+                if (!expected || !text || strcmp(expected, text) != 0) {
+                    printf("%s %zu KB: extractor and jansson differ (%zu-byte writes)\n",
+                           shape->name, len / 1024, steps[k]);
+                    failed = 1;
+                }
+                free(text);
+            }
+            free(expected);
+
+            Cost old = measure(0, shape, body, len);
+            Cost new = measure(1, shape, body, len);
+            printf("%-7s %4zu KB  %8.3f ms %5.0f allocs  %8.3f ms %5.0f allocs  %6.1fx\n",
+                   shape->name, len / 1024, old.ms, old.allocs, new.ms, new.allocs, old.ms / new.ms);
+            free(body);
+        }
+    }
+    return failed;
+}
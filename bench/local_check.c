@@ -0,0 +1,150 @@
+/*
+ * The in-process GGUF backend end to end on a real model: text streamed
+ * as it is generated, a query cut off at its deadline (and the next one
+ * still answered), and the prompt prefix reused across turns. Built
+ * together with ai_local.c so the cached prefix can be dropped to time a
+ * cold turn against a warm one.
+ *
+ * make local-check LLAMA_MODEL=path/to/model.gguf
+ */
+#include "../ai_local.c"
+
+#define CHECK_SYSTEM_REPEAT 24          /* Long enough that prefilling it dominates */
+
+static const char system_line[] =
+    "You are a Linux shell assistant. Reply with COMMAND: and one shell command, "
+    "then EXPLAIN: and one sentence. Never suggest commands that delete data. ";
+
+typedef struct {
+    int calls;
+    size_t len;
+    char *text;
+} Streamed;
+
+static void on_text(const char *text, size_t len, void *userdata) {
+    Streamed *s = (Streamed *)userdata;
+    if (!text) return;
+    char *grown = realloc(s->text, s->len + len + 1);
+    if (!grown) return;
+    memcpy(grown + s->len, text, len);
+    s->len += len;
+    grown[s->len] = '\0';
+    s->text = grown;
+    s->calls++;
+}
+
+static void response_free(AIResponse *response) {
+    if (!response) return;
+    free(response->content);
+    free(response->error_message);
+    free(response);
+}
+
+typedef struct {
+    AIResponse *response;
+    Streamed streamed;
+    long first_ms;
+    long total_ms;
+} Run;
+
+static Run run_query(const char *path, const char *prompt, const AIConversation *conv, long timeout_ms) {
+    Run run;
+    memset(&run, 0, sizeof(run));
+    long start = local_now_ms();
+    run.response = ai_local_query(path, prompt, conv, on_text, &run.streamed, timeout_ms, &run.first_ms);
+    run.total_ms = local_now_ms() - start;
+    return run;
+}
+
+static void run_free(Run *run) {
+    response_free(run->response);
+    free(run->streamed.text);
+}
+
+/* Prompt tokens of the next turn already held in the context */
+static int cached_prefix(const char *prompt, const AIConversation *conv) {
+    int count = 0, keep = 0;
+    char *chat = render_chat(prompt, conv);
+    llama_token *tokens = chat ? tokenize(chat, &count) : NULL;
+    while (tokens && keep < cached_count && keep < count - 1 && cached[keep] == tokens[keep]) keep++;
+    free(tokens);
+    free(chat);
+    return keep;
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : getenv("CORTEX_LOCAL_MODEL");
+    int failed = 0;
+
+    if (!path || !path[0]) {
+        printf("usage: %s model.gguf (or set CORTEX_LOCAL_MODEL)\n", argv[0]);
+        return 2;
+    }
+    ai_local_init();
+
+    size_t line = sizeof(system_line) - 1;
+    char *system = malloc(line * CHECK_SYSTEM_REPEAT + 1);
+    if (!system) return 1;
+    for (int i = 0; i < CHECK_SYSTEM_REPEAT; i++) memcpy(system + i * line, system_line, line);
+    system[line * CHECK_SYSTEM_REPEAT] = '\0';
+    AIConversation first = {system, NULL, 0};
+
+    /* Streaming: several pieces, the first well before the end, adding up to the answer */
+    Run cold = run_query(path, "list the five largest files here", &first, 600000);
+    int streamed = cold.response && cold.response->success && cold.streamed.calls > 1 &&
+                   cold.streamed.text && strcmp(cold.streamed.text, cold.response->content) == 0;
+    printf("streaming     %s  %d pieces, first after %ld ms of %ld ms\n", streamed ? "ok  " : "FAIL",
+           cold.streamed.calls, cold.first_ms, cold.total_ms);
+    if (!streamed) {
+        printf("              %s\n", cold.response && cold.response->error_message ?
+               cold.response->error_message : "answer and streamed text differ");
+        failed = 1;
+    }
+
+    /* Prefix reuse: the second turn starts with the first one, which the context still holds */
+    AITurn turn = {"list the five largest files here", cold.response && cold.response->content ?
+                   cold.response->content : "", 0};
+    turn.assistant_len = strlen(turn.assistant);
+    AIConversation second = {system, &turn, 1};
+    const char *follow_up = "now only those changed today";
+    int prompt_count = 0;
+    char *chat = render_chat(follow_up, &second);
+    free(chat ? tokenize(chat, &prompt_count) : NULL);
+    free(chat);
+
+    int reused = cached_prefix(follow_up, &second);
+    Run warm = run_query(path, follow_up, &second, 600000);
+    cached_count = 0;
+    Run again = run_query(path, follow_up, &second, 600000);
+    int reuse_ok = warm.response && warm.response->success && again.response && again.response->success &&
+                   reused > prompt_count / 2 && warm.first_ms < again.first_ms;
+    printf("prefix reuse  %s  %d of %d prompt tokens kept; first token %ld ms warm, %ld ms cold\n",
+           reuse_ok ? "ok  " : "FAIL", reused, prompt_count, warm.first_ms, again.first_ms);
+    failed |= !reuse_ok;
+
+    /* Cancellation: a deadline a third of the way into generation stops it promptly */
+    long generating = cold.total_ms - cold.first_ms;
+    long deadline = cold.first_ms + generating / 3 + 1;
+    cached_count = 0;
+    Run cut = run_query(path, "list the five largest files here", &first, deadline);
+    int timed_out = cut.response && !cut.response->success && cut.response->error_message &&
+                    strstr(cut.response->error_message, "timed out");
+    long late = cut.total_ms - deadline;
+    Run after = run_query(path, "list the five largest files here", &first, 600000);
+    int cancel_ok = timed_out && late < 250 + generating / (cold.streamed.calls + 1) * 2 &&
+                    after.response && after.response->success;
+    printf("cancellation  %s  deadline %ld ms, returned after %ld ms with \"%s\"; next query %s\n",
+           cancel_ok ? "ok  " : "FAIL", deadline, cut.total_ms,
+           cut.response && cut.response->error_message ? cut.response->error_message : "an answer",
+           after.response && after.response->success ? "answered" : "failed");
+    failed |= !cancel_ok;
+
+    run_free(&cold);
+    run_free(&warm);
+    run_free(&again);
+    run_free(&cut);
+    run_free(&after);
+    free(system);
+    ai_local_cleanup();
+    return failed;
+}
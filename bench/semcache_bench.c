@@ -0,0 +1,267 @@
+/*
+ * Semantic cache lookups on a large index. Built together with
+ * ai_semcache.c so its kernels and search can be driven directly; the
+ * embedding model and cache directory are replaced by stand-ins.
+ *
+ * First checks that the SIMD kernels agree with the portable ones (dot
+ * products within rounding, identical sketch scans), then fills an index
+ * of nomic-embed-text sized vectors and times lookups with each kernel
+ * pair. A lookup is what 'ai cache' reports as the search time: sketch
+ * the query, scan every row of its task, compare the nearest exactly.
+ *
+ * make bench
+ */
+#include "../ai_semcache.c"
+
+#define BENCH_DIM 768                   /* nomic-embed-text */
+#define BENCH_LOOKUPS 200
+#define BENCH_TASKS 4                   /* Entries are spread over this many task types */
+
+static char bench_dir[64];
+
+const char *ai_cache_dir(void) {
+    return bench_dir;
+}
+
+char *ai_cache_normalize(const char *prompt) {
+    return strdup(prompt);
+}
+
+float *ai_ollama_embed(const char *model, const char *text, int *dim) {
+    (void)model;
+    (void)text;
+    *dim = 0;
+    return NULL;
+}
+
+int ai_ollama_check_available(void) {
+    return 0;
+}
+
+void _puts(const char *str) {
+    fputs(str, stdout);
+}
+
+static uint64_t rng = 0x2545f4914f6cdd1dULL;
+
+static uint64_t next_random(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+/* Uniform in [-1, 1) */
+static float frand(void) {
+    return (float)((next_random() >> 40) & 0xffffff) / 8388608.0f - 1.0f;
+}
+
+static void random_unit(float *vec, int dim) {
+    for (int i = 0; i < dim; i++) vec[i] = frand();
+    sem_normalize(vec, dim);
+}
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int check_kernels(void) {
+    static const int dims[] = {1, 7, 8, 15, 16, 17, 33, 384, 768, 1024, 4096};
+    float a[4096], b[4096];
+    int failed = 0;
+
+#ifdef SEM_X86
+    __builtin_cpu_init();
+    int have_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    int have_popcnt = __builtin_cpu_supports("popcnt");
+#else
+    int have_avx2 = 0, have_popcnt = 0;
+#endif
+
+    for (size_t d = 0; d < sizeof(dims) / sizeof(dims[0]); d++) {
+        int n = dims[d];
+        for (int trial = 0; trial < 100; trial++) {
+            double exact = 0.0, magnitude = 0.0;
+            for (int i = 0; i < n; i++) {
+                a[i] = frand();
+                b[i] = frand();
+                exact += (double)a[i] * b[i];
+                magnitude += (double)(a[i] < 0 ? -a[i] : a[i]) * (b[i] < 0 ? -b[i] : b[i]);
+            }
+            /* Float sums in a different order: within a few ulps of the magnitudes involved */
+            double limit = 1e-6 * magnitude + 1e-7;
+            double err = dot_scalar(a, b, n) - exact;
+            if (err > limit || err < -limit) {
+                printf("dot_scalar off by %g at n=%d\n", err, n);
+                failed = 1;
+            }
+#ifdef SEM_X86
+            if (have_avx2) {
+                err = dot_avx2(a, b, n) - exact;
+                if (err > limit || err < -limit) {
+                    printf("dot_avx2 off by %g at n=%d\n", err, n);
+                    failed = 1;
+                }
+            }
+#endif
+        }
+    }
+
+    /* Sketch scans must pick the same rows in the same order */
+    enum { ROWS = 5000 };
+    static SemRow rows[ROWS];
+    for (int r = 0; r < ROWS; r++) {
+        rows[r].tag = 1 + r % BENCH_TASKS;
+        for (int w = 0; w < SEM_SKETCH_WORDS; w++) {
+            rows[r].sketch[w] = next_random();
+        }
+    }
+#ifdef SEM_X86
+    for (int q = 0; q < 50 && have_popcnt; q++) {
+        uint32_t best_a[SEM_RERANK], best_b[SEM_RERANK];
+        const uint64_t *sketch = rows[(q * 97) % ROWS].sketch;
+        uint64_t tag = 1 + q % BENCH_TASKS;
+        int found_a = scan_generic(rows, ROWS, tag, sketch, best_a, SEM_RERANK);
+        int found_b = scan_popcnt(rows, ROWS, tag, sketch, best_b, SEM_RERANK);
+        if (found_a != found_b || memcmp(best_a, best_b, sizeof(uint32_t) * found_a) != 0) {
+            printf("scan_popcnt and scan_generic disagree\n");
+            failed = 1;
+            break;
+        }
+    }
+#endif
+
+    printf("kernels: dot scalar%s, scan generic%s: %s\n",
+           have_avx2 ? " = AVX2" : " (no AVX2 here)", have_popcnt ? " = popcnt" : " (no popcnt here)",
+           failed ? "MISMATCH" : "agree");
+    return failed;
+}
+
+/* Fill an index of count entries (sketched with the current kernel); 0 on failure */
+static int fill_index(uint32_t count) {
+    sem_capacity = count;
+    if (!sem_lock(LOCK_EX) || !sem_create(BENCH_DIM)) return 0;
+    if (!sem_planes(BENCH_DIM)) return 0;
+
+    SemHeader *h = sem_header();
+    SemRow *rows = sem_rows();
+    SemMeta *meta = sem_meta();
+    time_t now = time(NULL);
+    for (uint32_t r = 0; r < count; r++) {
+        float *vec = sem_vector(r);
+        random_unit(vec, BENCH_DIM);
+        sem_sketch(vec, BENCH_DIM, rows[r].sketch);
+        rows[r].tag = 1 + r % BENCH_TASKS;
+        meta[r].created = now;
+        meta[r].key = 0x5eed0000ULL + r;
+    }
+    h->count = count;
+    h->next = 0;
+    sem_unlock();
+    return 1;
+}
+
+/* Value file for row, as ai_semcache_store writes it */
+static void write_value(uint32_t row, const char *norm) {
+    char path[600];
+    value_path(sem_meta()[row].key, path, sizeof(path));
+    FILE *fp = fopen(path, "w");
+    if (!fp) return;
+    fprintf(fp, "%s\nCOMMAND: echo %u\n", norm, row);
+    fclose(fp);
+}
+
+/* Time lookups of slightly reworded (perturbed) stored entries; counts hits */
+static int run_lookups(uint32_t count, const char *dot_name, const char *scan_name) {
+    static float query[BENCH_DIM];
+    double times[BENCH_LOOKUPS];
+    int hits = 0;
+
+    if (!sem_lock(LOCK_SH) || !sem_remap()) return -1;
+    for (int q = 0; q < BENCH_LOOKUPS; q++) {
+        uint32_t row = (uint32_t)(((uint64_t)q * 2654435761u) % count);
+        const float *stored = sem_vector(row);
+        for (int i = 0; i < BENCH_DIM; i++) query[i] = stored[i] + 0.01f * frand();
+        sem_normalize(query, BENCH_DIM);
+        write_value(row, "list big files");
+
+        float score = 0.0f;
+        double start = now_us();
+        char *content = sem_search((TaskType)(row % BENCH_TASKS), "list big files", query, &score);
+        times[q] = now_us() - start;
+
+        char expect[32];
+        snprintf(expect, sizeof(expect), "COMMAND: echo %u\n", row);
+        if (content && strcmp(content, expect) == 0) hits++;
+        free(content);
+    }
+    sem_unlock();
+
+    qsort(times, BENCH_LOOKUPS, sizeof(double), compare_double);
+    double sum = 0.0;
+    for (int q = 0; q < BENCH_LOOKUPS; q++) sum += times[q];
+    printf("%7u entries  %-6s %-7s  mean %7.1f us  p50 %7.1f us  p99 %7.1f us  found %d/%d\n",
+           count, dot_name, scan_name, sum / BENCH_LOOKUPS, times[BENCH_LOOKUPS / 2],
+           times[BENCH_LOOKUPS * 99 / 100], hits, BENCH_LOOKUPS);
+    return hits;
+}
+
+int main(void) {
+    static const uint32_t counts[] = {10000, 100000};
+    int failed = check_kernels();
+
+    snprintf(bench_dir, sizeof(bench_dir), "/tmp/cortex-semcache-bench.XXXXXX");
+    if (!mkdtemp(bench_dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(sem_model, sizeof(sem_model), "%s", SEM_DEFAULT_MODEL);
+    sem_threshold = SEM_DEFAULT_THRESHOLD;
+
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]) && !failed; c++) {
+#ifdef SEM_X86
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) dot = dot_avx2;
+#endif
+        if (!fill_index(counts[c])) {
+            printf("cannot create a %u entry index in %s\n", counts[c], bench_dir);
+            failed = 1;
+            break;
+        }
+        dot = dot_scalar;
+        scan = scan_generic;
+        failed |= run_lookups(counts[c], "scalar", "generic") < BENCH_LOOKUPS * 9 / 10;
+#ifdef SEM_X86
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+            __builtin_cpu_supports("popcnt")) {
+            dot = dot_avx2;
+            scan = scan_popcnt;
+            failed |= run_lookups(counts[c], "AVX2", "popcnt") < BENCH_LOOKUPS * 9 / 10;
+        }
+#endif
+    }
+
+    /* Drop the index and its value files */
+    if (sem_lock(LOCK_EX)) {
+        if (sem_remap()) {
+            for (uint32_t r = 0; r < sem_header()->count; r++) {
+                char path[600];
+                value_path(sem_meta()[r].key, path, sizeof(path));
+                unlink(path);
+            }
+        }
+        sem_unlock();
+    }
+    ai_semcache_cleanup();
+    char path[600];
+    snprintf(path, sizeof(path), "%s/semantic", bench_dir);
+    unlink(path);
+    rmdir(bench_dir);
+    return failed;
+}
@@ -1,4 +1,5 @@
 #include "shell.h"
+#include "ai_router.h"
 
 // Directory stack
 char *dir_stack[MAX_DIR_STACK];
@@ -82,6 +83,8 @@ void exitt(char **arv) {
         status = _atoi(arv[1]);
         status = status < 0 ? 2 : status;
     }
+    /* Leaves without the shell's cleanup, so keep the routing statistics here */
+    ai_router_save();
     exit(status);
 }
 void cd_dotdot(char **arv __attribute__ ((unused))) {
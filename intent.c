@@ -0,0 +1,563 @@
+#include "intent.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INTENT_MAX_TOKENS 24
+#define INTENT_MAX_SLOTS 8
+#define INTENT_SLOT_SIZE 128
+
+typedef enum {
+    SLOT_NONE = 0,
+    SLOT_SIZE,
+    SLOT_TIME,
+    SLOT_PORT,
+    SLOT_NUMBER,
+    SLOT_PATH,
+    SLOT_NAME
+} SlotType;
+
+static const char *slot_types[] = {"", "size", "time", "port", "number", "path", "name", NULL};
+
+/*
+ * Built-in templates. "a|b" is a choice of words, "[a]" an optional one.
+ * Commands are run by this shell directly, so they use no quotes or globs.
+ */
+typedef struct {
+    const char *pattern;
+    const char *command;
+    const char *explain;
+} IntentDef;
+
+static const IntentDef builtin_intents[] = {
+    {"[list|show|find] [all] [the] files larger|bigger than <size>",
+     "find . -type f -size +<size> -exec ls -lh {} +",
+     "Lists files under the current directory larger than <size>."},
+    {"[list|show|find] [all] [the] files larger|bigger than <size> in <path>",
+     "find <path> -type f -size +<size> -exec ls -lh {} +",
+     "Lists files under <path> larger than <size>."},
+    {"[list|show|find] [all] [the] files modified|changed [in] [the] [last] <time>",
+     "find . -type f -mtime -<time>",
+     "Lists files under the current directory modified in the last <time> day(s)."},
+    {"show|check [the] disk usage|space", "df -h",
+     "Shows used and free space on each mounted filesystem."},
+    {"disk usage|space", "df -h",
+     "Shows used and free space on each mounted filesystem."},
+    {"how much disk space [is] left|free", "df -h",
+     "Shows used and free space on each mounted filesystem."},
+    {"how big is <path>", "du -sh <path>", "Shows the total size of <path>."},
+    {"show|check [the] size of <path>", "du -sh <path>", "Shows the total size of <path>."},
+    {"disk usage of <path>", "du -sh <path>", "Shows the total size of <path>."},
+    {"kill [the] process [running|listening] on port <port>", "fuser -k <port>/tcp",
+     "Kills the process holding TCP port <port>."},
+    {"what|who is [running|listening] on port <port>", "ss -ltnp sport = :<port>",
+     "Shows the process listening on TCP port <port>."},
+    {"what|who is using port <port>", "ss -ltnp sport = :<port>",
+     "Shows the process listening on TCP port <port>."},
+    {"show|find [the] process [running|listening] on port <port>", "ss -ltnp sport = :<port>",
+     "Shows the process listening on TCP port <port>."},
+    {"show|list [all] [the] open|listening ports", "ss -tulpn",
+     "Lists listening TCP and UDP sockets with their processes."},
+    {"show|check [the] memory|ram usage", "free -h", "Shows used and free memory."},
+    {"how much memory|ram is free|used|left", "free -h", "Shows used and free memory."},
+    {"show|list [all] [the] [running] processes", "ps aux", "Lists all running processes."},
+    {"show|list [the] top <number> processes by memory|ram", "ps aux --sort=-%mem | head -n <number>",
+     "Lists the processes using the most memory."},
+    {"show|list [the] top <number> processes by cpu", "ps aux --sort=-%cpu | head -n <number>",
+     "Lists the processes using the most CPU."},
+    {"what is my ip [address]", "ip -brief address", "Shows the addresses of each network interface."},
+    {"show [my] [the] ip address|addresses", "ip -brief address",
+     "Shows the addresses of each network interface."},
+    {"list|show [all] [the] files [in] [the] [current] [directory]", "ls -la",
+     "Lists all files in the current directory."},
+    {"list|show [all] [the] files in <path>", "ls -la <path>", "Lists all files in <path>."},
+    {"find [a] [the] file|files named|called <name>", "find . -name <name>",
+     "Searches the current directory tree for <name>."},
+    {"count [the] lines in|of <path>", "wc -l <path>", "Counts the lines of <path>."},
+    {"show [the] last <number> lines of <path>", "tail -n <number> <path>",
+     "Shows the last <number> lines of <path>."},
+    {"search|grep for <name> in <path>", "grep -rn <name> <path>",
+     "Searches <path> for <name>, with file names and line numbers."},
+    {"show [the] uptime", "uptime", "Shows how long the system has been running, and its load."},
+    {"how long has the system been up|running", "uptime",
+     "Shows how long the system has been running, and its load."},
+    {"show|what is [the] kernel version", "uname -r", "Shows the running kernel version."},
+    {"where am i", "pwd", "Shows the current directory."},
+    {"show [the] current directory", "pwd", "Shows the current directory."},
+    {"who is logged in", "who", "Lists logged-in users."},
+    {"show|list [the] logged in users", "who", "Lists logged-in users."},
+    {"show|list [the] environment [variables]", "env", "Lists the environment variables."},
+};
+
+#define BUILTIN_COUNT (int)(sizeof(builtin_intents) / sizeof(builtin_intents[0]))
+
+/* Words in front of a request that do not change it */
+static const char *filler_phrases[] = {
+    "please", "can you", "could you", "would you", "how do i", "how can i",
+    "i want to", "i need to", NULL
+};
+
+/* Token trie: one edge per literal word or slot, shared between templates */
+typedef struct IntentNode {
+    char *word;                 /* Literal edge; NULL for a slot */
+    SlotType slot;
+    char slot_name[16];
+    int intent;                 /* Template completed here, -1 if none */
+    struct IntentNode *child;
+    struct IntentNode *next;
+} IntentNode;
+
+typedef struct {
+    char *pattern;
+    char *command;
+    char *explain;
+} Intent;
+
+typedef struct {
+    char name[16];
+    char value[INTENT_SLOT_SIZE];
+} SlotValue;
+
+static Intent *intents = NULL;
+static int intent_total = 0;
+static IntentNode root = {NULL, SLOT_NONE, "", -1, NULL, NULL};
+static int local_enabled = 1;
+static char intents_file[512] = {0};
+
+static IntentNode *get_child(IntentNode *node, const char *word, SlotType slot, const char *name) {
+    IntentNode **link = &node->child;
+    for (; *link; link = &(*link)->next) {
+        IntentNode *c = *link;
+        if (word && c->word && strcmp(c->word, word) == 0) return c;
+        if (!word && !c->word && c->slot == slot && strcmp(c->slot_name, name) == 0) return c;
+    }
+
+    IntentNode *child = calloc(1, sizeof(IntentNode));
+    if (!child) return NULL;
+    child->word = word ? strdup(word) : NULL;
+    child->slot = slot;
+    snprintf(child->slot_name, sizeof(child->slot_name), "%s", name ? name : "");
+    child->intent = -1;
+    *link = child;
+    return child;
+}
+
+/* "<path2>" -> SLOT_PATH named "path2"; SLOT_NONE if not a slot */
+static SlotType parse_slot(const char *token, char *name, size_t size) {
+    size_t len = strlen(token);
+    if (len < 3 || token[0] != '<' || token[len - 1] != '>') return SLOT_NONE;
+    snprintf(name, size, "%.*s", (int)(len - 2), token + 1);
+
+    size_t type_len = strcspn(name, "0123456789");
+    for (int i = 1; slot_types[i]; i++) {
+        if (strlen(slot_types[i]) == type_len && strncmp(name, slot_types[i], type_len) == 0) {
+            return (SlotType)i;
+        }
+    }
+    return SLOT_NONE;
+}
+
+/* Add one template, expanding choices and optional words into trie paths */
+static int insert_tokens(IntentNode *node, char **tokens, int count, int i, int intent) {
+    if (!node) return -1;
+    if (i == count) {
+        if (node->intent < 0) node->intent = intent;
+        return 0;
+    }
+
+    char name[16];
+    SlotType slot = parse_slot(tokens[i], name, sizeof(name));
+    if (slot != SLOT_NONE) {
+        return insert_tokens(get_child(node, NULL, slot, name), tokens, count, i + 1, intent);
+    }
+    if (tokens[i][0] == '<') return -1;
+
+    char words[128];
+    int optional = tokens[i][0] == '[';
+    size_t len = strlen(tokens[i]);
+    if (optional && (len < 3 || tokens[i][len - 1] != ']')) return -1;
+    snprintf(words, sizeof(words), "%.*s", (int)(optional ? len - 2 : len), tokens[i] + optional);
+
+    if (optional && insert_tokens(node, tokens, count, i + 1, intent) != 0) return -1;
+    char *saveptr;
+    for (char *word = strtok_r(words, "|", &saveptr); word; word = strtok_r(NULL, "|", &saveptr)) {
+        for (char *p = word; *p; p++) *p = (char)tolower((unsigned char)*p);
+        if (insert_tokens(get_child(node, word, SLOT_NONE, NULL), tokens, count, i + 1, intent) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int add_intent(const char *pattern, const char *command, const char *explain) {
+    char *copy = strdup(pattern);
+    char *tokens[INTENT_MAX_TOKENS];
+    int count = 0;
+    char *saveptr;
+    for (char *t = strtok_r(copy, " \t", &saveptr); t; t = strtok_r(NULL, " \t", &saveptr)) {
+        if (count == INTENT_MAX_TOKENS) {
+            free(copy);
+            return -1;
+        }
+        tokens[count++] = t;
+    }
+
+    Intent *grown = realloc(intents, sizeof(Intent) * (intent_total + 1));
+    if (!count || !grown) {
+        if (grown) intents = grown;
+        free(copy);
+        return -1;
+    }
+    intents = grown;
+    int result = insert_tokens(&root, tokens, count, 0, intent_total);
+    free(copy);
+    if (result != 0) return -1;
+
+    intents[intent_total].pattern = strdup(pattern);
+    intents[intent_total].command = strdup(command);
+    intents[intent_total].explain = explain ? strdup(explain) : NULL;
+    intent_total++;
+    return 0;
+}
+
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    size_t len = strlen(s);
+    while (len > 0 && isspace((unsigned char)s[len - 1])) s[--len] = '\0';
+    return s;
+}
+
+/* Site templates, one "template => command" per line */
+static void load_file(void) {
+    FILE *fp = fopen(intents_file, "r");
+    if (!fp) return;
+
+    char line[1024];
+    int number = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        number++;
+        char *text = trim(line);
+        if (!*text || *text == '#') continue;
+
+        char *arrow = strstr(text, "=>");
+        if (arrow) *arrow = '\0';
+        if (!arrow || !*trim(text) || !*trim(arrow + 2) ||
+            add_intent(trim(text), trim(arrow + 2), NULL) != 0) {
+            fprintf(stderr, "%s:%d: ignoring invalid line\n", intents_file, number);
+        }
+    }
+    fclose(fp);
+}
+
+void intent_init(void) {
+    char *custom = getenv("CORTEX_INTENTS_FILE");
+    char *xdg = getenv("XDG_CONFIG_HOME");
+    char *home = getenv("HOME");
+    if (custom && *custom) {
+        snprintf(intents_file, sizeof(intents_file), "%s", custom);
+    } else if (xdg && *xdg) {
+        snprintf(intents_file, sizeof(intents_file), "%s/cortexcli/intents", xdg);
+    } else if (home) {
+        snprintf(intents_file, sizeof(intents_file), "%s/.config/cortexcli/intents", home);
+    }
+
+    /* Site templates first: where two match, the lower index wins */
+    if (intents_file[0]) load_file();
+    for (int i = 0; i < BUILTIN_COUNT; i++) {
+        add_intent(builtin_intents[i].pattern, builtin_intents[i].command, builtin_intents[i].explain);
+    }
+}
+
+static void free_nodes(IntentNode *node) {
+    while (node) {
+        IntentNode *next = node->next;
+        free_nodes(node->child);
+        free(node->word);
+        free(node);
+        node = next;
+    }
+}
+
+void intent_cleanup(void) {
+    free_nodes(root.child);
+    root.child = NULL;
+    root.intent = -1;
+    for (int i = 0; i < intent_total; i++) {
+        free(intents[i].pattern);
+        free(intents[i].command);
+        free(intents[i].explain);
+    }
+    free(intents);
+    intents = NULL;
+    intent_total = 0;
+}
+
+/* Slot text must not carry anything this shell would act on */
+static int safe_value(const char *s, int allow_glob) {
+    if (*s == '-') return 0;
+    for (; *s; s++) {
+        if (isalnum((unsigned char)*s) || strchr("._/~+-:@,%", *s)) continue;
+        if (allow_glob && (*s == '*' || *s == '?')) continue;
+        return 0;
+    }
+    return 1;
+}
+
+static long parse_positive(const char *s) {
+    char *end;
+    long n = strtol(s, &end, 10);
+    return end == s || *end || n <= 0 ? -1 : n;
+}
+
+/* "10mb" or "10" "mb" as a find(1) size ("10M") */
+static int size_value(const char *number, const char *unit, char *out, size_t size) {
+    static const char *units[][2] = {
+        {"b", "c"}, {"byte", "c"}, {"bytes", "c"}, {"k", "k"}, {"kb", "k"}, {"kib", "k"},
+        {"m", "M"}, {"mb", "M"}, {"mib", "M"}, {"g", "G"}, {"gb", "G"}, {"gib", "G"}
+    };
+    char digits[24];
+    size_t len = strspn(number, "0123456789");
+    if (len == 0 || len >= sizeof(digits)) return 0;
+    memcpy(digits, number, len);
+    digits[len] = '\0';
+    if (!unit) unit = number + len;
+    else if (number[len]) return 0;
+
+    for (size_t i = 0; i < sizeof(units) / sizeof(units[0]); i++) {
+        if (strcmp(unit, units[i][0]) == 0) {
+            snprintf(out, size, "%s%s", digits, units[i][1]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* "today", "week", "3 days" as a number of days */
+static int time_value(char **words, int used, char *out, size_t size) {
+    static const char *spans[][2] = {
+        {"today", "1"}, {"yesterday", "2"}, {"day", "1"}, {"week", "7"}, {"month", "30"}
+    };
+    if (used == 1) {
+        for (size_t i = 0; i < sizeof(spans) / sizeof(spans[0]); i++) {
+            if (strcmp(words[0], spans[i][0]) == 0) {
+                snprintf(out, size, "%s", spans[i][1]);
+                return 1;
+            }
+        }
+        return 0;
+    }
+    long n = parse_positive(words[0]);
+    if (n < 0 || n > 36500) return 0;
+    if (strcmp(words[1], "day") == 0 || strcmp(words[1], "days") == 0) {
+        snprintf(out, size, "%ld", n);
+    } else if (strcmp(words[1], "week") == 0 || strcmp(words[1], "weeks") == 0) {
+        snprintf(out, size, "%ld", n * 7);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+typedef struct {
+    char *words[INTENT_MAX_TOKENS];     /* Lowercased, for literals */
+    char *raw[INTENT_MAX_TOKENS];       /* As typed, for paths and names */
+    int count;
+    SlotValue slots[INTENT_MAX_SLOTS];
+    int slot_count;
+    int best;
+    SlotValue best_slots[INTENT_MAX_SLOTS];
+    int best_slot_count;
+} MatchState;
+
+/* Does the slot take `used` tokens at position i? Writes its value */
+static int slot_accepts(SlotType slot, MatchState *m, int i, int used, char *out, size_t size) {
+    const char *word = m->words[i];
+    const char *raw = m->raw[i];
+    long n;
+
+    switch (slot) {
+        case SLOT_SIZE:
+            return size_value(word, used == 2 ? m->words[i + 1] : NULL, out, size);
+        case SLOT_TIME:
+            return time_value(&m->words[i], used, out, size);
+        case SLOT_PORT:
+            if (used != 1) return 0;
+            n = parse_positive(word[0] == ':' ? word + 1 : word);
+            if (n < 1 || n > 65535) return 0;
+            snprintf(out, size, "%ld", n);
+            return 1;
+        case SLOT_NUMBER:
+            if (used != 1) return 0;
+            n = parse_positive(word);
+            if (n < 1 || n > 1000000) return 0;
+            snprintf(out, size, "%ld", n);
+            return 1;
+        case SLOT_PATH:
+        case SLOT_NAME:
+            if (used != 1 || strlen(raw) >= size || !safe_value(raw, slot == SLOT_NAME)) return 0;
+            snprintf(out, size, "%s", raw);
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Walk every trie path the input fits; the lowest template index wins */
+static void match_node(const IntentNode *node, MatchState *m, int i) {
+    if (i == m->count) {
+        if (node->intent >= 0 && (m->best < 0 || node->intent < m->best)) {
+            m->best = node->intent;
+            memcpy(m->best_slots, m->slots, sizeof(m->slots));
+            m->best_slot_count = m->slot_count;
+        }
+        return;
+    }
+
+    for (const IntentNode *c = node->child; c; c = c->next) {
+        if (c->word) {
+            if (strcmp(c->word, m->words[i]) == 0) match_node(c, m, i + 1);
+            continue;
+        }
+        if (m->slot_count == INTENT_MAX_SLOTS) continue;
+
+        SlotValue *v = &m->slots[m->slot_count];
+        for (int used = 1; used <= 2 && i + used <= m->count; used++) {
+            if (!slot_accepts(c->slot, m, i, used, v->value, sizeof(v->value))) continue;
+            snprintf(v->name, sizeof(v->name), "%s", c->slot_name);
+            m->slot_count++;
+            match_node(c, m, i + used);
+            m->slot_count--;
+        }
+    }
+}
+
+/* Copy a template, replacing <name> with the matched slot values */
+static void substitute(const char *tmpl, const MatchState *m, char *out, size_t size) {
+    size_t len = 0;
+    while (*tmpl && len + 1 < size) {
+        const char *close = *tmpl == '<' ? strchr(tmpl, '>') : NULL;
+        const char *value = NULL;
+        for (int i = 0; close && i < m->best_slot_count; i++) {
+            const char *name = m->best_slots[i].name;
+            if (strlen(name) == (size_t)(close - tmpl - 1) && strncmp(tmpl + 1, name, strlen(name)) == 0) {
+                value = m->best_slots[i].value;
+            }
+        }
+        if (value) {
+            len += snprintf(out + len, size - len, "%s", value);
+            if (len >= size) len = size - 1;
+            tmpl = close + 1;
+        } else {
+            out[len++] = *tmpl++;
+        }
+    }
+    out[len] = '\0';
+}
+
+/* Lowercase, drop trailing punctuation and leading filler words */
+static int tokenize(char *text, MatchState *m) {
+    char *saveptr;
+    m->count = 0;
+    for (char *t = strtok_r(text, " \t\n", &saveptr); t; t = strtok_r(NULL, " \t\n", &saveptr)) {
+        if (m->count == INTENT_MAX_TOKENS) return 0;
+        m->raw[m->count++] = t;
+    }
+    if (m->count == 0) return 0;
+
+    for (int i = 0; i < m->count; i++) {
+        char *t = m->raw[i];
+        size_t len = strlen(t);
+        while (len > 0 && strchr("?!,", t[len - 1])) t[--len] = '\0';
+        if (i == m->count - 1 && len > 1 && t[len - 1] == '.' && t[len - 2] != '.') t[--len] = '\0';
+    }
+    return 1;
+}
+
+static void drop_fillers(MatchState *m) {
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (int f = 0; filler_phrases[f]; f++) {
+            char phrase[32];
+            snprintf(phrase, sizeof(phrase), "%s", filler_phrases[f]);
+            char *saveptr;
+            int n = 0, fits = 1;
+            for (char *w = strtok_r(phrase, " ", &saveptr); w; w = strtok_r(NULL, " ", &saveptr), n++) {
+                if (n >= m->count - 1 || strcmp(m->words[n], w) != 0) fits = 0;
+            }
+            if (!fits) continue;
+            memmove(m->words, m->words + n, sizeof(char *) * (m->count - n));
+            memmove(m->raw, m->raw + n, sizeof(char *) * (m->count - n));
+            m->count -= n;
+            changed = 1;
+        }
+    }
+    if (m->count > 1 && strcmp(m->words[m->count - 1], "please") == 0) m->count--;
+}
+
+char *intent_match(const char *input) {
+    if (!local_enabled || !intent_total || !input) return NULL;
+
+    MatchState m;
+    memset(&m, 0, sizeof(m));
+    m.best = -1;
+
+    char *raw = strdup(input);
+    char *lower = NULL;
+    if (!raw || !tokenize(raw, &m)) {
+        free(raw);
+        return NULL;
+    }
+
+    /* Lowercase copies of the same tokens, in one buffer */
+    size_t total = 0;
+    for (int i = 0; i < m.count; i++) total += strlen(m.raw[i]) + 1;
+    lower = malloc(total);
+    if (!lower) {
+        free(raw);
+        return NULL;
+    }
+    char *p = lower;
+    for (int i = 0; i < m.count; i++) {
+        m.words[i] = p;
+        for (const char *s = m.raw[i]; *s; s++) *p++ = (char)tolower((unsigned char)*s);
+        *p++ = '\0';
+    }
+    drop_fillers(&m);
+    match_node(&root, &m, 0);
+
+    char *response = NULL;
+    if (m.best >= 0) {
+        const Intent *intent = &intents[m.best];
+        char command[512], explain[512];
+        substitute(intent->command, &m, command, sizeof(command));
+        if (intent->explain) {
+            substitute(intent->explain, &m, explain, sizeof(explain));
+        } else {
+            snprintf(explain, sizeof(explain), "From the local intent '%s'.", intent->pattern);
+        }
+
+        size_t size = strlen(command) + strlen(explain) + 32;
+        response = malloc(size);
+        if (response) snprintf(response, size, "COMMAND: %s\nEXPLAIN: %s\n", command, explain);
+    }
+    free(lower);
+    free(raw);
+    return response;
+}
+
+void intent_set_enabled(int enabled) {
+    local_enabled = enabled ? 1 : 0;
+}
+
+int intent_get_enabled(void) {
+    return local_enabled;
+}
+
+int intent_count(void) {
+    return intent_total;
+}
+
+const char *intent_path(void) {
+    return intents_file;
+}
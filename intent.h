@@ -0,0 +1,27 @@
+#ifndef INTENT_H
+#define INTENT_H
+
+/*
+ * Offline intent engine: common requests ("show disk usage", "kill process
+ * on port 8080") are matched against templates with typed slots and
+ * answered with a COMMAND: response, without any AI request.
+ *
+ * Templates are words, choices (list|show), [optional] words and slots:
+ * <size> (10MB, 1 GB), <time> (today, yesterday, week, month, 3 days), <port>, <number>, <path>
+ * and <name>. A digit after the slot type (<path2>) allows two of a kind.
+ * Site-specific templates come from ~/.config/cortexcli/intents
+ * (CORTEX_INTENTS_FILE), one "template => command" per line, and take
+ * precedence over the built-in ones.
+ */
+void intent_init(void);
+void intent_cleanup(void);
+
+/* Response text for input, or NULL if no template matches (caller frees) */
+char *intent_match(const char *input);
+
+void intent_set_enabled(int enabled);
+int intent_get_enabled(void);
+int intent_count(void);
+const char *intent_path(void);
+
+#endif /* INTENT_H */
@@ -0,0 +1,366 @@
+#include "json_extract.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Parser states */
+enum {
+    EX_VALUE = 0,       /* Expecting a value */
+    EX_ARRAY_FIRST,     /* After '[': a value or ']' */
+    EX_OBJECT_FIRST,    /* After '{': a key or '}' */
+    EX_KEY,             /* After ',' in an object: a key */
+    EX_COLON,           /* After a key */
+    EX_AFTER,           /* After a value: ',' or a closing bracket */
+    EX_STRING,
+    EX_ESCAPE,
+    EX_UNICODE,
+    EX_SCALAR,          /* Number, true, false or null */
+    EX_END              /* Root value closed, only whitespace may follow */
+};
+
+/* Destination of the string being read */
+enum {
+    TARGET_NONE = 0,
+    TARGET_KEY,
+    TARGET_OUT
+};
+
+#define OUT_INITIAL_CAP 1024
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+void json_extract_init(JsonExtractor *x, const char *const *path, int path_len) {
+    memset(x, 0, sizeof(*x));
+    x->path = path;
+    x->path_len = path_len;
+    x->state = EX_VALUE;
+}
+
+/* Append bytes to the output, doubling its capacity as needed */
+static void out_append(JsonExtractor *x, const char *data, size_t len) {
+    if (x->out_len + len + 1 > x->out_cap) {
+        size_t cap = x->out_cap ? x->out_cap : OUT_INITIAL_CAP;
+        while (x->out_len + len + 1 > cap) cap *= 2;
+        char *grown = realloc(x->out, cap);
+        if (!grown) {
+            x->failed = 1;
+            return;
+        }
+        x->out = grown;
+        x->out_cap = cap;
+    }
+    memcpy(x->out + x->out_len, data, len);
+    x->out_len += len;
+    x->out[x->out_len] = '\0';
+}
+
+/* Route decoded string bytes to the key buffer or the output */
+static void string_put(JsonExtractor *x, const char *data, size_t len) {
+    if (x->string_target == TARGET_OUT) {
+        out_append(x, data, len);
+    } else if (x->string_target == TARGET_KEY) {
+        if (x->key_len + len >= sizeof(x->key)) {
+            x->key_overflow = 1;
+            return;
+        }
+        memcpy(x->key + x->key_len, data, len);
+        x->key_len += len;
+    }
+}
+
+/* Encode a code point as UTF-8 */
+static void string_put_codepoint(JsonExtractor *x, unsigned int cp) {
+    char buf[4];
+    size_t n;
+
+    if (cp == 0) return;    /* Keep the output a C string */
+    if (cp < 0x80) {
+        buf[0] = (char)cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        buf[0] = (char)(0xC0 | (cp >> 6));
+        buf[1] = (char)(0x80 | (cp & 0x3F));
+        n = 2;
+    } else if (cp < 0x10000) {
+        buf[0] = (char)(0xE0 | (cp >> 12));
+        buf[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        buf[2] = (char)(0x80 | (cp & 0x3F));
+        n = 3;
+    } else {
+        buf[0] = (char)(0xF0 | (cp >> 18));
+        buf[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        buf[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        buf[3] = (char)(0x80 | (cp & 0x3F));
+        n = 4;
+    }
+    string_put(x, buf, n);
+}
+
+/* Does the open container's current key/index equal path[depth - 1]? */
+static int segment_matches(const JsonExtractor *x) {
+    int i = x->depth - 1;
+    if (i < 0 || i >= x->path_len) return 0;
+
+    if (x->stack[i].type == '{') return x->stack[i].key_match;
+
+    const char *seg = x->path[i];
+    if (!*seg) return 0;
+    for (const char *p = seg; *p; p++) {
+        if (*p < '0' || *p > '9') return 0;
+    }
+    return atoi(seg) == x->stack[i].index;
+}
+
+/* A value starts at the current depth */
+static void value_begin(JsonExtractor *x) {
+    if (x->depth > 0 && x->matched == x->depth - 1 && segment_matches(x)) {
+        x->matched = x->depth;
+    }
+}
+
+/* The value at the current depth has ended */
+static void value_end(JsonExtractor *x) {
+    if (x->depth > 0 && x->matched == x->depth) x->matched = x->depth - 1;
+    if (x->depth == 0) {
+        x->state = EX_END;
+        x->complete = 1;
+    } else {
+        x->state = EX_AFTER;
+    }
+}
+
+/* A key has been read; remember whether it is on the target path */
+static void key_end(JsonExtractor *x) {
+    int i = x->depth - 1;
+
+    x->stack[i].key_match = !x->key_overflow && i < x->path_len &&
+                            strlen(x->path[i]) == x->key_len &&
+                            memcmp(x->path[i], x->key, x->key_len) == 0;
+    if (x->depth == 1 && !x->key_overflow && x->key_len == 5 &&
+        memcmp(x->key, "error", 5) == 0) {
+        x->saw_error = 1;
+    }
+    x->state = EX_COLON;
+}
+
+static void container_push(JsonExtractor *x, char type) {
+    value_begin(x);
+    if (x->depth == JSON_EXTRACT_MAX_DEPTH) {
+        x->failed = 1;
+        return;
+    }
+    x->stack[x->depth].type = type;
+    x->stack[x->depth].index = 0;
+    x->stack[x->depth].key_match = 0;
+    x->depth++;
+    x->state = type == '{' ? EX_OBJECT_FIRST : EX_ARRAY_FIRST;
+}
+
+static void container_pop(JsonExtractor *x, char close) {
+    char open = close == '}' ? '{' : '[';
+    if (x->depth == 0 || x->stack[x->depth - 1].type != open) {
+        x->failed = 1;
+        return;
+    }
+    x->depth--;
+    value_end(x);
+}
+
+/* Start of a value: decide what it is from its first byte */
+static void value_start(JsonExtractor *x, char c) {
+    if (c == '{' || c == '[') {
+        container_push(x, c);
+    } else if (c == '"') {
+        value_begin(x);
+        x->string_target = TARGET_NONE;
+        if (!x->started && x->depth == x->path_len && x->matched == x->path_len) {
+            x->string_target = TARGET_OUT;
+            x->started = 1;
+            out_append(x, "", 0);
+        }
+        x->state = EX_STRING;
+    } else if (c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' || c == 'n') {
+        value_begin(x);
+        x->state = EX_SCALAR;
+    } else {
+        x->failed = 1;
+    }
+}
+
+/* Closing quote of a key or a value string */
+static void string_end(JsonExtractor *x) {
+    if (x->string_target == TARGET_KEY) {
+        key_end(x);
+        return;
+    }
+    if (x->string_target == TARGET_OUT) x->found = 1;
+    x->string_target = TARGET_NONE;
+    value_end(x);
+}
+
+/* Finish a \uXXXX escape, pairing UTF-16 surrogates */
+static void unicode_end(JsonExtractor *x) {
+    unsigned int u = x->unicode;
+
+    if (u >= 0xD800 && u <= 0xDBFF) {
+        x->high_surrogate = u;
+        return;
+    }
+    if (u >= 0xDC00 && u <= 0xDFFF) {
+        if (x->high_surrogate) {
+            string_put_codepoint(x, 0x10000 + ((x->high_surrogate - 0xD800) << 10) + (u - 0xDC00));
+        }
+        x->high_surrogate = 0;
+        return;
+    }
+    x->high_surrogate = 0;
+    string_put_codepoint(x, u);
+}
+
+int json_extract_feed(JsonExtractor *x, const char *data, size_t len) {
+    size_t i = 0;
+
+    while (i < len && !x->failed) {
+        char c = data[i];
+
+        switch (x->state) {
+            case EX_STRING: {
+                /* Copy a run of plain bytes in one go */
+                size_t run = i;
+                while (run < len && data[run] != '"' && data[run] != '\\') run++;
+                if (run > i) {
+                    string_put(x, data + i, run - i);
+                    i = run;
+                    continue;
+                }
+                if (c == '"') string_end(x);
+                else x->state = EX_ESCAPE;
+                break;
+            }
+            case EX_ESCAPE: {
+                const char *plain = NULL;
+                switch (c) {
+                    case '"': plain = "\""; break;
+                    case '\\': plain = "\\"; break;
+                    case '/': plain = "/"; break;
+                    case 'b': plain = "\b"; break;
+                    case 'f': plain = "\f"; break;
+                    case 'n': plain = "\n"; break;
+                    case 'r': plain = "\r"; break;
+                    case 't': plain = "\t"; break;
+                    case 'u':
+                        x->unicode = 0;
+                        x->unicode_digits = 0;
+                        x->state = EX_UNICODE;
+                        break;
+                    default:
+                        x->failed = 1;
+                }
+                if (plain) {
+                    string_put(x, plain, 1);
+                    x->state = EX_STRING;
+                }
+                break;
+            }
+            case EX_UNICODE: {
+                unsigned int digit;
+                if (c >= '0' && c <= '9') digit = (unsigned int)(c - '0');
+                else if (c >= 'a' && c <= 'f') digit = (unsigned int)(c - 'a' + 10);
+                else if (c >= 'A' && c <= 'F') digit = (unsigned int)(c - 'A' + 10);
+                else {
+                    x->failed = 1;
+                    break;
+                }
+                x->unicode = (x->unicode << 4) | digit;
+                if (++x->unicode_digits == 4) {
+                    unicode_end(x);
+                    x->state = EX_STRING;
+                }
+                break;
+            }
+            case EX_SCALAR:
+                if (c == ',' || c == ']' || c == '}' || is_space(c)) {
+                    value_end(x);
+                    continue;   /* Let EX_AFTER see the delimiter */
+                }
+                if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+                      c == '.' || c == '+' || c == '-' || c == 'E')) {
+                    x->failed = 1;
+                }
+                break;
+            default:
+                if (is_space(c)) break;
+
+                switch (x->state) {
+                    case EX_VALUE:
+                        value_start(x, c);
+                        break;
+                    case EX_ARRAY_FIRST:
+                        if (c == ']') container_pop(x, c);
+                        else value_start(x, c);
+                        break;
+                    case EX_OBJECT_FIRST:
+                    case EX_KEY:
+                        if (c == '}' && x->state == EX_OBJECT_FIRST) {
+                            container_pop(x, c);
+                        } else if (c == '"') {
+                            x->string_target = TARGET_KEY;
+                            x->key_len = 0;
+                            x->key_overflow = 0;
+                            x->state = EX_STRING;
+                        } else {
+                            x->failed = 1;
+                        }
+                        break;
+                    case EX_COLON:
+                        if (c == ':') {
+                            x->string_target = TARGET_NONE;
+                            x->state = EX_VALUE;
+                        } else {
+                            x->failed = 1;
+                        }
+                        break;
+                    case EX_AFTER:
+                        if (c == ',') {
+                            if (x->stack[x->depth - 1].type == '[') {
+                                x->stack[x->depth - 1].index++;
+                                x->state = EX_VALUE;
+                            } else {
+                                x->state = EX_KEY;
+                            }
+                        } else if (c == '}' || c == ']') {
+                            container_pop(x, c);
+                        } else {
+                            x->failed = 1;
+                        }
+                        break;
+                    case EX_END:
+                    default:
+                        x->failed = 1;
+                }
+        }
+        i++;
+    }
+
+    return x->failed ? -1 : 0;
+}
+
+int json_extract_ok(const JsonExtractor *x) {
+    return x->found && x->complete && !x->failed && !x->saw_error;
+}
+
+char *json_extract_take(JsonExtractor *x) {
+    char *out = x->out;
+    x->out = NULL;
+    x->out_len = 0;
+    x->out_cap = 0;
+    return out;
+}
+
+void json_extract_free(JsonExtractor *x) {
+    free(x->out);
+    x->out = NULL;
+    x->out_len = 0;
+    x->out_cap = 0;
+}
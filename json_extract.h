@@ -0,0 +1,63 @@
+#ifndef JSON_EXTRACT_H
+#define JSON_EXTRACT_H
+
+#include <stddef.h>
+
+#define JSON_EXTRACT_MAX_DEPTH 32
+#define JSON_EXTRACT_KEY_SIZE 64
+
+/*
+ * Incremental extractor for one string value in a JSON document.
+ * Bytes are fed as they arrive; only the string at `path` is copied out,
+ * nothing else is kept. Path segments are object keys, or decimal indexes
+ * when the enclosing container is an array:
+ *   {"choices", "0", "message", "content"}
+ */
+typedef struct {
+    const char *const *path;
+    int path_len;
+
+    /* Open containers */
+    struct {
+        char type;          /* '{' or '[' */
+        int index;          /* Current element of an array */
+        int key_match;      /* Current key of an object equals its path segment */
+    } stack[JSON_EXTRACT_MAX_DEPTH];
+    int depth;
+    int matched;            /* Leading path segments matched by the open values */
+
+    int state;
+    int string_target;      /* Where string bytes go (see json_extract.c) */
+    unsigned int unicode;   /* \uXXXX being decoded */
+    int unicode_digits;
+    unsigned int high_surrogate;
+
+    char key[JSON_EXTRACT_KEY_SIZE];
+    size_t key_len;
+    int key_overflow;
+
+    char *out;              /* Extracted value, NUL-terminated */
+    size_t out_len;
+    size_t out_cap;
+
+    int started;            /* The target string has begun */
+    int found;              /* The target string is complete */
+    int saw_error;          /* Top-level "error" key present */
+    int complete;           /* Root value closed */
+    int failed;             /* Syntax error or allocation failure */
+} JsonExtractor;
+
+void json_extract_init(JsonExtractor *x, const char *const *path, int path_len);
+
+/* Feed the next bytes; returns -1 once the document cannot be parsed */
+int json_extract_feed(JsonExtractor *x, const char *data, size_t len);
+
+/* 1 if the document parsed and the target string was found */
+int json_extract_ok(const JsonExtractor *x);
+
+/* Hand over the extracted string (caller frees) */
+char *json_extract_take(JsonExtractor *x);
+
+void json_extract_free(JsonExtractor *x);
+
+#endif /* JSON_EXTRACT_H */
@@ -0,0 +1,237 @@
+#include "ollama_opts.h"
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define OLLAMA_DEFAULT_KEEP_ALIVE "30m"
+
+/* One section of the file; the first entry holds the top-level defaults */
+typedef struct {
+    char model[128];
+    OllamaOpts opts;
+} OptsEntry;
+
+static OptsEntry *entries = NULL;
+static int entry_count = 0;
+static char conf_path[512] = {0};
+static char env_keep_alive[32] = {0};
+
+/* The startup probe thread reads options while the shell may be setting them */
+static pthread_mutex_t opts_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static OptsEntry *find_entry(const char *model) {
+    for (int i = 0; i < entry_count; i++) {
+        if (strcmp(entries[i].model, model) == 0) return &entries[i];
+    }
+    return NULL;
+}
+
+static OptsEntry *get_entry(const char *model) {
+    OptsEntry *entry = find_entry(model);
+    if (entry) return entry;
+
+    OptsEntry *grown = realloc(entries, sizeof(OptsEntry) * (entry_count + 1));
+    if (!grown) return NULL;
+    entries = grown;
+    entry = &entries[entry_count++];
+    memset(entry, 0, sizeof(*entry));
+    snprintf(entry->model, sizeof(entry->model), "%s", model);
+    return entry;
+}
+
+/* Positive integer, or -1 */
+static long parse_count(const char *value) {
+    char *end;
+    errno = 0;
+    long n = strtol(value, &end, 10);
+    if (errno || end == value || *end || n <= 0) return -1;
+    return n;
+}
+
+/* Apply key = value to opts; "default" clears it. Returns -1 if invalid */
+static int apply_option(OllamaOpts *opts, const char *key, const char *value) {
+    int clear = strcmp(value, "default") == 0;
+    long *count = NULL;
+
+    if (strcmp(key, "keep_alive") == 0) {
+        if (clear) {
+            opts->keep_alive[0] = '\0';
+            return 0;
+        }
+        if (!*value || strlen(value) >= sizeof(opts->keep_alive) || strchr(value, ' ')) return -1;
+        snprintf(opts->keep_alive, sizeof(opts->keep_alive), "%s", value);
+        return 0;
+    }
+
+    if (strcmp(key, "num_ctx") == 0) count = &opts->num_ctx;
+    else if (strcmp(key, "num_thread") == 0) count = &opts->num_thread;
+    else if (strcmp(key, "num_predict") == 0) count = &opts->num_predict;
+    else return -1;
+
+    long n = clear ? 0 : parse_count(value);
+    if (n < 0) return -1;
+    *count = n;
+    return 0;
+}
+
+/* Copy the fields src sets over dst */
+static void merge_opts(OllamaOpts *dst, const OllamaOpts *src) {
+    if (src->keep_alive[0]) memcpy(dst->keep_alive, src->keep_alive, sizeof(dst->keep_alive));
+    if (src->num_ctx) dst->num_ctx = src->num_ctx;
+    if (src->num_thread) dst->num_thread = src->num_thread;
+    if (src->num_predict) dst->num_predict = src->num_predict;
+}
+
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    size_t len = strlen(s);
+    while (len > 0 && isspace((unsigned char)s[len - 1])) s[--len] = '\0';
+    return s;
+}
+
+static void load_file(void) {
+    FILE *fp = fopen(conf_path, "r");
+    if (!fp) return;
+
+    OptsEntry *section = get_entry("");
+    char line[512];
+    int number = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        number++;
+        char *text = trim(line);
+        if (!*text || *text == '#') continue;
+
+        size_t len = strlen(text);
+        if (*text == '[' && text[len - 1] == ']') {
+            text[len - 1] = '\0';
+            section = get_entry(trim(text + 1));
+            continue;
+        }
+
+        char *eq = strchr(text, '=');
+        if (eq) *eq = '\0';
+        if (!eq || !section || apply_option(&section->opts, trim(text), trim(eq + 1)) != 0) {
+            fprintf(stderr, "%s:%d: ignoring invalid line\n", conf_path, number);
+        }
+    }
+    fclose(fp);
+}
+
+static void write_opts(FILE *fp, const OllamaOpts *opts) {
+    if (opts->keep_alive[0]) fprintf(fp, "keep_alive = %s\n", opts->keep_alive);
+    if (opts->num_ctx) fprintf(fp, "num_ctx = %ld\n", opts->num_ctx);
+    if (opts->num_thread) fprintf(fp, "num_thread = %ld\n", opts->num_thread);
+    if (opts->num_predict) fprintf(fp, "num_predict = %ld\n", opts->num_predict);
+}
+
+static int opts_is_empty(const OllamaOpts *opts) {
+    return !opts->keep_alive[0] && !opts->num_ctx && !opts->num_thread && !opts->num_predict;
+}
+
+/* Create the directory holding the file (and its parent) */
+static void make_conf_dir(void) {
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%s", conf_path);
+    char *slash = strrchr(dir, '/');
+    if (!slash || slash == dir) return;
+    *slash = '\0';
+
+    char *parent = strrchr(dir, '/');
+    if (parent && parent != dir) {
+        *parent = '\0';
+        mkdir(dir, 0700);
+        *parent = '/';
+    }
+    mkdir(dir, 0700);
+}
+
+static int save_file(void) {
+    make_conf_dir();
+    FILE *fp = fopen(conf_path, "w");
+    if (!fp) return -1;
+
+    fprintf(fp, "# Ollama runtime options (written by 'ai model opts')\n");
+    for (int i = 0; i < entry_count; i++) {
+        if (opts_is_empty(&entries[i].opts)) continue;
+        if (entries[i].model[0]) fprintf(fp, "\n[%s]\n", entries[i].model);
+        write_opts(fp, &entries[i].opts);
+    }
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+void ollama_opts_init(void) {
+    char *custom = getenv("CORTEX_OLLAMA_CONF");
+    char *xdg = getenv("XDG_CONFIG_HOME");
+    char *home = getenv("HOME");
+    if (custom && *custom) {
+        snprintf(conf_path, sizeof(conf_path), "%s", custom);
+    } else if (xdg && *xdg) {
+        snprintf(conf_path, sizeof(conf_path), "%s/cortexcli/ollama.conf", xdg);
+    } else if (home) {
+        snprintf(conf_path, sizeof(conf_path), "%s/.config/cortexcli/ollama.conf", home);
+    }
+
+    char *keep_alive = getenv("CORTEX_OLLAMA_KEEP_ALIVE");
+    if (keep_alive && *keep_alive) {
+        snprintf(env_keep_alive, sizeof(env_keep_alive), "%s", keep_alive);
+    }
+
+    if (conf_path[0]) load_file();
+}
+
+void ollama_opts_cleanup(void) {
+    pthread_mutex_lock(&opts_lock);
+    free(entries);
+    entries = NULL;
+    entry_count = 0;
+    pthread_mutex_unlock(&opts_lock);
+}
+
+void ollama_opts_get(const char *model, OllamaOpts *opts) {
+    memset(opts, 0, sizeof(*opts));
+    snprintf(opts->keep_alive, sizeof(opts->keep_alive), "%s", OLLAMA_DEFAULT_KEEP_ALIVE);
+
+    pthread_mutex_lock(&opts_lock);
+    OptsEntry *defaults = find_entry("");
+    if (defaults) merge_opts(opts, &defaults->opts);
+    if (env_keep_alive[0]) memcpy(opts->keep_alive, env_keep_alive, sizeof(opts->keep_alive));
+    if (!model || !*model) {
+        pthread_mutex_unlock(&opts_lock);
+        return;
+    }
+
+    /* A section without a tag ("llama3.2") covers every tag of that model */
+    const char *tag = strchr(model, ':');
+    if (tag) {
+        char base[128];
+        snprintf(base, sizeof(base), "%.*s", (int)(tag - model), model);
+        OptsEntry *entry = find_entry(base);
+        if (entry) merge_opts(opts, &entry->opts);
+    }
+    OptsEntry *entry = find_entry(model);
+    if (entry) merge_opts(opts, &entry->opts);
+    pthread_mutex_unlock(&opts_lock);
+}
+
+int ollama_opts_set(const char *model, const char *key, const char *value) {
+    OllamaOpts check = {0};
+    if (apply_option(&check, key, value) != 0) return -1;
+
+    pthread_mutex_lock(&opts_lock);
+    OptsEntry *entry = get_entry(model ? model : "");
+    int result = -1;
+    if (entry) {
+        apply_option(&entry->opts, key, value);
+        result = save_file() == 0 ? 0 : -2;
+    }
+    pthread_mutex_unlock(&opts_lock);
+    return result;
+}
+
+const char *ollama_opts_path(void) {
+    return conf_path;
+}
@@ -0,0 +1,32 @@
+#ifndef OLLAMA_OPTS_H
+#define OLLAMA_OPTS_H
+
+/* Runtime options sent with Ollama requests; 0 / "" = server default */
+typedef struct {
+    char keep_alive[32];    /* "30m", "-1", or seconds */
+    long num_ctx;           /* Context window in tokens */
+    long num_thread;        /* CPU threads used for inference */
+    long num_predict;       /* Cap on generated tokens */
+} OllamaOpts;
+
+/*
+ * Load ~/.config/cortexcli/ollama.conf (or CORTEX_OLLAMA_CONF): keys at the
+ * top apply to every model, keys under a [model] section to that model only.
+ * CORTEX_OLLAMA_KEEP_ALIVE overrides the file's default keep_alive.
+ */
+void ollama_opts_init(void);
+void ollama_opts_cleanup(void);
+
+/* Effective options for a model: defaults, then its own section */
+void ollama_opts_get(const char *model, OllamaOpts *opts);
+
+/*
+ * Set one option for a model and save the file; value "default" removes
+ * the model's own setting. Returns 0, -1 for an unknown key or bad value,
+ * -2 if the file could not be written (the setting still applies).
+ */
+int ollama_opts_set(const char *model, const char *key, const char *value);
+
+const char *ollama_opts_path(void);
+
+#endif /* OLLAMA_OPTS_H */
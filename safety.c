@@ -84,6 +84,7 @@ static const char *low_risk_patterns[] = {
 };
 
 static int sandbox_mode = 0;
+static int early_exec = 0;
 static RiskLevel confirmation_threshold = RISK_HIGH;
 
 void safety_init(void) {
@@ -92,6 +93,11 @@ void safety_init(void) {
         sandbox_mode = 1;
     }
     
+    char *early = getenv("CORTEX_EARLY_EXEC");
+    if (early && strcmp(early, "1") == 0) {
+        early_exec = 1;
+    }
+    
     char *threshold = getenv("CORTEX_RISK_THRESHOLD");
     if (threshold) {
         if (strcasecmp(threshold, "low") == 0) confirmation_threshold = RISK_LOW;
@@ -318,6 +324,21 @@ int safety_get_sandbox_mode(void) {
     return sandbox_mode;
 }
 
+void safety_set_early_exec(int enabled) {
+    early_exec = enabled;
+}
+
+int safety_get_early_exec(void) {
+    return early_exec;
+}
+
+/* Only risk-free commands may start while the AI is still responding */
+int safety_allows_early_exec(const RiskAnalysis *analysis) {
+    if (!early_exec || sandbox_mode || !analysis) return 0;
+    return analysis->level == RISK_NONE && !analysis->blocked &&
+           !analysis->requires_confirmation;
+}
+
 char *safety_preview_command(const char *command) {
     /* Generate a dry-run preview of what the command would do */
     size_t preview_len = strlen(command) + 256;
@@ -39,6 +39,11 @@ int safety_should_block(const char *command);
 void safety_set_sandbox_mode(int enabled);
 int safety_get_sandbox_mode(void);
 
+/* Early execution of AI commands while the response streams (opt-in) */
+void safety_set_early_exec(int enabled);
+int safety_get_early_exec(void);
+int safety_allows_early_exec(const RiskAnalysis *analysis);
+
 /* Preview command in sandbox (dry-run) */
 char *safety_preview_command(const char *command);
 
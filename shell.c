@@ -3,6 +3,17 @@
 #include "lang_detect.h"
 #include "safety.h"
 #include "audit.h"
+#include "ai_cache.h"
+#include "ai_semcache.h"
+#include "vuln_batch.h"
+#include "ollama_opts.h"
+#include "ai_router.h"
+#include "ai_breaker.h"
+#include "ai_ratelimit.h"
+#include "ai_local.h"
+#include "ai_endpoints.h"
+#include "ai_jobs.h"
+#include "intent.h"
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <ctype.h>
@@ -18,8 +29,7 @@
 "3. ALWAYS prefix each logical unit with the appropriate prefix\n" \
 "4. Provide both commands and explanations when appropriate\n" \
 "5. Never include text before prefixes\n" \
-"6. Support multilingual input (Urdu, Arabic, Hindi, etc.) - detect language and respond appropriately\n" \
-"Current session context:\n"
+"6. Support multilingual input (Urdu, Arabic, Hindi, etc.) - detect language and respond appropriately\n"
 
 History hist = {0};
 SessionExchange session_memory[MAX_SESSION_MEMORY] = {0};
@@ -32,15 +42,9 @@ struct MemoryStruct
 };
 
 void add_to_session_memory(const char *user_input, const char *ai_response) {
-    /* Create a cleaned version of the response (single line) */
-    char *cleaned_response = strdup(ai_response);
-    for (char *p = cleaned_response; *p; p++) {
-        if (*p == '\n') *p = '|';  /* Replace newlines with pipes */
-    }
-    
-    /* Store new exchange */
+    /* Store new exchange; it is sent back verbatim as an assistant turn */
     session_memory[session_memory_count % MAX_SESSION_MEMORY].user_input = strdup(user_input);
-    session_memory[session_memory_count % MAX_SESSION_MEMORY].ai_response = cleaned_response;
+    session_memory[session_memory_count % MAX_SESSION_MEMORY].ai_response = strdup(ai_response);
     session_memory_count++;
 }
 
@@ -56,67 +60,417 @@ void sig_handler(int sig_num)
     }
 }
 
-/* Get AI command using the multi-backend system */
-char *get_ai_command(const char *input)
+/* Smallest shortened exchange worth sending, in tokens */
+#define CONTEXT_MIN_TURN_TOKENS 48
+
+/* System prompt, reused between queries so steady state does not allocate */
+static StrBuf context_buf;
+static AITurn context_turns[MAX_SESSION_MEMORY];
+
+/*
+ * Oldest exchange (as a session_memory_count value) still sent to the model
+ * in context_model. History only grows from it, so each request repeats the
+ * previous one and the server can reuse its cached prefix (Ollama keeps the
+ * KV cache of a loaded model) instead of prefilling the transcript again.
+ */
+static int context_anchor;
+static char context_model[256];
+
+static int exchange_tokens(AIBackendType backend, const SessionExchange *ex)
 {
-    /* Detect task type for intelligent model selection */
-    TaskType task = ai_detect_task_type(input);
+    if (!ex->user_input || !ex->ai_response) return 0;
+    return ai_estimate_tokens(backend, ex->user_input, strlen(ex->user_input)) + 4 +
+           ai_estimate_tokens(backend, ex->ai_response, strlen(ex->ai_response));
+}
+
+/*
+ * Pick the session exchanges sent with a query, oldest first. Everything
+ * since the anchor goes out unchanged while it fits the token budget and
+ * session memory; once it does not, old exchanges are dropped until half is
+ * free, so the prefix then stays stable for several more turns. A newest exchange
+ * larger than the whole budget is cut at the end of a line.
+ */
+static int select_context_turns(AIBackendType backend, const char *model,
+                                 int budget, AITurn *turns)
+{
+    int newest = session_memory_count;
+    int oldest = newest > MAX_SESSION_MEMORY ? newest - MAX_SESSION_MEMORY : 0;
     
-    /* Auto-select the best model for this task type */
-    ai_auto_select_model(task);
+    if (strcmp(context_model, model) != 0) {
+        snprintf(context_model, sizeof(context_model), "%s", model);
+        context_anchor = oldest;
+    }
+    if (context_anchor < oldest) {
+        /* The ring overwrote the anchor: restart from its newer half */
+        context_anchor = newest - MAX_SESSION_MEMORY / 2;
+    }
     
-    /* Build context-enhanced query with task-optimized prompt */
-    char context_query[8192] = {0};
-    const char *optimized_prompt = ai_get_optimized_prompt(task);
-    strncpy(context_query, optimized_prompt, sizeof(context_query) - 1);
-    strncat(context_query, "\n\n", sizeof(context_query) - strlen(context_query) - 1);
-    strncat(context_query, PROMPT_PREFIX, sizeof(context_query) - strlen(context_query) - 1);
-    
-    /* Add session memory */
-    for (int i = 0; i < MAX_SESSION_MEMORY; i++) {
-        int idx = (session_memory_count - i - 1) % MAX_SESSION_MEMORY;
-        if (idx < 0) idx += MAX_SESSION_MEMORY;
+    int total = 0;
+    for (int i = context_anchor; i < newest; i++) {
+        total += exchange_tokens(backend, &session_memory[i % MAX_SESSION_MEMORY]);
+    }
+    if (total > budget) {
+        while (context_anchor < newest - 1 && total > budget / 2) {
+            total -= exchange_tokens(backend, &session_memory[context_anchor % MAX_SESSION_MEMORY]);
+            context_anchor++;
+        }
+    }
+    
+    int count = 0;
+    for (int i = context_anchor; i < newest; i++) {
+        SessionExchange *ex = &session_memory[i % MAX_SESSION_MEMORY];
+        if (!ex->user_input || !ex->ai_response) continue;
+        
+        turns[count].user = ex->user_input;
+        turns[count].assistant = ex->ai_response;
+        turns[count].assistant_len = strlen(ex->ai_response);
+        count++;
+    }
+    if (total <= budget || count == 0) return count;
+    
+    /* Only the newest exchange is left and it is still too long */
+    AITurn *turn = &turns[count - 1];
+    int fixed = ai_estimate_tokens(backend, turn->user, strlen(turn->user)) + 4;
+    int room = budget - fixed;
+    if (room < CONTEXT_MIN_TURN_TOKENS) return 0;
+    
+    size_t cut = turn->assistant_len * (size_t)room / (size_t)(total - fixed);
+    while (cut > 0 && ai_estimate_tokens(backend, turn->assistant, cut) > room) {
+        cut = cut * 9 / 10;
+    }
+    size_t line_end = cut;
+    while (line_end > 0 && turn->assistant[line_end] != '\n') line_end--;
+    if (line_end > 0) {
+        cut = line_end;
+    } else {
+        /* One long line: at least do not split a UTF-8 character */
+        while (cut > 0 && (turn->assistant[cut] & 0xC0) == 0x80) cut--;
+    }
+    turn->assistant_len = cut;
+    return cut > 0 ? count : 0;
+}
+
+/*
+ * Rules and task prompt as the system message, plus as much session history
+ * as the model's budget allows. The system text depends only on the task, so
+ * it stays byte-identical across the session for provider prompt caches.
+ */
+static AIConversation build_context(TaskType task, const char *input,
+                                    AIBackendType backend, const char *model)
+{
+    strbuf_reset(&context_buf);
+    strbuf_puts(&context_buf, PROMPT_PREFIX);
+    strbuf_puts(&context_buf, "\n");
+    strbuf_puts(&context_buf, ai_get_optimized_prompt(task));
+    
+    int budget = ai_get_context_budget(backend, model)
+                 - ai_estimate_tokens(backend, context_buf.data, context_buf.len)
+                 - ai_estimate_tokens(backend, input, strlen(input));
+    
+    AIConversation conv;
+    conv.system = context_buf.data ? context_buf.data : "";
+    conv.turns = context_turns;
+    conv.turn_count = budget > 0 ? select_context_turns(backend, model, budget, context_turns) : 0;
+    return conv;
+}
+
+/* Line prefixes understood by handle_ai_response */
+static const char *response_prefixes[] = {
+    "COMMAND:", "EXPLAIN:", "SCAN:", "VULN:", "CTF:", NULL
+};
+
+/* Cascade routing: inputs up to this long count as simple questions */
+#define CASCADE_SIMPLE_CHARS 80
+
+/* A model that writes these is guessing */
+static const char *unsure_phrases[] = {
+    "not sure", "i don't know", "i do not know", "unclear", "cannot determine",
+    "can't determine", "not certain", "might not work", "may not work", NULL
+};
+
+static int cascade_applies(TaskType task, const char *input) {
+    if (task == TASK_SHELL_COMMAND) return 1;
+    return task == TASK_GENERAL && strlen(input) <= CASCADE_SIMPLE_CHARS;
+}
+
+/* Length of the word at cmd, up to unquoted whitespace or end */
+static size_t word_length(const char *cmd, const char *end) {
+    char quote = 0;
+    const char *p = cmd;
+    for (; p < end; p++) {
+        if (quote) {
+            if (*p == quote) quote = 0;
+        } else if (*p == '\'' || *p == '"') {
+            quote = *p;
+        } else if (isspace((unsigned char)*p)) {
+            break;
+        }
+    }
+    return (size_t)(p - cmd);
+}
+
+/* Length of the command at cmd, up to the next unquoted |, ; or & (not a 2>&1 redirect) */
+static size_t stage_length(const char *cmd) {
+    char quote = 0;
+    size_t i = 0;
+    for (; cmd[i]; i++) {
+        if (quote) {
+            if (cmd[i] == quote) quote = 0;
+        } else if (cmd[i] == '\'' || cmd[i] == '"') {
+            quote = cmd[i];
+        } else if (cmd[i] == '&' && ((i > 0 && (cmd[i - 1] == '>' || cmd[i - 1] == '<')) || cmd[i + 1] == '>')) {
+            continue;
+        } else if (cmd[i] == '|' || cmd[i] == ';' || cmd[i] == '&') {
+            break;
+        }
+    }
+    return i;
+}
+
+/* NAME=value set for the command that follows */
+static int is_assignment(const char *word, size_t len) {
+    if (len == 0 || !(isalpha((unsigned char)word[0]) || word[0] == '_')) return 0;
+    for (size_t i = 1; i < len; i++) {
+        if (word[i] == '=') return 1;
+        if (!isalnum((unsigned char)word[i]) && word[i] != '_') return 0;
+    }
+    return 0;
+}
+
+/*
+ * Can this shell run every command in cmd? Checks the first word, past
+ * any NAME=value, of each pipeline stage and of each command after ;,
+ * && or ||.
+ */
+static int command_exists(const char *cmd) {
+    int stages = 0;
+    
+    while (*cmd) {
+        const char *end = cmd + stage_length(cmd);
+        const char *word = cmd;
+        size_t len = 0;
+        for (;;) {
+            while (word < end && isspace((unsigned char)*word)) word++;
+            len = word_length(word, end);
+            if (!is_assignment(word, len)) break;
+            word += len;
+        }
+        if (cmd + strspn(cmd, " \t") < end) stages++;
         
-        if (session_memory[idx].user_input && session_memory[idx].ai_response) {
-            size_t remaining = sizeof(context_query) - strlen(context_query) - 1;
-            if (remaining > 100) {
-                strncat(context_query, "User: ", remaining);
-                strncat(context_query, session_memory[idx].user_input, remaining - 50);
-                strncat(context_query, "\nAI: ", remaining - 50);
-                strncat(context_query, session_memory[idx].ai_response, remaining - 100);
-                strncat(context_query, "\n", remaining - 100);
+        if (len > 0) {
+            if (len >= 256) return 0;
+            char name[256];
+            memcpy(name, word, len);
+            name[len] = '\0';
+            char *args[2] = {name, NULL};
+            int found = checkbuild(args) != NULL;
+            if (!found && strchr(name, '/')) {
+                found = access(name, X_OK) == 0;
+            } else if (!found && _getenv("PATH")) {
+                list_path *head = linkpath(_getenv("PATH"));
+                char *full_path = _which(name, head);
+                found = full_path != NULL;
+                free(full_path);
+                free_list(head);
             }
+            if (!found) return 0;
         }
+        cmd = end + strspn(end, "|;&");
     }
+    return stages > 0;
+}
+
+/*
+ * Why a fast model's answer is not good enough, or NULL to accept it:
+ * nothing in the response format, a shell task without a runnable
+ * COMMAND: line, or wording that admits a guess.
+ */
+static const char *cascade_reject_reason(TaskType task, const char *response) {
+    char *lower = strdup(response);
+    for (char *p = lower; *p; p++) *p = (char)tolower((unsigned char)*p);
+    for (int i = 0; unsure_phrases[i]; i++) {
+        if (strstr(lower, unsure_phrases[i])) {
+            free(lower);
+            return "low confidence";
+        }
+    }
+    free(lower);
+    
+    int parsed = 0, commands = 0;
+    const char *line = response;
+    while (*line) {
+        while (isspace((unsigned char)*line)) line++;
+        size_t len = strcspn(line, "\n");
+        for (int i = 0; response_prefixes[i]; i++) {
+            if (strncmp(line, response_prefixes[i], strlen(response_prefixes[i])) == 0) parsed++;
+        }
+        if (strncmp(line, "COMMAND:", 8) == 0) {
+            char cmd[1024];
+            snprintf(cmd, sizeof(cmd), "%.*s", (int)(len - 8), line + 8);
+            if (!command_exists(cmd)) return "command not found";
+            commands++;
+        }
+        line += len;
+    }
+    if (!parsed) return "no parseable answer";
+    if (task == TASK_SHELL_COMMAND && !commands) return "no COMMAND: line";
+    return NULL;
+}
+
+/* Ask the fast model; returns its answer if it passes, else NULL */
+static char *cascade_fast_answer(const char *input, const AIConversation *conv, TaskType task,
+                                 const AIClient *client, const char *fast) {
+    AIClient fast_client = *client;
+    snprintf(fast_client.model, sizeof(fast_client.model), "%s", fast);
+    AIResponse *response = ai_client_query(&fast_client, input, conv, NULL, NULL);
+    
+    const char *reason = response && response->success && response->content ?
+                         cascade_reject_reason(task, response->content) : "no answer";
+    char *answer = NULL;
+    if (!reason) {
+        answer = strdup(response->content);
+    } else {
+        char note[512];
+        snprintf(note, sizeof(note), "(%s: %s, asking %s)\n", fast, reason, client->model);
+        _puts(COLOR_YELLOW);
+        _puts(note);
+        _puts(COLOR_RESET);
+    }
+    ai_response_free(response);
+    return answer;
+}
+
+/* Everything decided about a query before its request is sent */
+typedef struct {
+    TaskType task;
+    AIClient client;
+    AIConversation conv;    /* Points into buffers the next plan reuses */
+    char context_key[32];
+} AIQueryPlan;
+
+/*
+ * Front half of a query, shared by foreground and background ones. An
+ * answer that needs no request (local template or a response cache) is
+ * noted, logged and returned; otherwise NULL, with the request in plan.
+ */
+static char *plan_ai_query(const char *input, AIQueryPlan *plan)
+{
+    /* Common requests are answered by a local template, with no AI request at all */
+    char *local = intent_match(input);
+    if (local) {
+        _puts(COLOR_CYAN);
+        _puts("(local)\n");
+        _puts(COLOR_RESET);
+        audit_log(AUDIT_AI_RESPONSE, local);
+        return local;
+    }
+    
+    /* Detect task type for intelligent model selection */
+    plan->task = ai_detect_task_type(input);
+    
+    /* The best backend and model for this task type, chosen for this query only */
+    ai_client_init(&plan->client);
+    ai_client_select_model(&plan->client, plan->task);
+    AIBackendType backend = plan->client.backend;
+    const char *model = plan->client.model;
+    
+    /* Build context-enhanced query with task-optimized prompt */
+    plan->conv = build_context(plan->task, input, backend, model);
+    snprintf(plan->context_key, sizeof(plan->context_key), "%016llx", ai_conversation_hash(&plan->conv));
     
     /* Log the AI query with task type */
     char log_msg[512];
-    snprintf(log_msg, sizeof(log_msg), "[%s] %s", ai_get_task_type_name(task), input);
+    snprintf(log_msg, sizeof(log_msg), "[%s] %s", ai_get_task_type_name(plan->task), input);
     audit_log(AUDIT_AI_QUERY, log_msg);
     
+    /* Serve repeated questions from the response cache */
+    char *cached = ai_cache_lookup(backend, model, plan->task, input, plan->context_key);
+    if (cached) {
+        _puts(COLOR_CYAN);
+        _puts("(cached)\n");
+        _puts(COLOR_RESET);
+        audit_log(AUDIT_AI_RESPONSE, cached);
+        return cached;
+    }
+    
+    /* Or the answer to a differently worded question of the same kind */
+    float similarity = 0.0f;
+    char *similar = ai_semcache_lookup(plan->task, input, &similarity);
+    if (similar) {
+        char note[64];
+        snprintf(note, sizeof(note), "(cached, %.0f%% similar)\n", similarity * 100.0f);
+        _puts(COLOR_CYAN);
+        _puts(note);
+        _puts(COLOR_RESET);
+        audit_log(AUDIT_AI_RESPONSE, similar);
+        return similar;
+    }
+    return NULL;
+}
+
+/* Log a fresh answer and keep it in the response caches */
+static void remember_ai_answer(const char *input, TaskType task, const AIClient *client,
+                               const char *context_key, const char *answer)
+{
+    audit_log(AUDIT_AI_RESPONSE, answer);
+    ai_cache_store(client->backend, client->model, task, input, context_key, answer);
+    ai_semcache_store(task, input, answer);
+}
+
+static void report_ai_error(const AIResponse *response)
+{
+    if (!response || !response->error_message) return;
+    audit_log(AUDIT_ERROR, response->error_message);
+    _puts(COLOR_RED);
+    _puts("AI Error: ");
+    _puts(response->error_message);
+    _puts("\n");
+    _puts(COLOR_RESET);
+}
+
+/* Get AI command, passing response text to on_text while it streams in */
+static char *get_ai_command_stream(const char *input, AIStreamCallback on_text, void *userdata)
+{
+    AIQueryPlan plan;
+    char *ready = plan_ai_query(input, &plan);
+    if (ready) {
+        if (on_text) on_text(ready, strlen(ready), userdata);
+        return ready;
+    }
+    
+    /* Cascade: a fast model answers first; the chosen one only if that answer is rejected */
+    const char *fast = ai_get_cascade() && cascade_applies(plan.task, input) ?
+                       ai_get_fast_model(plan.client.backend, plan.task) : NULL;
+    if (fast && strcmp(fast, plan.client.model) != 0) {
+        char *answer = cascade_fast_answer(input, &plan.conv, plan.task, &plan.client, fast);
+        if (answer) {
+            remember_ai_answer(input, plan.task, &plan.client, plan.context_key, answer);
+            if (on_text) on_text(answer, strlen(answer), userdata);
+            return answer;
+        }
+    }
+    
     /* Query AI with the new backend system */
-    AIResponse *response = ai_query(input, context_query);
+    AIResponse *response = ai_client_query(&plan.client, input, &plan.conv, on_text, userdata);
     
     if (response && response->success && response->content) {
-        audit_log(AUDIT_AI_RESPONSE, response->content);
+        remember_ai_answer(input, plan.task, &plan.client, plan.context_key, response->content);
         char *result = strdup(response->content);
         ai_response_free(response);
         return result;
     }
     
-    if (response && response->error_message) {
-        audit_log(AUDIT_ERROR, response->error_message);
-        _puts(COLOR_RED);
-        _puts("AI Error: ");
-        _puts(response->error_message);
-        _puts("\n");
-        _puts(COLOR_RESET);
-    }
-    
+    report_ai_error(response);
     ai_response_free(response);
     return NULL;
 }   
 
+/* Get AI command using the multi-backend system */
+char *get_ai_command(const char *input)
+{
+    return get_ai_command_stream(input, NULL, NULL);
+}
+
 void expand_variables(char **args)
 {
     if (!args)
@@ -156,10 +510,31 @@ void expand_tilde(char **args)
     }
 }
 
-void execute_single_command(char *cmd) {
-    /* Use the safety module for risk analysis */
-    RiskAnalysis *analysis = analyze_risk(cmd);
-    
+/* Run a command in this process: builtins, pipelines or a plain exec */
+static void run_command(char *cmd) {
+    char **args = splitstring(cmd, " \n");
+    expand_tilde(args);
+    expand_variables(args);
+
+    void (*builtin_func)(char **) = args[0] ? checkbuild(args) : NULL;
+    if (builtin_func) {
+        builtin_func(args);
+    } else {
+        if (contains_pipes(cmd)) {
+            char ***pipeline = parse_pipeline(cmd);
+            execute_pipeline(pipeline);
+            for (int i = 0; pipeline[i]; i++)
+                freearv(pipeline[i]);
+            free(pipeline);
+        } else {
+            execute(args);
+        }
+    }
+    freearv(args);
+}
+
+/* Apply the safety checks for an analyzed command, then run it (takes analysis) */
+static void execute_analyzed_command(char *cmd, RiskAnalysis *analysis) {
     if (analysis->blocked) {
         _puts(COLOR_RED);
         _puts("⛔ Security: Command BLOCKED\n");
@@ -201,25 +576,12 @@ void execute_single_command(char *cmd) {
     /* Log command execution */
     audit_log(AUDIT_COMMAND_EXEC, cmd);
     
-    char **args = splitstring(cmd, " \n");
-    expand_tilde(args);
-    expand_variables(args);
+    run_command(cmd);
+}
 
-    void (*builtin_func)(char **) = checkbuild(args);
-    if (builtin_func) {
-        builtin_func(args);
-    } else {
-        if (contains_pipes(cmd)) {
-            char ***pipeline = parse_pipeline(cmd);
-            execute_pipeline(pipeline);
-            for (int i = 0; pipeline[i]; i++)
-                freearv(pipeline[i]);
-            free(pipeline);
-        } else {
-            execute(args);
-        }
-    }
-    freearv(args);
+void execute_single_command(char *cmd) {
+    /* Use the safety module for risk analysis */
+    execute_analyzed_command(cmd, analyze_risk(cmd));
 }
 
 void execute_scan_command(char *scan_cmd) {
@@ -249,7 +611,378 @@ void execute_scan_command(char *scan_cmd) {
     }
 }
 
-void handle_ai_response(char *response) {
+/* Streaming line states */
+enum {
+    STREAM_LINE_PENDING = 0,   /* Prefix not known yet */
+    STREAM_LINE_EXPLAIN_START, /* EXPLAIN: seen, skipping blanks before the text */
+    STREAM_LINE_EXPLAIN,       /* Printing explanation text as it arrives */
+    STREAM_LINE_COMMAND,       /* Collecting a COMMAND: line for the queue */
+    STREAM_LINE_HELD           /* Other prefix - collected, acted on once the response completes */
+};
+
+/* COMMAND: line analyzed while the response was still streaming, or a held line */
+typedef struct {
+    char *cmd;
+    RiskAnalysis *analysis;
+    int started;    /* Already launched early */
+    int held;       /* Whole SCAN:/VULN:/CTF: line; runs, in its place, once the response is complete */
+} QueuedCommand;
+
+/* Renders explanations and queues commands while the response streams in */
+typedef struct {
+    char pending[16];
+    size_t pending_len;
+    int state;
+    int rendered;   /* Set once any text reached the dispatcher */
+    
+    char *line;     /* Current COMMAND: text, or held line */
+    size_t line_len;
+    size_t line_cap;
+    
+    QueuedCommand *queue;
+    int queue_count;
+    int next;       /* First queued command not yet started */
+    pid_t running;  /* Early command still executing, or 0 */
+    int early_stopped;
+    
+    char **ran;     /* Started early from an interrupted answer; NULL once repeated */
+    int ran_count;
+    int restarted;  /* The backend withdrew an answer for a fallback */
+} StreamDispatcher;
+
+/* Print n bytes */
+static void stream_write(const char *text, size_t len) {
+    for (size_t i = 0; i < len; i++) _putchar(text[i]);
+}
+
+/* Builtins change shell state, so they never run in a child */
+static int is_builtin_command(char *cmd) {
+    char **args = splitstring(cmd, " \n");
+    int builtin = args[0] && checkbuild(args);
+    freearv(args);
+    return builtin;
+}
+
+/* Wait for the early command, if one is running */
+static void stream_wait_running(StreamDispatcher *d, int block) {
+    if (!d->running) return;
+    if (waitpid(d->running, NULL, block ? 0 : WNOHANG) != 0) {
+        d->running = 0;
+    }
+}
+
+/* Start queued commands early, one at a time and strictly in order */
+static void stream_start_ready(StreamDispatcher *d) {
+    stream_wait_running(d, 0);
+    
+    while (!d->early_stopped && !d->running && d->next < d->queue_count) {
+        QueuedCommand *q = &d->queue[d->next];
+        if (q->started) {
+            d->next++;
+            continue;
+        }
+        if (q->held) break;
+        
+        /* Anything that needs a decision stops early execution from here on */
+        if (!safety_allows_early_exec(q->analysis) || is_builtin_command(q->cmd)) {
+            d->early_stopped = 1;
+            break;
+        }
+        
+        audit_log(AUDIT_COMMAND_EXEC, q->cmd);
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("fork");
+            d->early_stopped = 1;
+            break;
+        }
+        if (pid == 0) {
+            signal(SIGINT, SIG_DFL);
+            run_command(q->cmd);
+            _exit(0);
+        }
+        q->started = 1;
+        d->running = pid;
+        d->next++;
+    }
+}
+
+/* Did an interrupted answer already run cmd early? Each run excuses one repeat */
+static int stream_already_ran(StreamDispatcher *d, const char *cmd) {
+    for (int i = 0; i < d->ran_count; i++) {
+        if (d->ran[i] && strcmp(d->ran[i], cmd) == 0) {
+            free(d->ran[i]);
+            d->ran[i] = NULL;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* A complete COMMAND: line arrived - analyze it now and queue it; held lines queue as they are */
+static void stream_queue_command(StreamDispatcher *d, int held) {
+    char *cmd = d->line ? d->line : "";
+    while (isspace((unsigned char)*cmd)) cmd++;
+    if (!*cmd) return;
+    
+    QueuedCommand *queue = realloc(d->queue, sizeof(QueuedCommand) * (d->queue_count + 1));
+    if (!queue) return;
+    d->queue = queue;
+    
+    QueuedCommand *q = &d->queue[d->queue_count++];
+    q->cmd = strdup(cmd);
+    q->analysis = held ? NULL : analyze_risk(q->cmd);
+    q->started = held ? 0 : stream_already_ran(d, q->cmd);
+    q->held = held;
+    
+    stream_start_ready(d);
+}
+
+/* Close the current line, mirroring what handle_explanation prints */
+static void stream_end_line(StreamDispatcher *d) {
+    switch (d->state) {
+        case STREAM_LINE_PENDING:
+            if (d->pending_len > 0) {
+                /* Short line without a prefix - an explanation */
+                _puts("\nExplanation:\n  ");
+                stream_write(d->pending, d->pending_len);
+                _puts("\n");
+            }
+            break;
+        case STREAM_LINE_EXPLAIN_START:
+            _puts("\nExplanation:\n");
+            break;
+        case STREAM_LINE_EXPLAIN:
+            _puts("\n");
+            break;
+        case STREAM_LINE_COMMAND:
+        case STREAM_LINE_HELD:
+            stream_queue_command(d, d->state == STREAM_LINE_HELD);
+            break;
+        default:
+            break;
+    }
+    d->state = STREAM_LINE_PENDING;
+    d->pending_len = 0;
+    d->line_len = 0;
+    if (d->line) d->line[0] = '\0';
+}
+
+/* Collect COMMAND: (or held) text until its newline arrives */
+static void stream_append_command(StreamDispatcher *d, const char *text, size_t len) {
+    if (d->line_len + len + 1 > d->line_cap) {
+        size_t cap = d->line_cap ? d->line_cap : 256;
+        while (cap < d->line_len + len + 1) cap *= 2;
+        char *line = realloc(d->line, cap);
+        if (!line) return;
+        d->line = line;
+        d->line_cap = cap;
+    }
+    memcpy(d->line + d->line_len, text, len);
+    d->line_len += len;
+    d->line[d->line_len] = '\0';
+}
+
+/* Is the current line text kept for later rather than printed? */
+static int stream_collecting(const StreamDispatcher *d) {
+    return d->state == STREAM_LINE_COMMAND || d->state == STREAM_LINE_HELD;
+}
+
+/* Decide what the current line is once enough of it has arrived */
+static void stream_classify(StreamDispatcher *d) {
+    int could_match = 0;
+    
+    for (int i = 0; response_prefixes[i]; i++) {
+        size_t plen = strlen(response_prefixes[i]);
+        if (d->pending_len == plen &&
+            memcmp(d->pending, response_prefixes[i], plen) == 0) {
+            if (strcmp(response_prefixes[i], "EXPLAIN:") == 0)
+                d->state = STREAM_LINE_EXPLAIN_START;
+            else if (strcmp(response_prefixes[i], "COMMAND:") == 0)
+                d->state = STREAM_LINE_COMMAND;
+            else {
+                /* Acted on later from the whole line, prefix included */
+                d->state = STREAM_LINE_HELD;
+                stream_append_command(d, d->pending, d->pending_len);
+            }
+            d->pending_len = 0;
+            return;
+        }
+        if (d->pending_len < plen &&
+            memcmp(d->pending, response_prefixes[i], d->pending_len) == 0) {
+            could_match = 1;
+        }
+    }
+    
+    if (!could_match) {
+        /* Not a prefix - plain text defaults to an explanation */
+        _puts("\nExplanation:\n  ");
+        stream_write(d->pending, d->pending_len);
+        d->state = STREAM_LINE_EXPLAIN;
+        d->pending_len = 0;
+    }
+}
+
+/*
+ * The backend gave up on the answer streaming in and asks a fallback.
+ * Its half line and the commands it queued are dropped; commands already
+ * started cannot be taken back, so they are remembered and not run again
+ * when the new answer repeats them.
+ */
+static void stream_restart(StreamDispatcher *d) {
+    d->restarted = 1;
+    if (!d->rendered) return;
+    
+    if (d->state == STREAM_LINE_EXPLAIN || d->state == STREAM_LINE_EXPLAIN_START) _puts("\n");
+    d->state = STREAM_LINE_PENDING;
+    d->pending_len = 0;
+    d->line_len = 0;
+    if (d->line) d->line[0] = '\0';
+    
+    int started = 0;
+    for (int i = 0; i < d->queue_count; i++) {
+        QueuedCommand *q = &d->queue[i];
+        risk_analysis_free(q->analysis);
+        if (q->started) {
+            char **ran = realloc(d->ran, sizeof(char *) * (d->ran_count + 1));
+            if (ran) {
+                d->ran = ran;
+                d->ran[d->ran_count++] = q->cmd;
+                started++;
+                continue;
+            }
+        }
+        free(q->cmd);
+    }
+    d->queue_count = 0;
+    d->next = 0;
+    d->early_stopped = 0;
+    d->rendered = 0;
+    
+    char note[160];
+    snprintf(note, sizeof(note), COLOR_YELLOW "[Answer broke off; asking another backend.%s]\n" COLOR_RESET,
+             started ? " Commands it already ran are not repeated." : "");
+    _puts(note);
+}
+
+/* AIStreamCallback: render and dispatch streamed text line by line */
+static void stream_dispatch_text(const char *text, size_t len, void *userdata) {
+    StreamDispatcher *d = (StreamDispatcher *)userdata;
+    size_t run_start = 0;
+    
+    if (!text) {
+        stream_restart(d);
+        return;
+    }
+    d->rendered = 1;
+    for (size_t i = 0; i < len; i++) {
+        char c = text[i];
+        
+        if (c == '\n') {
+            if (d->state == STREAM_LINE_EXPLAIN && i > run_start) {
+                stream_write(text + run_start, i - run_start);
+            } else if (stream_collecting(d) && i > run_start) {
+                stream_append_command(d, text + run_start, i - run_start);
+            }
+            stream_end_line(d);
+            run_start = i + 1;
+            continue;
+        }
+        
+        switch (d->state) {
+            case STREAM_LINE_PENDING:
+                if (d->pending_len == 0 && isspace((unsigned char)c)) break;
+                d->pending[d->pending_len++] = c;
+                stream_classify(d);
+                run_start = i + 1;  /* Already printed if it became an explanation */
+                break;
+            case STREAM_LINE_EXPLAIN_START:
+                if (isspace((unsigned char)c)) break;
+                _puts("\nExplanation:\n  ");
+                d->state = STREAM_LINE_EXPLAIN;
+                run_start = i;
+                break;
+            default:
+                break;
+        }
+        
+        /* Explanation and command text are consumed in runs, not byte by byte */
+        if (d->state != STREAM_LINE_EXPLAIN && !stream_collecting(d))
+            run_start = i + 1;
+    }
+    
+    if (d->state == STREAM_LINE_EXPLAIN && len > run_start) {
+        stream_write(text + run_start, len - run_start);
+    } else if (stream_collecting(d) && len > run_start) {
+        stream_append_command(d, text + run_start, len - run_start);
+    }
+    
+    /* Pick up an early command that finished while text was arriving */
+    if (d->running) stream_start_ready(d);
+}
+
+/* Act on a SCAN:, VULN: or CTF: line; 0 if it is none of them */
+static int dispatch_held_line(char *line) {
+    if (strstr(line, "SCAN:") == line) {
+        char *scan_cmd = line + 5;
+        while (isspace(*scan_cmd)) scan_cmd++;
+        
+        _puts(COLOR_CYAN);
+        _puts("Executing scan: ");
+        _puts(scan_cmd);
+        _puts("\n");
+        _puts(COLOR_RESET);
+        
+        execute_scan_command(scan_cmd);
+    }
+    else if (strstr(line, "VULN:") == line) {
+        char *vuln_info = line + 5;
+        while (isspace(*vuln_info)) vuln_info++;
+        
+        research_vulnerability(vuln_info);
+    }
+    else if (strstr(line, "CTF:") == line) {
+        char *ctf_info = line + 4;
+        while (isspace(*ctf_info)) ctf_info++;
+        
+        ctf_assistance(ctf_info);
+    }
+    else {
+        return 0;
+    }
+    return 1;
+}
+
+/* End of stream: finish the last line, then run what is still queued, in the answer's order */
+static void stream_dispatch_finish(StreamDispatcher *d, int run_queued) {
+    if (d->rendered) stream_end_line(d);
+    
+    stream_wait_running(d, 1);
+    for (int i = 0; i < d->queue_count; i++) {
+        QueuedCommand *q = &d->queue[i];
+        if (q->held) {
+            if (run_queued) dispatch_held_line(q->cmd);
+        } else if (!q->started && run_queued) {
+            execute_analyzed_command(q->cmd, q->analysis);
+        } else {
+            risk_analysis_free(q->analysis);
+        }
+        free(q->cmd);
+    }
+    for (int i = 0; i < d->ran_count; i++) free(d->ran[i]);
+    free(d->ran);
+    free(d->queue);
+    free(d->line);
+    d->queue = NULL;
+    d->queue_count = 0;
+    d->ran = NULL;
+    d->ran_count = 0;
+    d->line = NULL;
+}
+
+/* Act on each response line in order */
+static void dispatch_ai_response(char *response) {
     char *saveptr;
     char *line = strtok_r(response, "\n", &saveptr);
     
@@ -269,29 +1002,8 @@ void handle_ai_response(char *response) {
             
             handle_explanation(explanation);
         }
-        else if (strstr(line, "SCAN:") == line) {
-            char *scan_cmd = line + 5;
-            while (isspace(*scan_cmd)) scan_cmd++;
-            
-            _puts(COLOR_CYAN);
-            _puts("Executing scan: ");
-            _puts(scan_cmd);
-            _puts("\n");
-            _puts(COLOR_RESET);
-            
-            execute_scan_command(scan_cmd);
-        }
-        else if (strstr(line, "VULN:") == line) {
-            char *vuln_info = line + 5;
-            while (isspace(*vuln_info)) vuln_info++;
-            
-            research_vulnerability(vuln_info);
-        }
-        else if (strstr(line, "CTF:") == line) {
-            char *ctf_info = line + 4;
-            while (isspace(*ctf_info)) ctf_info++;
-            
-            ctf_assistance(ctf_info);
+        else if (dispatch_held_line(line)) {
+            /* Scan, vulnerability or CTF line */
         }
         else if (strlen(line) > 0) {
             // Default to explanation for non-empty lines without prefix
@@ -302,21 +1014,125 @@ void handle_ai_response(char *response) {
     }
 }
 
+void handle_ai_response(char *response) {
+    dispatch_ai_response(response);
+}
+
 void handle_ai_command(char *input) {
     char *clean_input = input + (input[0] == '\'' ? 1 : (strstr(input, "ai:") == input ? 3 : 0));
     clean_input[strcspn(clean_input, "\n")] = 0;
     add_custom_history(&hist, clean_input);
     
-    char *response = get_ai_command(clean_input);
+    /* A trailing '&' (not '&&') sends the question to the background */
+    size_t len = strlen(clean_input);
+    while (len > 0 && isspace((unsigned char)clean_input[len - 1])) len--;
+    if (len > 1 && clean_input[len - 1] == '&' && clean_input[len - 2] != '&') {
+        clean_input[--len] = '\0';
+        while (len > 0 && isspace((unsigned char)clean_input[len - 1])) clean_input[--len] = '\0';
+        if (len > 0) {
+            handle_ai_background(clean_input);
+            return;
+        }
+    }
+    
+    /* Render explanations and queue commands while the model is generating */
+    StreamDispatcher dispatcher = {0};
+    char *response = ai_get_streaming() ?
+        get_ai_command_stream(clean_input, stream_dispatch_text, &dispatcher) :
+        get_ai_command(clean_input);
+    /* A fallback's answer arrives whole; it still goes past what the broken one ran */
+    if (response && dispatcher.restarted && !dispatcher.rendered) {
+        stream_dispatch_text(response, strlen(response), &dispatcher);
+    }
+    stream_dispatch_finish(&dispatcher, response != NULL);
+    
     if (response) {
         add_to_session_memory(clean_input, response);
-        handle_ai_response(response);  // Process the AI response
+        /* A streamed answer was acted on line by line as it came */
+        if (!dispatcher.rendered) dispatch_ai_response(response);
         free(response);
     } else {
         _puts("AI request failed\n");
     }
 }
 
+/*
+ * Send a question as a background job and return to the prompt. An answer
+ * that needs no request (local template, cache) is acted on at once.
+ */
+void handle_ai_background(const char *input) {
+    AIQueryPlan plan;
+    char *ready = plan_ai_query(input, &plan);
+    if (ready) {
+        add_to_session_memory(input, ready);
+        dispatch_ai_response(ready);
+        free(ready);
+        return;
+    }
+    
+    char note[384];
+    int id = ai_job_submit(&plan.client, plan.task, input, &plan.conv);
+    if (id < 0) {
+        snprintf(note, sizeof(note), COLOR_RED "Too many background AI jobs (%d); collect one with 'ai fg'\n"
+                 COLOR_RESET, AI_JOB_MAX);
+    } else {
+        snprintf(note, sizeof(note), COLOR_CYAN "[%d]" COLOR_RESET " sent to %s (%s)\n",
+                 id, ai_get_backend_name(plan.client.backend), plan.client.model);
+    }
+    _puts(note);
+}
+
+/* Report background jobs that finished since the last prompt */
+static void announce_ai_jobs(void) {
+    const AIJob *job;
+    while ((job = ai_job_next_finished())) {
+        /* Cached and logged here, on the shell's thread, not by the worker */
+        if (job->state == AI_JOB_DONE) {
+            char context_key[32];
+            snprintf(context_key, sizeof(context_key), "%016llx", ai_conversation_hash(&job->conv));
+            remember_ai_answer(job->prompt, job->task, &job->client, context_key, job->response->content);
+        }
+        ai_job_announce(job);
+    }
+}
+
+/* ai fg [n]: act on a background job's answer, waiting for it if it is still running */
+static void ai_fg_command(const char *arg) {
+    int id = 0;
+    if (arg) {
+        id = atoi(arg[0] == '%' ? arg + 1 : arg);
+        if (id <= 0) {
+            _puts("Usage: ai fg [job number]\n");
+            return;
+        }
+    }
+    
+    AIJob *job = ai_job_claim(id);
+    if (!job) {
+        _puts(id ? "No such background AI job\n" : "No background AI jobs\n");
+        return;
+    }
+    
+    _puts(COLOR_CYAN);
+    _puts("➤ ");
+    _puts(job->prompt);
+    _puts("\n");
+    _puts(COLOR_RESET);
+    if (job->state == AI_JOB_DONE) {
+        if (!job->announced) {
+            char context_key[32];
+            snprintf(context_key, sizeof(context_key), "%016llx", ai_conversation_hash(&job->conv));
+            remember_ai_answer(job->prompt, job->task, &job->client, context_key, job->response->content);
+        }
+        add_to_session_memory(job->prompt, job->response->content);
+        dispatch_ai_response(job->response->content);
+    } else {
+        report_ai_error(job->response);
+        _puts("AI request failed\n");
+    }
+    ai_job_free(job);
+}
+
 
 
 void handle_explanation(const char *text)
@@ -380,32 +1196,29 @@ void analyze_scan_results(const char *scan_output) {
     // Example parsing logic (you'd expand this)
     if (strstr(scan_output, "open")) {
         _puts("Found open ports:\n");
-        // Extract port numbers and services
-        // This is simplified - you'd want proper parsing
+        
+        /* Collect distinct services with version info, researched in batches below */
+        VulnBatch batch;
+        vuln_batch_init(&batch);
+        
         char *copy = strdup(scan_output);
-        char *line = strtok(copy, "\n");
+        char *saveptr;
+        char *line = strtok_r(copy, "\n", &saveptr);
         
         while (line) {
             if (strstr(line, "open")) {
                 _puts("  ");
                 _puts(line);
                 _puts("\n");
-                
-                /* Check for version info */
-                if (strstr(line, "version")) {
-                    char service[128];  /* %127s + null terminator */
-                    char version[128];  /* %127s + null terminator */
-                    /* Extract service and version (simplified) */
-                    if (sscanf(line, "%*d/tcp open %127s %127s", service, version) == 2) {
-                        char query[512];
-                        snprintf(query, sizeof(query), "VULN: %s %s", service, version);
-                        handle_ai_command(query);
-                    }
-                }
+                vuln_batch_add_line(&batch, line);
             }
-            line = strtok(NULL, "\n");
+            line = strtok_r(NULL, "\n", &saveptr);
         }
         free(copy);
+        _puts(COLOR_RESET);
+        
+        vuln_batch_research(&batch);
+        vuln_batch_free(&batch);
     } else {
         _puts("No open ports found\n");
     }
@@ -463,15 +1276,55 @@ void ctf_assistance(const char *challenge_info) {
     _puts(COLOR_RESET);
 }
 
-int main(void)
+/* Milliseconds on the monotonic clock */
+static double startup_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/* Run one startup step, printing its duration when tracing */
+static void startup_step(int trace, const char *name, void (*step)(void)) {
+    double start = startup_clock_ms();
+    step();
+    fflush(stdout);
+    if (trace) {
+        char line[128];
+        snprintf(line, sizeof(line), "  %-18s %8.2f ms\n", name, startup_clock_ms() - start);
+        _puts(line);
+    }
+}
+
+int main(int argc, char **argv)
 {
+    int trace = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--startup-trace") == 0) trace = 1;
+        if (strcmp(argv[i], "--no-local") == 0) intent_set_enabled(0);
+    }
+    
+    double start = startup_clock_ms();
+    if (trace) {
+        _puts(COLOR_CYAN);
+        _puts("Startup trace:\n");
+        _puts(COLOR_RESET);
+    }
+    
     /* Initialize all modules */
-    ai_backend_init();
-    lang_detect_init();
-    safety_init();
-    audit_init();
+    startup_step(trace, "ai_backend_init", ai_backend_init);
+    startup_step(trace, "ai_cache_init", ai_cache_init);
+    startup_step(trace, "ai_semcache_init", ai_semcache_init);
+    startup_step(trace, "lang_detect_init", lang_detect_init);
+    startup_step(trace, "safety_init", safety_init);
+    startup_step(trace, "audit_init", audit_init);
+    startup_step(trace, "intent_init", intent_init);
+    startup_step(trace, "display_logo", display_logo);
     
-    display_logo();
+    if (trace) {
+        char line[128];
+        snprintf(line, sizeof(line), "  %-18s %8.2f ms\n", "total", startup_clock_ms() - start);
+        _puts(line);
+    }
     
     /* Initialize history */
     hist.items = malloc(sizeof(char *) * MAX_HISTORY);
@@ -483,6 +1336,7 @@ int main(void)
 
     while (1)
     {
+        announce_ai_jobs();
 
         char *prompt = generate_prompt();
         char *input = readline(prompt);
@@ -578,14 +1432,72 @@ int main(void)
     
     /* Cleanup */
     free(hist.items);
+    strbuf_free(&context_buf);
+    ai_jobs_cleanup();
     ai_backend_cleanup();
+    ai_cache_cleanup();
+    ai_semcache_cleanup();
     lang_detect_cleanup();
     safety_cleanup();
     audit_cleanup();
+    intent_cleanup();
     
     return 0;
 }
 
+/* ai model opts [<key> <value>|default]: Ollama runtime options of the current model */
+static void ollama_opts_command(char **args)
+{
+    const char *model = ai_get_model();
+    
+    if (args[3]) {
+        if (!args[4]) {
+            _puts("Usage: ai model opts <keep_alive|num_ctx|num_thread|num_predict> <value|default>\n");
+            return;
+        }
+        int result = ollama_opts_set(model, args[3], args[4]);
+        if (result == -1) {
+            _puts(COLOR_RED);
+            _puts("Invalid option. Keys: keep_alive (e.g. 30m, -1), num_ctx, num_thread, num_predict\n");
+            _puts(COLOR_RESET);
+            return;
+        }
+        if (result == -2) {
+            _puts(COLOR_YELLOW);
+            _puts("Could not save ");
+            _puts(ollama_opts_path());
+            _puts("; the option applies to this session only\n");
+            _puts(COLOR_RESET);
+        }
+    }
+    
+    OllamaOpts opts;
+    ollama_opts_get(model, &opts);
+    char line[256];
+    _puts(COLOR_CYAN);
+    _puts("Ollama options for ");
+    _puts(model);
+    _puts(":\n");
+    _puts(COLOR_RESET);
+    snprintf(line, sizeof(line), "  keep_alive   %s\n", opts.keep_alive);
+    _puts(line);
+    const char *names[3] = {"num_ctx", "num_thread", "num_predict"};
+    long values[3] = {opts.num_ctx, opts.num_thread, opts.num_predict};
+    for (int i = 0; i < 3; i++) {
+        if (values[i]) snprintf(line, sizeof(line), "  %-12s %ld\n", names[i], values[i]);
+        else snprintf(line, sizeof(line), "  %-12s server default\n", names[i]);
+        _puts(line);
+    }
+    snprintf(line, sizeof(line), "  Context budget: %d tokens\n",
+             ai_get_context_budget(AI_BACKEND_OLLAMA, model));
+    _puts(line);
+    if (ollama_opts_path()[0]) {
+        _puts("  Config: ");
+        _puts(ollama_opts_path());
+        _puts("\n");
+    }
+}
+
 /* AI builtin command - manage AI backends */
 void ai_builtin(char **args) {
     if (!args[1]) {
@@ -602,6 +1514,18 @@ void ai_builtin(char **args) {
         _puts("  ai model <name>- Change model\n");
         _puts("  ai models      - List Ollama models (if available)\n");
         _puts("  ai detect      - Show model detection status\n");
+        _puts("  ai stream on|off - Toggle token streaming\n");
+        _puts("  ai early on|off  - Run safe commands while the AI is still responding\n");
+        _puts("  ai cache [stats|clear|on|off] - Manage the response cache\n");
+        _puts("  ai cache semantic on|off - Reuse answers to similar questions (Ollama embeddings)\n");
+        _puts("  ai hedge on|off  - Race a backup backend when the primary is slow\n");
+        _puts("  ai cascade on|off - Try a fast model first; escalate if its answer fails checks\n");
+        _puts("  ai local on|off  - Answer common requests from local templates, offline\n");
+        _puts("  ai bg <prompt>   - Ask in the background (or end a question with &)\n");
+        _puts("  ai jobs          - List background questions\n");
+        _puts("  ai fg [n]        - Show and act on a background answer\n");
+        _puts("  ai models refresh - Re-read the Ollama model list\n");
+        _puts("  ai model opts [key value] - Ollama keep_alive/num_ctx/num_thread/num_predict\n");
         return;
     }
     
@@ -611,6 +1535,10 @@ void ai_builtin(char **args) {
     }
     
     if (strcmp(args[1], "models") == 0) {
+        /* 'ai models refresh' drops the cached listing first */
+        if (args[2] && strcmp(args[2], "refresh") == 0) {
+            ai_ollama_invalidate_models();
+        }
         /* List Ollama models if backend is Ollama, otherwise show message */
         if (ai_get_active_backend() == AI_BACKEND_OLLAMA || ai_ollama_check_available()) {
             ai_list_ollama_models();
@@ -694,6 +1622,20 @@ void ai_builtin(char **args) {
         _puts(COLOR_RESET);
         _puts("\n");
         
+        _puts("Local:    ");
+        if (ai_backend_available(AI_BACKEND_LOCAL)) {
+            char local_str[64];
+            snprintf(local_str, sizeof(local_str), "✓ In-process (%d-token context)",
+                     ai_local_context_size());
+            _puts(COLOR_GREEN);
+            _puts(local_str);
+        } else {
+            _puts(COLOR_YELLOW);
+            _puts(ai_local_supported() ? "○ Not configured" : "○ Not built in");
+        }
+        _puts(COLOR_RESET);
+        _puts("\n");
+        
         _puts("───────────────────────────\n");
         _puts("Active: ");
         _puts(COLOR_GREEN);
@@ -702,13 +1644,159 @@ void ai_builtin(char **args) {
         _puts(" (");
         _puts(ai_get_model());
         _puts(")\n");
+
+        /* Connection pool reuse, only for backends that have been used */
+        int shown_header = 0;
+        for (int i = 0; i < AI_BACKEND_COUNT; i++) {
+            AIPoolStats stats;
+            ai_get_pool_stats((AIBackendType)i, &stats);
+            if (stats.handle_hits + stats.handle_misses == 0) continue;
+
+            if (!shown_header) {
+                _puts("\nConnection pool:\n");
+                shown_header = 1;
+            }
+            char line[256];
+            snprintf(line, sizeof(line),
+                     "  %-9s handles %ld hit / %ld miss, connections %ld reused / %ld new\n",
+                     ai_get_backend_name((AIBackendType)i),
+                     stats.handle_hits, stats.handle_misses,
+                     stats.conn_reused, stats.conn_new);
+            _puts(line);
+        }
+
+        AIFlightStats flight;
+        ai_get_flight_stats(&flight);
+        if (flight.shared > 0) {
+            char line[128];
+            snprintf(line, sizeof(line), "\nCoalesced queries: %ld of %ld shared a request\n",
+                     flight.shared, flight.queries);
+            _puts(line);
+        }
+
+        /* What auto routing knows, across sessions */
+        AIRouteStats routes[16];
+        int route_count = ai_router_get_stats(routes, 16);
+        if (route_count > 0) {
+            _puts(ai_get_auto_routing() ? "\nLatency (routing: auto):\n" : "\nLatency:\n");
+            for (int i = 0; i < route_count; i++) {
+                char line[256], pct[48] = "";
+                if (routes[i].p50_ms >= 0) {
+                    snprintf(pct, sizeof(pct), ", p50 %ld / p95 %ld ms",
+                             routes[i].p50_ms, routes[i].p95_ms);
+                }
+                snprintf(line, sizeof(line),
+                         "  %-9s %-28s %4ld req, first byte %.0f ms, total %.0f ms%s, "
+                         "errors %.0f%% (%ld timeouts)\n",
+                         ai_get_backend_name(routes[i].backend), routes[i].model,
+                         routes[i].requests, routes[i].ewma_ttfb_ms, routes[i].ewma_total_ms,
+                         pct, routes[i].ewma_error * 100.0, routes[i].timeouts);
+                _puts(line);
+            }
+        }
+
+        /* Circuit breakers, and the timeouts observed latency gives each backend */
+        shown_header = 0;
+        for (int i = 0; i < AI_BACKEND_COUNT; i++) {
+            AIBackendType type = (AIBackendType)i;
+            if (!ai_backend_available(type)) continue;
+            if (!shown_header) {
+                _puts("\nReliability:\n");
+                shown_header = 1;
+            }
+            AIBreakerStats breaker;
+            ai_breaker_get_stats(type, &breaker);
+            const char *model = type == ai_get_active_backend() ? ai_get_model() :
+                                ai_get_recommended_model(type, TASK_GENERAL);
+            long connect_ms, stall_ms, stream_stall_ms;
+            ai_get_timeouts(type, model, &connect_ms, &stall_ms, &stream_stall_ms);
+
+            char state[96], line[256];
+            if (breaker.state == BREAKER_OPEN) {
+                snprintf(state, sizeof(state), COLOR_RED "open" COLOR_RESET ", retry in %ld s",
+                         (breaker.retry_in_ms + 999) / 1000);
+            } else {
+                snprintf(state, sizeof(state), "%s, %d/%d recent failures",
+                         ai_breaker_state_name(breaker.state),
+                         breaker.window_failures, breaker.window_requests);
+            }
+            snprintf(line, sizeof(line), "  %-9s %s; timeouts connect %.1f s, silence %.1f s (streamed %.1f s)\n",
+                     ai_get_backend_name(type), state, connect_ms / 1000.0, stall_ms / 1000.0,
+                     stream_stall_ms / 1000.0);
+            _puts(line);
+        }
+
+        /* Backends spread over several servers */
+        for (int i = 0; i < AI_BACKEND_COUNT; i++) {
+            AIEndpointStats nodes[AI_ENDPOINT_MAX];
+            int node_count = ai_endpoint_get_stats((AIBackendType)i, nodes, AI_ENDPOINT_MAX);
+            if (node_count < 2) continue;
+
+            char line[384];
+            snprintf(line, sizeof(line), "\n%s endpoints (%s):\n",
+                     ai_get_backend_name((AIBackendType)i), ai_endpoint_policy_name());
+            _puts(line);
+            for (int n = 0; n < node_count; n++) {
+                char state[64], latency[48] = "", models[32] = "";
+                if (nodes[n].healthy) {
+                    snprintf(state, sizeof(state), COLOR_GREEN "up" COLOR_RESET);
+                } else {
+                    snprintf(state, sizeof(state), COLOR_RED "down" COLOR_RESET ", retry in %ld s",
+                             (nodes[n].retry_in_ms + 999) / 1000);
+                }
+                if (nodes[n].ewma_ms >= 0) {
+                    snprintf(latency, sizeof(latency), ", first byte %ld ms", nodes[n].ewma_ms);
+                }
+                if (nodes[n].models >= 0) {
+                    snprintf(models, sizeof(models), ", %d models", nodes[n].models);
+                }
+                snprintf(line, sizeof(line), "  %-32s %s; %d in flight, %ld req / %ld failed%s%s\n",
+                         nodes[n].url, state, nodes[n].outstanding,
+                         nodes[n].requests, nodes[n].failures, latency, models);
+                _puts(line);
+            }
+        }
+
+        /* Rate-limit buckets, shared by every dynamo on this host */
+        AIRateStats rates[8];
+        int rate_count = ai_ratelimit_get_stats(rates, 8);
+        if (rate_count > 0) _puts("\nRate limits (all sessions on this host):\n");
+        for (int i = 0; i < rate_count; i++) {
+            char pace[64] = "limit unknown", blocked[48] = "", line[256];
+            if (rates[i].per_minute > 0) {
+                if (rates[i].tokens >= 0) {
+                    snprintf(pace, sizeof(pace), "%.0f/min, %.0f free",
+                             rates[i].per_minute, rates[i].tokens);
+                } else {
+                    snprintf(pace, sizeof(pace), "%.0f/min, %.0f queued",
+                             rates[i].per_minute, -rates[i].tokens);
+                }
+            }
+            if (rates[i].blocked_ms > 0) {
+                snprintf(blocked, sizeof(blocked), ", paused %ld s", (rates[i].blocked_ms + 999) / 1000);
+            }
+            snprintf(line, sizeof(line), "  %-9s %s%s, %ld rate-limited answers\n",
+                     ai_get_backend_name(rates[i].backend), pace, blocked, rates[i].limited);
+            _puts(line);
+        }
+
+        AIModelCacheStats tags;
+        ai_ollama_get_cache_stats(&tags);
+        if (tags.fetches > 0) {
+            char line[160];
+            snprintf(line, sizeof(line),
+                     "\nOllama model list: %ld cached lookups, %ld fetches (%ld unchanged)\n",
+                     tags.hits, tags.fetches, tags.not_modified);
+            _puts(line);
+        }
         return;
     }
     
     if (strcmp(args[1], "use") == 0) {
         if (!args[2]) {
             _puts("Usage: ai use <backend_name>\n");
-            _puts("Available: gemini, openai, claude, deepseek, ollama\n");
+            _puts(ai_local_supported() ? "Available: gemini, openai, claude, deepseek, ollama, local, auto\n" :
+                  "Available: gemini, openai, claude, deepseek, ollama, auto\n");
             return;
         }
         if (ai_set_backend_by_name(args[2]) == 0) {
@@ -728,6 +1816,11 @@ void ai_builtin(char **args) {
         return;
     }
     
+    if (strcmp(args[1], "model") == 0 && args[2] && strcmp(args[2], "opts") == 0) {
+        ollama_opts_command(args);
+        return;
+    }
+    
     if (strcmp(args[1], "model") == 0) {
         if (!args[2]) {
             _puts("Current model: ");
@@ -744,7 +1837,168 @@ void ai_builtin(char **args) {
         return;
     }
     
-    _puts("Unknown ai subcommand. Try: backend, use, model, models, detect\n");
+    if (strcmp(args[1], "stream") == 0) {
+        if (args[2] && strcmp(args[2], "on") == 0) {
+            ai_set_streaming(1);
+        } else if (args[2] && strcmp(args[2], "off") == 0) {
+            ai_set_streaming(0);
+        } else if (args[2]) {
+            _puts("Usage: ai stream on|off\n");
+            return;
+        }
+        _puts("Streaming: ");
+        _puts(ai_get_streaming() ? COLOR_GREEN "ON" : COLOR_YELLOW "OFF");
+        _puts(COLOR_RESET);
+        _puts("\n");
+        return;
+    }
+    
+    if (strcmp(args[1], "early") == 0) {
+        if (args[2] && strcmp(args[2], "on") == 0) {
+            safety_set_early_exec(1);
+        } else if (args[2] && strcmp(args[2], "off") == 0) {
+            safety_set_early_exec(0);
+        } else if (args[2]) {
+            _puts("Usage: ai early on|off\n");
+            return;
+        }
+        _puts("Early execution of risk-free commands: ");
+        _puts(safety_get_early_exec() ? COLOR_GREEN "ON" : COLOR_YELLOW "OFF");
+        _puts(COLOR_RESET);
+        _puts("\n");
+        return;
+    }
+    
+    if (strcmp(args[1], "cache") == 0) {
+        if (!args[2] || strcmp(args[2], "stats") == 0) {
+            ai_cache_show_stats();
+            ai_semcache_show_stats();
+        } else if (strcmp(args[2], "clear") == 0) {
+            ai_cache_clear();
+            ai_semcache_clear();
+            _puts("Response cache cleared.\n");
+        } else if (strcmp(args[2], "semantic") == 0) {
+            if (args[3] && strcmp(args[3], "on") == 0) {
+                ai_semcache_set_enabled(1);
+            } else if (args[3] && strcmp(args[3], "off") == 0) {
+                ai_semcache_set_enabled(0);
+            } else if (args[3]) {
+                _puts("Usage: ai cache semantic on|off\n");
+                return;
+            }
+            _puts("Semantic cache: ");
+            _puts(ai_semcache_is_enabled() ? COLOR_GREEN "ON" : COLOR_YELLOW "OFF");
+            _puts(COLOR_RESET);
+            _puts("\n");
+        } else if (strcmp(args[2], "on") == 0) {
+            ai_cache_set_enabled(1);
+            _puts(COLOR_GREEN);
+            _puts("Response cache enabled.\n");
+            _puts(COLOR_RESET);
+        } else if (strcmp(args[2], "off") == 0) {
+            ai_cache_set_enabled(0);
+            _puts(COLOR_YELLOW);
+            _puts("Response cache disabled.\n");
+            _puts(COLOR_RESET);
+        } else {
+            _puts("Usage: ai cache [stats|clear|on|off|semantic on|off]\n");
+        }
+        return;
+    }
+    
+    if (strcmp(args[1], "hedge") == 0) {
+        if (args[2] && strcmp(args[2], "on") == 0) {
+            ai_set_hedging(1);
+        } else if (args[2] && strcmp(args[2], "off") == 0) {
+            ai_set_hedging(0);
+        } else if (args[2]) {
+            _puts("Usage: ai hedge on|off\n");
+            return;
+        }
+        _puts("Hedged requests: ");
+        _puts(ai_get_hedging() ? COLOR_GREEN "ON" : COLOR_YELLOW "OFF");
+        _puts(COLOR_RESET);
+        _puts("\n");
+        for (int i = 0; i < AI_BACKEND_COUNT; i++) {
+            if (!ai_backend_available((AIBackendType)i)) continue;
+            char line[128];
+            snprintf(line, sizeof(line), "  %-9s backup sent after %ld ms without a reply\n",
+                     ai_get_backend_name((AIBackendType)i),
+                     ai_get_hedge_delay_ms((AIBackendType)i));
+            _puts(line);
+        }
+        return;
+    }
+    
+    if (strcmp(args[1], "cascade") == 0) {
+        if (args[2] && strcmp(args[2], "on") == 0) {
+            ai_set_cascade(1);
+        } else if (args[2] && strcmp(args[2], "off") == 0) {
+            ai_set_cascade(0);
+        } else if (args[2]) {
+            _puts("Usage: ai cascade on|off\n");
+            return;
+        }
+        _puts("Cascade routing: ");
+        _puts(ai_get_cascade() ? COLOR_GREEN "ON" : COLOR_YELLOW "OFF");
+        _puts(COLOR_RESET);
+        _puts("\n");
+        for (int i = 0; i < AI_BACKEND_COUNT; i++) {
+            if (!ai_backend_available((AIBackendType)i)) continue;
+            const char *fast = ai_get_fast_model((AIBackendType)i, TASK_SHELL_COMMAND);
+            char line[320];
+            snprintf(line, sizeof(line), "  %-9s %s\n", ai_get_backend_name((AIBackendType)i),
+                     fast ? fast : "(no fast model)");
+            _puts(line);
+        }
+        return;
+    }
+    
+    if (strcmp(args[1], "local") == 0) {
+        if (args[2] && strcmp(args[2], "on") == 0) {
+            intent_set_enabled(1);
+        } else if (args[2] && strcmp(args[2], "off") == 0) {
+            intent_set_enabled(0);
+        } else if (args[2]) {
+            _puts("Usage: ai local on|off\n");
+            return;
+        }
+        _puts("Local intents: ");
+        _puts(intent_get_enabled() ? COLOR_GREEN "ON" : COLOR_YELLOW "OFF");
+        _puts(COLOR_RESET);
+        char line[640];
+        snprintf(line, sizeof(line), "\n  %d templates; site templates from %s\n",
+                 intent_count(), intent_path()[0] ? intent_path() : "(no HOME)");
+        _puts(line);
+        return;
+    }
+    
+    if (strcmp(args[1], "bg") == 0) {
+        if (!args[2]) {
+            _puts("Usage: ai bg <prompt>\n");
+            return;
+        }
+        StrBuf prompt = {0};
+        for (int i = 2; args[i]; i++) {
+            if (i > 2) strbuf_puts(&prompt, " ");
+            strbuf_puts(&prompt, args[i]);
+        }
+        if (prompt.data) handle_ai_background(prompt.data);
+        strbuf_free(&prompt);
+        return;
+    }
+    
+    if (strcmp(args[1], "jobs") == 0) {
+        ai_jobs_show();
+        return;
+    }
+    
+    if (strcmp(args[1], "fg") == 0) {
+        ai_fg_command(args[2]);
+        return;
+    }
+    
+    _puts("Unknown ai subcommand. Try: backend, use, model, models, detect, stream, early, cache, hedge, cascade, local, bg, jobs, fg\n");
 }
 
 /* Sandbox builtin command */
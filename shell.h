@@ -36,10 +36,20 @@
 "\n"\
 "AI COMMANDS:\n"\
 "  ai backend     - List available AI backends\n"\
-"  ai use <name>  - Switch AI backend (gemini/openai/claude/deepseek/ollama)\n"\
+"  ai use <name>  - Switch AI backend (gemini/openai/claude/deepseek/ollama/local)\n"\
+"  ai use auto    - Send each query to the fastest backend suited to its task\n"\
 "  ai model <name> - Set model for current backend\n"\
-"  ai models      - List installed Ollama models\n"\
+"  ai models [refresh] - List installed Ollama models (refresh: re-read now)\n"\
+"  ai model opts [key value] - Ollama options for the current model\n"\
+"                   (keep_alive, num_ctx, num_thread, num_predict; 'default' clears)\n"\
 "  ai detect      - Show model detection status\n"\
+"  ai stream on|off - Stream responses as they are generated\n"\
+"  ai early on|off  - Start risk-free commands while the response streams\n"\
+"  ai cache [stats|clear|on|off|semantic on|off] - Manage the response caches\n"\
+"  ai hedge on|off  - Race the next backend when the active one is slow\n"\
+"  ai cascade on|off - Try a fast model first; escalate if its answer fails checks\n"\
+"  ai local on|off  - Answer common requests from local templates, offline\n"\
+"  ai bg <query>, <query> & - Ask in the background; ai jobs, ai fg [n]\n"\
 "\n"\
 "TASK DETECTION:\n"\
 "  Auto-detects task type (code/shell/automation) and selects optimal model\n"\
@@ -67,9 +77,32 @@
 "  OPENAI_API_KEY     - OpenAI API key\n"\
 "  ANTHROPIC_API_KEY  - Anthropic Claude API key\n"\
 "  DEEPSEEK_API_KEY   - DeepSeek API key\n"\
-"  OLLAMA_HOST        - Ollama server URL (default: localhost:11434)\n"\
+"  OLLAMA_HOST        - Ollama server URL(s), comma-separated (default: localhost:11434)\n"\
+"  CORTEX_<BACKEND>_ENDPOINTS - Server pool; CORTEX_ENDPOINT_POLICY=latency to weight by speed\n"\
+"  CORTEX_LOCAL_MODEL - GGUF model for the in-process backend (make LLAMA=1)\n"\
+"  CORTEX_LOCAL_CTX/_PREDICT/_THREADS - Its context, reply cap and threads\n"\
+"  CORTEX_OLLAMA_TAGS_TTL - Seconds to trust the Ollama model list (default: 60)\n"\
+"  CORTEX_OLLAMA_KEEP_ALIVE - How long Ollama keeps the model loaded (default: 30m)\n"\
+"  CORTEX_OLLAMA_CONF - Ollama options file (default: ~/.config/cortexcli/ollama.conf)\n"\
+"  CORTEX_OLLAMA_WARMUP - Set to 0 to skip loading the Ollama model at startup\n"\
 "  CORTEX_SANDBOX     - Enable sandbox mode (1)\n"\
-"  CORTEX_LANG        - Preferred language\n"
+"  CORTEX_LANG        - Preferred language\n"\
+"  CORTEX_STREAM      - Set to 0 to disable response streaming\n"\
+"  CORTEX_EARLY_EXEC  - Set to 1 to run risk-free commands while streaming\n"\
+"  CORTEX_CACHE[_TTL|_MAX_MB] - 0 = no response cache; entry seconds (86400); MB cap (16)\n"\
+"  CORTEX_SEMCACHE    - 1 = reuse answers to similar questions (CORTEX_EMBED_MODEL,\n"\
+"                       CORTEX_SEMCACHE_THRESHOLD 0.90, CORTEX_SEMCACHE_MAX 10000)\n"\
+"  CORTEX_CONTEXT_TOKENS - Prompt context budget (default: 1536 Ollama, 6144 cloud)\n"\
+"  CORTEX_COALESCE_MS - Reuse window for identical queries (default: 10000)\n"\
+"  CORTEX_VULN_BATCH_TOKENS - Service-list budget per scan research request (default: 1024)\n"\
+"  CORTEX_ROUTE       - Set to auto to start with auto routing\n"\
+"  CORTEX_ROUTER_FILE - Latency statistics file (default: ~/.cache/cortexcli/router)\n"\
+"  CORTEX_HEDGE[_DELAY_MS] - 1 = hedged requests; fixed hedge delay (default: observed p95)\n"\
+"  CORTEX_CASCADE     - Set to 1 to try a fast model before the chosen one\n"\
+"  CORTEX_INTENTS_FILE - Site intent templates (default: ~/.config/cortexcli/intents)\n"\
+"  CORTEX_BREAKER_FAILURES/_COOLDOWN - Failures that take a backend out (3, 0 = off); seconds out (30)\n"\
+"  CORTEX_RATELIMIT_WAIT - Seconds a query may wait out provider rate limits (default: 30)\n"\
+"  CORTEX_RATELIMIT_SHM - Shared rate-limit segment (off = per process)\n"
 
 typedef struct list_path {
     char *dir;
@@ -92,6 +125,13 @@ typedef struct {
     int size;
 } History;
 
+/* Growable string that tracks its length, so appends never rescan */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} StrBuf;
+
 /* Function prototypes */
 int contains_pipes(const char *str);
 char ***parse_pipeline(char *input);
@@ -101,6 +141,10 @@ void _puts(const char *str);
 int _strlen(char *s);
 char *_strdup(char *str);
 char *concat_all(char *name, char *sep, char *value);
+int strbuf_append(StrBuf *sb, const char *s, size_t n);
+int strbuf_puts(StrBuf *sb, const char *s);
+void strbuf_reset(StrBuf *sb);
+void strbuf_free(StrBuf *sb);
 void expand_tilde(char **args);
 void handle_explanation(const char *text);
 void analyze_scan_results(const char *scan_output);
@@ -131,6 +175,7 @@ void _unsetenv(char **arv);
 
 char *get_ai_command(const char *input);
 void handle_ai_command(char *input);
+void handle_ai_background(const char *input);
 void add_custom_history(History *hist, const char *cmd);
 void show_history(char **arv);
 void handle_history_replay(History *hist, const char *cmd);
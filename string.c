@@ -25,4 +25,40 @@ int _putchar(char c) {
 
 void _puts(const char *str) {
     while(str && *str) _putchar(*str++);
-}
\ No newline at end of file
+}
+/* Make room for n more bytes plus the terminator, doubling the capacity */
+static int strbuf_reserve(StrBuf *sb, size_t n) {
+    if (sb->len + n + 1 <= sb->cap) return 0;
+    size_t cap = sb->cap ? sb->cap : 1024;
+    while (sb->len + n + 1 > cap) cap *= 2;
+    char *data = realloc(sb->data, cap);
+    if (!data) return -1;
+    sb->data = data;
+    sb->cap = cap;
+    return 0;
+}
+
+int strbuf_append(StrBuf *sb, const char *s, size_t n) {
+    if (strbuf_reserve(sb, n) != 0) return -1;
+    memcpy(sb->data + sb->len, s, n);
+    sb->len += n;
+    sb->data[sb->len] = '\0';
+    return 0;
+}
+
+int strbuf_puts(StrBuf *sb, const char *s) {
+    return strbuf_append(sb, s, strlen(s));
+}
+
+/* Empty the buffer but keep its memory for the next use */
+void strbuf_reset(StrBuf *sb) {
+    sb->len = 0;
+    if (sb->data) sb->data[0] = '\0';
+}
+
+void strbuf_free(StrBuf *sb) {
+    free(sb->data);
+    sb->data = NULL;
+    sb->len = 0;
+    sb->cap = 0;
+}
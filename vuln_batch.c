@@ -0,0 +1,237 @@
+#include "vuln_batch.h"
+#include "shell.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* Request sizing */
+#define VULN_BATCH_DEFAULT_TOKENS 1024  /* Budget for the service list of one request */
+#define VULN_BATCH_MAX_SERVICES 16      /* Keeps each answer within the reply limit */
+#define VULN_BATCH_MIN_TOKENS 64
+
+#define VULN_BATCH_PROMPT \
+"Research known vulnerabilities for each numbered service below. " \
+"Include CVE references and exploit links if available.\n" \
+"Start the findings for each service with a line 'SERVICE <number>:' using its number, " \
+"then use VULN: or EXPLAIN: lines. Cover every service, in order.\n"
+
+void vuln_batch_init(VulnBatch *batch) {
+    memset(batch, 0, sizeof(*batch));
+}
+
+void vuln_batch_free(VulnBatch *batch) {
+    for (int i = 0; i < batch->count; i++) {
+        free(batch->items[i].findings);
+    }
+    free(batch->items);
+    memset(batch, 0, sizeof(*batch));
+}
+
+/* Rough token count: about four characters per token */
+static int estimate_tokens(size_t len) {
+    return (int)((len + 3) / 4);
+}
+
+/* Add a port to an existing entry, or start a new one */
+static void vuln_batch_add(VulnBatch *batch, int port, const char *proto,
+                           const char *service, const char *version) {
+    char port_str[24];
+    snprintf(port_str, sizeof(port_str), "%d/%s", port, proto);
+
+    for (int i = 0; i < batch->count; i++) {
+        VulnService *item = &batch->items[i];
+        if (strcmp(item->service, service) == 0 && strcmp(item->version, version) == 0) {
+            size_t used = strlen(item->ports);
+            if (used + strlen(port_str) + 3 < sizeof(item->ports)) {
+                snprintf(item->ports + used, sizeof(item->ports) - used, ", %s", port_str);
+            }
+            return;
+        }
+    }
+
+    if (batch->count == batch->capacity) {
+        int capacity = batch->capacity ? batch->capacity * 2 : 16;
+        VulnService *items = realloc(batch->items, sizeof(VulnService) * capacity);
+        if (!items) return;
+        batch->items = items;
+        batch->capacity = capacity;
+    }
+
+    VulnService *item = &batch->items[batch->count++];
+    memset(item, 0, sizeof(*item));
+    snprintf(item->service, sizeof(item->service), "%s", service);
+    snprintf(item->version, sizeof(item->version), "%s", version);
+    snprintf(item->ports, sizeof(item->ports), "%s", port_str);
+}
+
+int vuln_batch_add_line(VulnBatch *batch, const char *line) {
+    int port;
+    char proto[8], state[24], service[64];
+    int rest = 0;
+
+    if (sscanf(line, " %d/%7[a-z] %23s %63s %n", &port, proto, state, service, &rest) != 4) {
+        return 0;
+    }
+    if (strcmp(state, "open") != 0 || rest == 0) return 0;
+
+    /* Everything after the service name is version information */
+    char version[192];
+    snprintf(version, sizeof(version), "%s", line + rest);
+    size_t len = strlen(version);
+    while (len > 0 && isspace((unsigned char)version[len - 1])) version[--len] = '\0';
+    if (len == 0) return 0;
+
+    vuln_batch_add(batch, port, proto, service, version);
+    return 1;
+}
+
+/* Append a line to a growing string */
+static void append_line(char **text, const char *line) {
+    size_t old_len = *text ? strlen(*text) : 0;
+    size_t add = strlen(line);
+    char *grown = realloc(*text, old_len + add + 2);
+    if (!grown) return;
+    memcpy(grown + old_len, line, add);
+    grown[old_len + add] = '\n';
+    grown[old_len + add + 1] = '\0';
+    *text = grown;
+}
+
+/* Skip decoration and a VULN:/EXPLAIN: prefix the model put on a line */
+static const char *strip_line(const char *line) {
+    while (*line == ' ' || *line == '\t' || *line == '*' || *line == '#' || *line == '-') line++;
+    if (strncmp(line, "VULN:", 5) == 0) line += 5;
+    else if (strncmp(line, "EXPLAIN:", 8) == 0) line += 8;
+    while (*line == ' ' || *line == '\t' || *line == '*') line++;
+    return line;
+}
+
+/* "SERVICE 3: ..." -> 3 and the text after the marker; 0 if not a marker */
+static int parse_service_marker(const char *line, const char **rest) {
+    if (strncasecmp(line, "SERVICE", 7) != 0) return 0;
+    line += 7;
+    while (*line == ' ' || *line == '#') line++;
+    if (!isdigit((unsigned char)*line)) return 0;
+
+    int number = (int)strtol(line, (char **)&line, 10);
+    while (*line == ' ' || *line == '*') line++;
+    if (*line == ':' || *line == '.' || *line == ')') line++;
+    while (*line == ' ' || *line == '*') line++;
+    *rest = line;
+    return number;
+}
+
+/* Send one request for items [first, first + count) and split the answer up */
+static int research_chunk(VulnBatch *batch, int first, int count) {
+    size_t size = strlen(VULN_BATCH_PROMPT) + 1;
+    for (int i = 0; i < count; i++) {
+        VulnService *item = &batch->items[first + i];
+        size += strlen(item->service) + strlen(item->version) + strlen(item->ports) + 32;
+    }
+
+    char *query = malloc(size);
+    if (!query) return -1;
+    size_t used = (size_t)snprintf(query, size, "%s", VULN_BATCH_PROMPT);
+    for (int i = 0; i < count && used < size; i++) {
+        VulnService *item = &batch->items[first + i];
+        used += (size_t)snprintf(query + used, size - used, "%d. %s %s (ports %s)\n",
+                                 i + 1, item->service, item->version, item->ports);
+    }
+
+    char *response = get_ai_command(query);
+    free(query);
+    if (!response) return -1;
+
+    /* Lines before any marker belong to the only service, or to none */
+    int current = count == 1 ? 1 : 0;
+    char *saveptr;
+    for (char *line = strtok_r(response, "\n", &saveptr); line;
+         line = strtok_r(NULL, "\n", &saveptr)) {
+        const char *text = strip_line(line);
+        const char *rest;
+        int number = parse_service_marker(text, &rest);
+
+        if (number >= 1 && number <= count) {
+            current = number;
+            text = rest;
+        }
+        if (*text && current > 0) {
+            append_line(&batch->items[first + current - 1].findings, text);
+        }
+    }
+
+    free(response);
+    return 0;
+}
+
+/* Print what came back for one service */
+static void show_findings(const VulnService *item) {
+    _puts(COLOR_MAGENTA);
+    _puts("\n[+] Vulnerabilities for ");
+    _puts(item->service);
+    _puts(" ");
+    _puts(item->version);
+    _puts(" (");
+    _puts(item->ports);
+    _puts(")\n");
+    _puts(COLOR_RESET);
+
+    if (!item->findings) {
+        _puts("  No findings returned\n");
+        return;
+    }
+
+    char *copy = strdup(item->findings);
+    char *saveptr;
+    for (char *line = strtok_r(copy, "\n", &saveptr); line;
+         line = strtok_r(NULL, "\n", &saveptr)) {
+        _puts("  ");
+        _puts(line);
+        _puts("\n");
+    }
+    free(copy);
+}
+
+void vuln_batch_research(VulnBatch *batch) {
+    if (batch->count == 0) return;
+
+    int budget = VULN_BATCH_DEFAULT_TOKENS;
+    char *env_budget = getenv("CORTEX_VULN_BATCH_TOKENS");
+    if (env_budget && atoi(env_budget) >= VULN_BATCH_MIN_TOKENS) {
+        budget = atoi(env_budget);
+    }
+
+    char status[128];
+    snprintf(status, sizeof(status), "\n[+] Researching %d distinct service%s...\n",
+             batch->count, batch->count == 1 ? "" : "s");
+    _puts(COLOR_MAGENTA);
+    _puts(status);
+    _puts(COLOR_RESET);
+
+    int first = 0;
+    while (first < batch->count) {
+        /* Grow the chunk until the next service would exceed the budget */
+        int count = 0, tokens = 0;
+        while (first + count < batch->count && count < VULN_BATCH_MAX_SERVICES) {
+            VulnService *item = &batch->items[first + count];
+            int cost = estimate_tokens(strlen(item->service) + strlen(item->version) +
+                                       strlen(item->ports) + 16);
+            if (count > 0 && tokens + cost > budget) break;
+            tokens += cost;
+            count++;
+        }
+
+        if (research_chunk(batch, first, count) == 0) {
+            for (int i = first; i < first + count; i++) {
+                show_findings(&batch->items[i]);
+            }
+        } else {
+            _puts(COLOR_RED);
+            _puts("Failed to research vulnerabilities\n");
+            _puts(COLOR_RESET);
+        }
+        first += count;
+    }
+}
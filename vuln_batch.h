@@ -0,0 +1,30 @@
+#ifndef VULN_BATCH_H
+#define VULN_BATCH_H
+
+/* One distinct (service, version) seen in a scan, with every port it is on */
+typedef struct {
+    char service[64];
+    char version[192];
+    char ports[128];        /* "22/tcp, 2222/tcp" */
+    char *findings;         /* Demultiplexed answer lines, NULL if none */
+} VulnService;
+
+typedef struct {
+    VulnService *items;
+    int count;
+    int capacity;
+} VulnBatch;
+
+void vuln_batch_init(VulnBatch *batch);
+void vuln_batch_free(VulnBatch *batch);
+
+/* Add an nmap "PORT STATE SERVICE VERSION" line; returns 1 if it was collected */
+int vuln_batch_add_line(VulnBatch *batch, const char *line);
+
+/*
+ * Research every collected service, several per AI request within the
+ * token budget (CORTEX_VULN_BATCH_TOKENS), and print the findings per service.
+ */
+void vuln_batch_research(VulnBatch *batch);
+
+#endif /* VULN_BATCH_H */